@@ -0,0 +1,102 @@
+/* Copyright (c) 2026 SK hynix, Inc. */
+/* SPDX-License-Identifier: BSD 2-Clause */
+
+/*
+ * Compare hmsdk::allocator and hmsdk::memory_resource with std::allocator on
+ * standard containers.
+ *
+ *   $ HMALLOC_JEMALLOC=1 ./allocator_bench [iterations]
+ *
+ * Each row is the time in milliseconds to fill and destroy the container the
+ * given number of times.
+ */
+
+#include <hmalloc.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <list>
+#include <memory_resource>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+template <typename F>
+static double measure(int iterations, F &&fn) {
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < iterations; i++)
+        fn();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start)
+        .count();
+}
+
+template <template <typename> class Alloc>
+static void bench(const char *name, int iterations) {
+    using map_alloc = Alloc<std::pair<const int, int>>;
+    using map = std::unordered_map<int, int, std::hash<int>, std::equal_to<int>, map_alloc>;
+
+    double vector_time = measure(iterations, [] {
+        std::vector<int, Alloc<int>> v;
+        for (int i = 0; i < 100000; i++)
+            v.push_back(i);
+    });
+    double list_time = measure(iterations, [] {
+        std::list<int, Alloc<int>> l;
+        for (int i = 0; i < 10000; i++)
+            l.push_back(i);
+    });
+    double map_time = measure(iterations, [] {
+        map m;
+        for (int i = 0; i < 10000; i++)
+            m[i] = i;
+    });
+
+    printf("%-24s %12.3f %12.3f %12.3f\n", name, vector_time, list_time, map_time);
+}
+
+template <typename T>
+using hmsdk_allocator = hmsdk::allocator<T>;
+
+static void bench_pmr(const char *name, std::pmr::memory_resource *res, int iterations) {
+    double vector_time = measure(iterations, [res] {
+        std::pmr::vector<int> v(res);
+        for (int i = 0; i < 100000; i++)
+            v.push_back(i);
+    });
+    double list_time = measure(iterations, [res] {
+        std::pmr::list<int> l(res);
+        for (int i = 0; i < 10000; i++)
+            l.push_back(i);
+    });
+    double map_time = measure(iterations, [res] {
+        std::pmr::unordered_map<int, int> m(res);
+        for (int i = 0; i < 10000; i++)
+            m[i] = i;
+    });
+
+    printf("%-24s %12.3f %12.3f %12.3f\n", name, vector_time, list_time, map_time);
+}
+
+int main(int argc, char *argv[]) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 100;
+    hmsdk::memory_resource res;
+
+    if (!getenv("HMALLOC_JEMALLOC"))
+        fprintf(stderr, "warning: HMALLOC_JEMALLOC=1 is not set, "
+                        "hmalloc() uses the built-in slab allocator\n");
+
+    printf("%-24s %12s %12s %12s\n", "allocator", "vector(ms)", "list(ms)", "map(ms)");
+    bench<std::allocator>("std::allocator", iterations);
+    bench<hmsdk_allocator>("hmsdk::allocator", iterations);
+    bench_pmr("pmr new_delete", std::pmr::new_delete_resource(), iterations);
+    bench_pmr("hmsdk::memory_resource", &res, iterations);
+
+    /* the upstream buffers are freed at once when the monotonic resource goes away */
+    {
+        std::pmr::monotonic_buffer_resource mono(1 << 20, &res);
+        bench_pmr("monotonic over hmsdk", &mono, iterations);
+    }
+    return 0;
+}
@@ -0,0 +1,118 @@
+/* Copyright (c) 2026 SK hynix, Inc. */
+/* SPDX-License-Identifier: BSD 2-Clause */
+
+/*
+ * Measure the throughput of hmalloc() and hfree() of the allocator behind
+ * hmalloc, which is the built-in slab allocator unless HMALLOC_JEMALLOC=1 or
+ * HMALLOC_BACKEND=jemalloc selects jemalloc, with or without the per-thread
+ * caches of HMALLOC_TCACHE=1.
+ *
+ *   $ ./backend_bench [max threads] [iterations]
+ *   $ HMALLOC_JEMALLOC=1 ./backend_bench [max threads] [iterations]
+ *   $ HMALLOC_TCACHE=1 ./backend_bench [max threads] [iterations]
+ *
+ * Each thread allocates 64 objects of a size and frees them, in its own
+ * order ("local") or the objects of the previous round of the next thread
+ * ("remote"), which are freed to the cache of another thread than the one
+ * that allocated them.  Each row is millions of pairs of hmalloc() and
+ * hfree() per second over all the threads.
+ */
+
+#include <hmalloc.h>
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define NR_OBJS 64
+
+struct worker {
+    pthread_t thread;
+    size_t size;
+    int iterations;
+    bool remote;
+    pthread_barrier_t *barrier;
+    /* the objects of the current round, which the previous thread frees if remote */
+    void *objs[NR_OBJS];
+    struct worker *next;
+};
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *worker_main(void *arg) {
+    struct worker *w = arg;
+
+    for (int i = 0; i < w->iterations; i++) {
+        for (int j = 0; j < NR_OBJS; j++)
+            w->objs[j] = hmalloc(w->size + (j & 7) * 8);
+        if (!w->remote) {
+            for (int j = 0; j < NR_OBJS; j++)
+                hfree(w->objs[j]);
+            continue;
+        }
+        pthread_barrier_wait(w->barrier);
+        for (int j = 0; j < NR_OBJS; j++)
+            hfree(w->next->objs[j]);
+        pthread_barrier_wait(w->barrier);
+    }
+    return NULL;
+}
+
+static void bench(int nthreads, size_t size, int iterations, bool remote) {
+    struct worker *workers = calloc(nthreads, sizeof(*workers));
+    pthread_barrier_t barrier;
+    double start, elapsed;
+
+    if (!workers) {
+        perror("calloc");
+        return;
+    }
+    pthread_barrier_init(&barrier, NULL, nthreads);
+
+    start = now();
+    for (int t = 0; t < nthreads; t++) {
+        workers[t].size = size;
+        workers[t].iterations = iterations;
+        workers[t].remote = remote;
+        workers[t].barrier = &barrier;
+        workers[t].next = &workers[(t + 1) % nthreads];
+        pthread_create(&workers[t].thread, NULL, worker_main, &workers[t]);
+    }
+    for (int t = 0; t < nthreads; t++)
+        pthread_join(workers[t].thread, NULL);
+    elapsed = now() - start;
+
+    printf("%8d %8zu %8s %12.2f\n", nthreads, size, remote ? "remote" : "local",
+           (double)nthreads * iterations * NR_OBJS / elapsed / 1e6);
+
+    pthread_barrier_destroy(&barrier);
+    free(workers);
+}
+
+int main(int argc, char *argv[]) {
+    int max_threads = argc > 1 ? atoi(argv[1]) : 8;
+    int iterations = argc > 2 ? atoi(argv[2]) : 20000;
+    const char *backend = getenv("HMALLOC_BACKEND");
+    const char *jemalloc = getenv("HMALLOC_JEMALLOC");
+    const char *tcache = getenv("HMALLOC_TCACHE");
+
+    printf("HMALLOC_JEMALLOC=%s HMALLOC_BACKEND=%s HMALLOC_TCACHE=%s\n",
+           jemalloc ? jemalloc : "(unset)", backend ? backend : "(unset)",
+           tcache ? tcache : "(unset)");
+
+    printf("%8s %8s %8s %12s\n", "threads", "size", "free", "Mops/s");
+    for (int nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+        for (size_t size = 16; size <= 4096; size *= 16) {
+            bench(nthreads, size, iterations, false);
+            bench(nthreads, size, iterations, true);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,80 @@
+/* Copyright (c) 2026 SK hynix, Inc. */
+/* SPDX-License-Identifier: BSD 2-Clause */
+
+/*
+ * Compare hmalloc_batch() and hfree_batch() with a loop of hmalloc() and
+ * hfree() for many objects of the same size.
+ *
+ *   $ HMALLOC_JEMALLOC=1 ./batch_bench [count] [rounds]
+ *
+ * Each row is the average time in nanoseconds per object.
+ */
+
+#include <hmalloc.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench(size_t size, void **ptrs, size_t count, int rounds) {
+    double loop_alloc = 0, loop_free = 0, batch_alloc = 0, batch_free = 0;
+    double start;
+
+    for (int r = 0; r < rounds; r++) {
+        start = now();
+        for (size_t i = 0; i < count; i++)
+            ptrs[i] = hmalloc(size);
+        loop_alloc += now() - start;
+
+        start = now();
+        for (size_t i = 0; i < count; i++)
+            hfree(ptrs[i]);
+        loop_free += now() - start;
+
+        start = now();
+        if (hmalloc_batch(size, count, ptrs)) {
+            printf("%10zu   (out of memory)\n", size);
+            return;
+        }
+        batch_alloc += now() - start;
+
+        start = now();
+        hfree_batch(ptrs, count);
+        batch_free += now() - start;
+    }
+
+    count *= rounds;
+    printf("%10zu %12.1f %12.1f %12.1f %12.1f\n", size, loop_alloc * 1e9 / count,
+           batch_alloc * 1e9 / count, loop_free * 1e9 / count, batch_free * 1e9 / count);
+}
+
+int main(int argc, char *argv[]) {
+    size_t count = argc > 1 ? strtoul(argv[1], NULL, 0) : 100000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 10;
+    void **ptrs;
+
+    if (!getenv("HMALLOC_JEMALLOC"))
+        fprintf(stderr, "warning: HMALLOC_JEMALLOC=1 is not set, "
+                        "hmalloc() uses the built-in slab allocator\n");
+
+    ptrs = malloc(count * sizeof(*ptrs));
+    if (!ptrs) {
+        perror("malloc");
+        return 1;
+    }
+
+    printf("%10s %12s %12s %12s %12s\n", "size", "hmalloc(ns)", "batch(ns)", "hfree(ns)",
+           "batch(ns)");
+    for (size_t size = 16; size <= 16384; size *= 4)
+        bench(size, ptrs, count, rounds);
+
+    free(ptrs);
+    return 0;
+}
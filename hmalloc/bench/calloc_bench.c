@@ -0,0 +1,120 @@
+/* Copyright (c) 2026 SK hynix, Inc. */
+/* SPDX-License-Identifier: BSD 2-Clause */
+
+/*
+ * Measure time-to-calloc of hcalloc() on each memory tier.
+ *
+ *   $ HMALLOC_JEMALLOC=1 ./calloc_bench [max size in MiB] [node...]
+ *
+ * "calloc" is the time spent in hcalloc() itself, and "+touch" adds the first
+ * write to every page.  "memset" is hmalloc() followed by memset(), which is
+ * what hcalloc() used to do.  Each of them runs on a new policy destroyed
+ * afterwards, so that both fault in fresh pages instead of reusing the memory
+ * freed by the other.
+ */
+
+#include <hmalloc.h>
+
+#include <numa.h>
+#include <numaif.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define KiB (1024UL)
+#define MiB (1024UL * KiB)
+#define GiB (1024UL * MiB)
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void touch(char *ptr, size_t size) {
+    for (size_t i = 0; i < size; i += 4 * KiB)
+        ptr[i] = 1;
+}
+
+static void bench(int node, const unsigned long *nodemask, size_t size) {
+    double start, calloc_time, touch_time, memset_time;
+    hmalloc_policy_t *policy;
+    char *ptr;
+
+    policy = hmalloc_policy_create(MPOL_BIND, nodemask, HMALLOC_MAX_NODES);
+    if (!policy) {
+        perror("hmalloc_policy_create");
+        return;
+    }
+    start = now();
+    ptr = hcalloc_p(policy, size, sizeof(char));
+    calloc_time = now() - start;
+    if (!ptr) {
+        printf("%4d %10lu   (out of memory)\n", node, size / MiB);
+        hmalloc_policy_destroy(policy);
+        return;
+    }
+    touch(ptr, size);
+    touch_time = now() - start;
+    hfree(ptr);
+    hmalloc_policy_destroy(policy);
+
+    policy = hmalloc_policy_create(MPOL_BIND, nodemask, HMALLOC_MAX_NODES);
+    if (!policy) {
+        perror("hmalloc_policy_create");
+        return;
+    }
+    start = now();
+    ptr = hmalloc_p(policy, size);
+    if (!ptr) {
+        printf("%4d %10lu   (out of memory)\n", node, size / MiB);
+        hmalloc_policy_destroy(policy);
+        return;
+    }
+    memset(ptr, 0, size);
+    memset_time = now() - start;
+    hfree(ptr);
+    hmalloc_policy_destroy(policy);
+
+    printf("%4d %10lu %12.3f %12.3f %12.3f\n", node, size / MiB, calloc_time * 1e3,
+           touch_time * 1e3, memset_time * 1e3);
+}
+
+int main(int argc, char *argv[]) {
+    size_t max_size = 16 * GiB;
+    struct bitmask *nodes;
+
+    if (!getenv("HMALLOC_JEMALLOC"))
+        fprintf(stderr, "warning: HMALLOC_JEMALLOC=1 is not set, "
+                        "hcalloc() uses the built-in slab allocator\n");
+
+    if (argc > 1)
+        max_size = strtoul(argv[1], NULL, 0) * MiB;
+
+    nodes = numa_allocate_nodemask();
+    if (argc > 2) {
+        for (int i = 2; i < argc; i++)
+            numa_bitmask_setbit(nodes, atoi(argv[i]));
+    } else {
+        copy_bitmask_to_bitmask(numa_all_nodes_ptr, nodes);
+    }
+
+    printf("%4s %10s %12s %12s %12s\n", "node", "size(MiB)", "calloc(ms)", "+touch(ms)",
+           "memset(ms)");
+
+    for (unsigned node = 0; node < nodes->size; node++) {
+        unsigned long nodemask[HMALLOC_NODEMASK_LONGS] = {0};
+
+        if (!numa_bitmask_isbitset(nodes, node) || node >= HMALLOC_MAX_NODES)
+            continue;
+
+        nodemask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+        for (size_t size = 1 * MiB; size <= max_size; size *= 4)
+            bench(node, nodemask, size);
+    }
+
+    numa_free_nodemask(nodes);
+    return 0;
+}
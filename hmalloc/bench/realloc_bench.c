@@ -0,0 +1,128 @@
+/* Copyright (c) 2026 SK hynix, Inc. */
+/* SPDX-License-Identifier: BSD 2-Clause */
+
+/*
+ * Measure growing a buffer with hrealloc() on each memory tier.
+ *
+ *   $ HMALLOC_JEMALLOC=1 ./realloc_bench [max size in MiB] [node...]
+ *   $ HMALLOC_JEMALLOC=1 HMALLOC_MREMAP_THRESHOLD=64M ./realloc_bench [max size in MiB] [node...]
+ *
+ * "double" doubles the buffer from 1MiB as a vector does, and "append" grows
+ * it by 64MiB at a time as a log or a column does.  Each step writes the new
+ * part of the buffer.  "mremap" is the number of mremap() calls made by
+ * hmalloc, which stays 0 unless HMALLOC_MREMAP_THRESHOLD is set, and the
+ * rest of the reallocations are either in place or copies.
+ */
+
+#include <hmalloc.h>
+
+#include <numa.h>
+#include <numaif.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define KiB (1024UL)
+#define MiB (1024UL * KiB)
+#define GiB (1024UL * MiB)
+
+#define APPEND_STEP (64 * MiB)
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned long nr_mremap(void) {
+    static struct hmalloc_stats stats;
+
+    if (hmalloc_stats(&stats))
+        return 0;
+    return stats.nr_mremap;
+}
+
+static void bench(int node, hmalloc_policy_t *policy, const char *pattern, size_t max_size) {
+    unsigned long mremaps = nr_mremap();
+    size_t size = 0, new_size;
+    unsigned nr_reallocs = 0;
+    double start, elapsed;
+    char *ptr = NULL;
+
+    start = now();
+    while (size < max_size) {
+        char *new_ptr;
+
+        if (!strcmp(pattern, "double"))
+            new_size = size ? size * 2 : 1 * MiB;
+        else
+            new_size = size + APPEND_STEP;
+        if (new_size > max_size)
+            new_size = max_size;
+
+        new_ptr = hrealloc_p(policy, ptr, new_size);
+        if (!new_ptr) {
+            printf("%4d %8s %10lu   (out of memory)\n", node, pattern, new_size / MiB);
+            hfree(ptr);
+            return;
+        }
+        ptr = new_ptr;
+        memset(ptr + size, 1, new_size - size);
+        size = new_size;
+        nr_reallocs++;
+    }
+    elapsed = now() - start;
+    hfree(ptr);
+
+    printf("%4d %8s %10lu %12.3f %10u %10lu\n", node, pattern, size / MiB, elapsed * 1e3,
+           nr_reallocs, nr_mremap() - mremaps);
+}
+
+int main(int argc, char *argv[]) {
+    size_t max_size = 4 * GiB;
+    struct bitmask *nodes;
+    const char *threshold;
+
+    if (!getenv("HMALLOC_JEMALLOC"))
+        fprintf(stderr, "warning: HMALLOC_JEMALLOC=1 is not set, "
+                        "hrealloc() uses the built-in slab allocator\n");
+    threshold = getenv("HMALLOC_MREMAP_THRESHOLD");
+    printf("HMALLOC_MREMAP_THRESHOLD=%s\n", threshold ? threshold : "(unset)");
+
+    if (argc > 1)
+        max_size = strtoul(argv[1], NULL, 0) * MiB;
+
+    nodes = numa_allocate_nodemask();
+    if (argc > 2) {
+        for (int i = 2; i < argc; i++)
+            numa_bitmask_setbit(nodes, atoi(argv[i]));
+    } else {
+        copy_bitmask_to_bitmask(numa_all_nodes_ptr, nodes);
+    }
+
+    printf("%4s %8s %10s %12s %10s %10s\n", "node", "pattern", "size(MiB)", "time(ms)",
+           "reallocs", "mremap");
+
+    for (unsigned node = 0; node < nodes->size; node++) {
+        unsigned long nodemask[HMALLOC_NODEMASK_LONGS] = {0};
+        hmalloc_policy_t *policy;
+
+        if (!numa_bitmask_isbitset(nodes, node) || node >= HMALLOC_MAX_NODES)
+            continue;
+
+        nodemask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+        policy = hmalloc_policy_create(MPOL_BIND, nodemask, HMALLOC_MAX_NODES);
+        if (!policy) {
+            perror("hmalloc_policy_create");
+            continue;
+        }
+
+        bench(node, policy, "double", max_size);
+        bench(node, policy, "append", max_size);
+    }
+
+    numa_free_nodemask(nodes);
+    return 0;
+}
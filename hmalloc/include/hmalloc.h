@@ -5,21 +5,146 @@
 #define HMALLOC_H
 
 #include <stddef.h>
+#include <stdio.h>
 #include <sys/types.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* hmmap() flag to back an anonymous mapping with huge pages, not passed to mmap() */
+#define HMAP_HUGEPAGE 0x2000000
+
 void *hmalloc(size_t size);
 void hfree(void *ptr);
+void hfree_sized(void *ptr, size_t size);
+void hfree_aligned_sized(void *ptr, size_t alignment, size_t size);
 void *hcalloc(size_t nmemb, size_t size);
 void *hrealloc(void *ptr, size_t size);
 void *haligned_alloc(size_t alignment, size_t size);
 int hposix_memalign(void **memptr, size_t alignment, size_t size);
 void *hmmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset);
 int hmunmap(void *addr, size_t length);
+int hmmap_populate(void *addr, size_t length, int nthreads);
 size_t hmalloc_usable_size(void *ptr);
+int hmalloc_batch(size_t size, size_t count, void **out);
+void hfree_batch(void **ptrs, size_t count);
+
+typedef struct hmalloc_policy hmalloc_policy_t;
+
+hmalloc_policy_t *hmalloc_policy_create(int mode, const unsigned long *nodemask,
+                                        unsigned long maxnode);
+int hmalloc_policy_destroy(hmalloc_policy_t *policy);
+int hmalloc_set_policy(int mode, const unsigned long *nodemask, unsigned long maxnode);
+void hmalloc_thread_set_policy(hmalloc_policy_t *policy);
+hmalloc_policy_t *hmalloc_thread_get_policy(void);
+void *hmalloc_node(size_t size, int node);
+void *hmalloc_p(hmalloc_policy_t *policy, size_t size);
+void *hcalloc_p(hmalloc_policy_t *policy, size_t nmemb, size_t size);
+void *hrealloc_p(hmalloc_policy_t *policy, void *ptr, size_t size);
+void *haligned_alloc_p(hmalloc_policy_t *policy, size_t alignment, size_t size);
+int hposix_memalign_p(hmalloc_policy_t *policy, void **memptr, size_t alignment, size_t size);
+void *hmmap_p(hmalloc_policy_t *policy, void *addr, size_t length, int prot, int flags, int fd,
+              off_t offset);
+int hmalloc_batch_p(hmalloc_policy_t *policy, size_t size, size_t count, void **out);
+
+typedef struct hmpool hmpool_t;
+
+hmpool_t *hmpool_create(size_t obj_size, size_t align, hmalloc_policy_t *policy);
+void hmpool_destroy(hmpool_t *pool);
+void *hmpool_alloc(hmpool_t *pool);
+void hmpool_free(hmpool_t *pool, void *ptr);
+
+typedef struct hmarena hmarena_t;
+
+hmarena_t *hmarena_create(hmalloc_policy_t *policy, size_t chunk_size);
+void hmarena_destroy(hmarena_t *arena);
+void *hmarena_alloc(hmarena_t *arena, size_t size);
+void *hmarena_aligned_alloc(hmarena_t *arena, size_t alignment, size_t size);
+void hmarena_reset(hmarena_t *arena);
+int hmarena_trim(hmarena_t *arena, size_t keep);
+
+/* the maximum number of nodes of the memory policies and hmalloc_stats() */
+#define HMALLOC_MAX_NODES 1024
+
+/* the number of unsigned longs of a nodemask of HMALLOC_MAX_NODES nodes */
+#define HMALLOC_NODEMASK_LONGS (HMALLOC_MAX_NODES / (8 * sizeof(unsigned long)))
+
+/* bucket i of latency histograms counts the latencies in [2^i, 2^(i+1)) ns */
+#define HMALLOC_LATENCY_BUCKETS 32
+
+enum hmalloc_page_kind {
+    HMALLOC_PAGE_BASE, /* base pages */
+    HMALLOC_PAGE_THP,  /* advised for transparent huge pages */
+    HMALLOC_PAGE_2M,   /* 2MB hugetlb pages */
+    HMALLOC_PAGE_1G,   /* 1GB hugetlb pages */
+    HMALLOC_PAGE_KINDS,
+};
+
+struct hmalloc_stats {
+    /* bytes resident on each node among the mappings of hmalloc */
+    size_t resident[HMALLOC_MAX_NODES];
+    /* bytes allocated on each node, estimated from the memory policy of each arena */
+    size_t allocated[HMALLOC_MAX_NODES];
+    /* bytes allocated from arenas whose memory policy has no nodes */
+    size_t allocated_default;
+    /* bytes mapped by hmalloc per enum hmalloc_page_kind */
+    size_t mapped[HMALLOC_PAGE_KINDS];
+
+    /* syscalls made to map and bind extents, hmmap() mappings and huge allocations */
+    unsigned long nr_mmap;
+    unsigned long nr_mmap_failed;
+    unsigned long nr_mbind;
+    unsigned long nr_mbind_failed;
+    unsigned long nr_munmap;
+    unsigned long nr_munmap_failed;
+    unsigned long nr_mremap;
+    unsigned long nr_mremap_failed;
+
+    /* bytes of the jemalloc arenas or the slabs of hmalloc, and of its huge allocations */
+    size_t active;
+    size_t dirty;
+    size_t retained;
+
+    /* sampled latency histograms of hmalloc() and hfree() */
+    unsigned long malloc_latency[HMALLOC_LATENCY_BUCKETS];
+    unsigned long free_latency[HMALLOC_LATENCY_BUCKETS];
+
+    /* nodes under memory pressure and the fallback nodes of HMALLOC_FALLBACK */
+    unsigned long pressured_nodes[HMALLOC_NODEMASK_LONGS];
+    unsigned long fallback_nodes[HMALLOC_NODEMASK_LONGS];
+    /* the global memory policy that new extents are bound to under the pressure */
+    int effective_mode;
+    unsigned long effective_nodemask[HMALLOC_NODEMASK_LONGS];
+    /* ranges bound to the other nodes than their policy because of the pressure */
+    unsigned long nr_fallbacks;
+
+    /* huge allocations copied by hrealloc() as mremap() failed to move them */
+    unsigned long nr_huge_copies;
+};
+
+int hmalloc_stats(struct hmalloc_stats *stats);
+
+/* bytes on each node of the pages in a range or in all the mappings of hmalloc */
+ssize_t hmalloc_where(const void *ptr, size_t length, size_t *counts, size_t nr_nodes);
+int hmalloc_placement_report(FILE *fp, size_t *counts, size_t nr_nodes);
+
+/* a range of pages to be moved to node by hmove() */
+struct hmove {
+    void *addr;
+    /* 0 for the usable size of the object at addr returned by the hmalloc APIs */
+    size_t length;
+    int node;
+    /* optional status of each page, which is the node of the page or -errno */
+    int *status;
+};
+
+typedef void (*hmove_callback_t)(struct hmove *moves, size_t nr_moves, long ret, void *arg);
+
+int hmalloc_migrate(void *ptr, int node);
+long hmove(struct hmove *moves, size_t nr_moves, int flags);
+int hmove_async(struct hmove *moves, size_t nr_moves, int flags, hmove_callback_t callback,
+                void *arg);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,180 @@
+/* Copyright (c) 2026 SK hynix, Inc. */
+/* SPDX-License-Identifier: BSD 2-Clause */
+
+/*
+ * C++ adaptors of the hmalloc APIs so that standard containers can be placed
+ * on a memory tier.
+ *
+ *   std::vector<int, hmsdk::allocator<int>> v;
+ *   std::vector<int, hmsdk::allocator<int, hmsdk::bind_policy<2>>> cxl;
+ *
+ *   hmsdk::memory_resource res(policy);
+ *   std::pmr::vector<int> pv(&res);
+ *
+ * The size is passed back on deallocation so that jemalloc can skip looking
+ * up the size class of the object.
+ */
+
+#ifndef HMALLOC_HPP
+#define HMALLOC_HPP
+
+#include <hmalloc.h>
+
+#include <cstddef>
+#include <initializer_list>
+#include <limits>
+#include <new>
+#include <type_traits>
+
+#if __cplusplus >= 201703L && __has_include(<memory_resource>)
+#include <memory_resource>
+#define HMSDK_HAS_PMR 1
+#endif
+
+namespace hmsdk {
+
+/* the policy of hmalloc(), i.e. hmctl options and HMALLOC_CONF rules */
+struct default_policy {
+    static hmalloc_policy_t *get() noexcept {
+        return nullptr;
+    }
+};
+
+/*
+ * A policy of mode over the nodes, which is created at the first use.  It
+ * throws std::bad_alloc if the policy cannot be created rather than falling
+ * back to the default policy, and it is created again at the next use.
+ */
+template <int Mode, int... Nodes>
+struct static_policy {
+    static hmalloc_policy_t *get() {
+        static hmalloc_policy_t *policy = create();
+        return policy;
+    }
+
+  private:
+    static hmalloc_policy_t *create() {
+        constexpr size_t bits = sizeof(unsigned long) * 8;
+        unsigned long nodemask[HMALLOC_NODEMASK_LONGS] = {};
+        hmalloc_policy_t *policy;
+
+        for (int node : {Nodes...}) {
+            if (node < 0 || node >= HMALLOC_MAX_NODES)
+                throw std::bad_alloc();
+            nodemask[node / bits] |= 1UL << (node % bits);
+        }
+        policy = hmalloc_policy_create(Mode, nodemask, HMALLOC_MAX_NODES);
+        if (policy == nullptr)
+            throw std::bad_alloc();
+        return policy;
+    }
+};
+
+/* MPOL_BIND and MPOL_PREFERRED of <numaif.h> */
+template <int... Nodes>
+using bind_policy = static_policy<2, Nodes...>;
+template <int Node>
+using preferred_policy = static_policy<1, Node>;
+
+namespace detail {
+
+inline void *allocate(hmalloc_policy_t *policy, std::size_t size, std::size_t alignment) {
+    void *ptr;
+
+    /* jemalloc does not take a zero size */
+    if (size == 0)
+        size = 1;
+    if (alignment > alignof(std::max_align_t))
+        ptr = haligned_alloc_p(policy, alignment, size);
+    else
+        ptr = hmalloc_p(policy, size);
+    if (ptr == nullptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+inline void deallocate(void *ptr, std::size_t size, std::size_t alignment) noexcept {
+    if (size == 0)
+        size = 1;
+    if (alignment > alignof(std::max_align_t))
+        hfree_aligned_sized(ptr, alignment, size);
+    else
+        hfree_sized(ptr, size);
+}
+
+} // namespace detail
+
+/* an allocator of the standard containers that allocates from Policy */
+template <typename T, typename Policy = default_policy>
+class allocator {
+  public:
+    using value_type = T;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using propagate_on_container_move_assignment = std::true_type;
+    using is_always_equal = std::true_type;
+
+    template <typename U>
+    struct rebind {
+        using other = allocator<U, Policy>;
+    };
+
+    allocator() noexcept = default;
+
+    template <typename U>
+    allocator(const allocator<U, Policy> &) noexcept {
+    }
+
+    T *allocate(std::size_t n) {
+        if (n > std::numeric_limits<std::size_t>::max() / sizeof(T))
+            throw std::bad_array_new_length();
+        return static_cast<T *>(detail::allocate(Policy::get(), n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *ptr, std::size_t n) noexcept {
+        detail::deallocate(ptr, n * sizeof(T), alignof(T));
+    }
+};
+
+template <typename T, typename U, typename Policy>
+bool operator==(const allocator<T, Policy> &, const allocator<U, Policy> &) noexcept {
+    return true;
+}
+
+template <typename T, typename U, typename Policy>
+bool operator!=(const allocator<T, Policy> &, const allocator<U, Policy> &) noexcept {
+    return false;
+}
+
+#ifdef HMSDK_HAS_PMR
+/* a polymorphic memory resource bound to a policy handle, nullptr for hmalloc() */
+class memory_resource : public std::pmr::memory_resource {
+  public:
+    explicit memory_resource(hmalloc_policy_t *policy = nullptr) noexcept : policy_(policy) {
+    }
+
+    hmalloc_policy_t *policy() const noexcept {
+        return policy_;
+    }
+
+  private:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+        return detail::allocate(policy_, bytes, alignment);
+    }
+
+    void do_deallocate(void *ptr, std::size_t bytes, std::size_t alignment) override {
+        detail::deallocate(ptr, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        auto *res = dynamic_cast<const memory_resource *>(&other);
+        return res && res->policy_ == policy_;
+    }
+
+    hmalloc_policy_t *policy_;
+};
+#endif
+
+} // namespace hmsdk
+
+#endif
@@ -0,0 +1,437 @@
+/* Copyright (c) 2026 SK hynix, Inc. */
+/* SPDX-License-Identifier: BSD 2-Clause */
+
+/*
+ * Placement rules of HMALLOC_CONF and HMALLOC_CONF_FILE.  Each rule maps the
+ * allocations of a size range, an alignment range and a thread name prefix or
+ * glob to a memory policy, e.g.
+ *
+ *   size=-4K default; size=4K-2M interleave=0,1; size=2M- membind=2
+ *
+ * The first matching rule wins.  The rules are compiled once into tables of
+ * policies indexed by size class so that an allocation finds its policy with
+ * a single array load.  A thread looks up its table at its first allocation
+ * and again after conf_generation changes or it is renamed.
+ */
+
+#include "env.h"
+#include "internal.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <numaif.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#ifndef MPOL_PREFERRED_MANY
+#define MPOL_PREFERRED_MANY 5
+#endif
+
+#ifndef MPOL_WEIGHTED_INTERLEAVE
+#define MPOL_WEIGHTED_INTERLEAVE 6
+#endif
+
+/* a rule is a bit of conf_table.matched */
+#define CONF_MAX_RULES 64
+
+/* the tables of the distinct sets of thread patterns that the threads match */
+#define CONF_MAX_THREAD_TABLES 64
+
+/* allocations in [size_min, size_max) with alignment in [align_min, align_max) */
+struct conf_rule {
+    size_t size_min;
+    size_t size_max;
+    size_t align_min;
+    size_t align_max;
+    bool has_align;
+    char thread[CONF_THREAD_LEN];
+    int mode;
+    nodes_t nodemask;
+    struct hmalloc_policy *policy;
+};
+
+static struct conf_rule rules[CONF_MAX_RULES];
+static unsigned nr_rules;
+
+struct conf_table *conf_default;
+__tls struct conf_table *conf_thread;
+/* starts from 1 so that a new thread looks up its table */
+atomic_uint conf_generation = 1;
+__tls unsigned conf_thread_generation;
+
+/* the policies of all the rules compiled so far, which are reused by the same rules */
+static struct hmalloc_policy *conf_policies[HMALLOC_MAX_POLICIES];
+static unsigned nr_conf_policies;
+
+/*
+ * Tables of the threads that match thread patterns, made at the first lookup
+ * of each set of patterns as the names are not known in advance.  They are
+ * mapped directly since the lookup is in the allocation path.
+ */
+static struct conf_table *thread_tables[CONF_MAX_THREAD_TABLES];
+static unsigned nr_thread_tables;
+static bool has_thread_rules;
+static pthread_mutex_t thread_tables_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* "min-max", "min-", "-max" or a single size */
+static bool parse_range(const char *str, size_t *min, size_t *max) {
+    char *end;
+
+    *min = 0;
+    *max = SIZE_MAX;
+    if (*str != '-') {
+        *min = parse_size(str, &end);
+        if (end == str)
+            return false;
+        if (*end == '\0') {
+            *max = *min + 1;
+            return true;
+        }
+        str = end;
+    }
+    if (*str++ != '-')
+        return false;
+    if (*str) {
+        *max = parse_size(str, &end);
+        if (end == str || *end)
+            return false;
+    }
+    return *min < *max;
+}
+
+static const struct {
+    const char *name;
+    int mode;
+} conf_modes[] = {
+    {"membind", MPOL_BIND},
+    {"preferred", MPOL_PREFERRED},
+    {"preferred-many", MPOL_PREFERRED_MANY},
+    {"interleave", MPOL_INTERLEAVE},
+    {"weighted-interleave", MPOL_WEIGHTED_INTERLEAVE},
+};
+
+/* parse whitespace separated key=value conditions and a policy into rule */
+static bool parse_rule(char *str, struct conf_rule *rule) {
+    bool has_policy = false;
+    char *tok, *saveptr;
+
+    *rule = (struct conf_rule){.size_max = SIZE_MAX, .align_max = SIZE_MAX};
+
+    for (tok = strtok_r(str, " \t", &saveptr); tok; tok = strtok_r(NULL, " \t", &saveptr)) {
+        char *value = strchr(tok, '=');
+        bool found = false;
+
+        if (value)
+            *value++ = '\0';
+
+        if (!strcmp(tok, "size") && value) {
+            if (!parse_range(value, &rule->size_min, &rule->size_max))
+                return false;
+            continue;
+        }
+        if (!strcmp(tok, "align") && value) {
+            if (!parse_range(value, &rule->align_min, &rule->align_max))
+                return false;
+            rule->has_align = true;
+            continue;
+        }
+        if (!strcmp(tok, "thread") && value) {
+            if (*value == '\0' || strlen(value) >= CONF_THREAD_LEN)
+                return false;
+            strcpy(rule->thread, value);
+            continue;
+        }
+
+        if (has_policy)
+            return false;
+        has_policy = true;
+
+        if (!strcmp(tok, "default") || !strcmp(tok, "local")) {
+            rule->mode = tok[0] == 'd' ? MPOL_DEFAULT : MPOL_LOCAL;
+            if (value)
+                return false;
+            continue;
+        }
+        for (size_t i = 0; i < sizeof(conf_modes) / sizeof(conf_modes[0]); i++) {
+            if (strcmp(tok, conf_modes[i].name))
+                continue;
+            rule->mode = conf_modes[i].mode;
+            found = true;
+        }
+        if (!found || !value || !parse_nodes(value, &rule->nodemask))
+            return false;
+        if (rule->mode == MPOL_PREFERRED && nodes_weight(&rule->nodemask) != 1)
+            return false;
+    }
+    return has_policy;
+}
+
+/* rules separated by ';' or newlines, empty rules are skipped */
+static bool parse_rules(char *str) {
+    char *rule, *saveptr;
+
+    for (rule = strtok_r(str, ";\n", &saveptr); rule; rule = strtok_r(NULL, ";\n", &saveptr)) {
+        if (strspn(rule, " \t") == strlen(rule))
+            continue;
+        if (nr_rules == CONF_MAX_RULES || !parse_rule(rule, &rules[nr_rules]))
+            return false;
+        nr_rules++;
+    }
+    return true;
+}
+
+/* the rules file has a rule per line and '#' starts a comment */
+static bool parse_file(const char *path) {
+    char *line = NULL;
+    size_t len = 0;
+    bool ret = true;
+    FILE *fp;
+
+    fp = fopen(path, "r");
+    if (!fp)
+        return false;
+
+    while (ret && getline(&line, &len, fp) > 0) {
+        char *comment = strchr(line, '#');
+
+        if (comment)
+            *comment = '\0';
+        ret = parse_rules(line);
+    }
+
+    free(line);
+    fclose(fp);
+    return ret;
+}
+
+/*
+ * The rules with the same policy share the arenas, and so do the rules of the
+ * previous conf_init() calls as the policies are never freed.
+ */
+static struct hmalloc_policy *rule_policy(unsigned index, unsigned narenas) {
+    struct conf_rule *rule = &rules[index];
+    struct hmalloc_policy *policy;
+
+    for (unsigned i = 0; i < nr_conf_policies; i++) {
+        policy = conf_policies[i];
+        if (policy->mode == rule->mode && nodes_equal(&policy->nodemask, &rule->nodemask))
+            return policy;
+    }
+    if (nr_conf_policies == HMALLOC_MAX_POLICIES)
+        return NULL;
+    policy = policy_create(rule->mode, &rule->nodemask, narenas);
+    if (policy)
+        conf_policies[nr_conf_policies++] = policy;
+    return policy;
+}
+
+static inline size_t class_size(unsigned class) {
+    if (class < 4)
+        return class;
+    return (size_t)(4 + class % 4) << (class / 4 - 1);
+}
+
+static bool rule_match(unsigned index, uint64_t matched, size_t size, size_t alignment) {
+    const struct conf_rule *rule = &rules[index];
+
+    if (rule->thread[0] && !(matched & (1ULL << index)))
+        return false;
+    if (size < rule->size_min || size >= rule->size_max)
+        return false;
+    /* the allocations without alignment never match the rules with align */
+    if (rule->has_align &&
+        (alignment == 0 || alignment < rule->align_min || alignment >= rule->align_max))
+        return false;
+    return true;
+}
+
+/* a size class takes the rule that matches the smallest size of the class */
+static void fill_row(struct hmalloc_policy **row, uint64_t matched, size_t alignment) {
+    for (unsigned class = 0; class < CONF_NR_CLASSES; class++) {
+        row[class] = NULL;
+        for (unsigned i = 0; i < nr_rules; i++) {
+            if (rule_match(i, matched, class_size(class), alignment)) {
+                row[class] = rules[i].policy;
+                break;
+            }
+        }
+    }
+}
+
+/* the table of the rules without a thread pattern and the ones in matched */
+static struct conf_table *table_create(uint64_t matched) {
+    struct hmalloc_policy *(*rows)[CONF_NR_CLASSES];
+    size_t rows_size = (CONF_NR_ALIGNS + 1) * sizeof(*rows);
+    struct conf_table table = {.matched = matched}, *ret;
+    unsigned nr_rows = 1;
+
+    rows = mmap(NULL, rows_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (rows == MAP_FAILED)
+        return NULL;
+
+    /* most alignments share a row as only a few rules have align */
+    fill_row(rows[0], matched, 0);
+    for (unsigned lg = 0; lg < CONF_NR_ALIGNS; lg++) {
+        unsigned row;
+
+        fill_row(rows[nr_rows], matched, 1UL << lg);
+        for (row = 0; row < nr_rows; row++) {
+            if (!memcmp(rows[row], rows[nr_rows], sizeof(*rows)))
+                break;
+        }
+        if (row == nr_rows)
+            nr_rows++;
+        table.align_rows[lg] = row;
+    }
+
+    /* the rows follow the table in the same mapping */
+    ret = mmap(NULL, sizeof(*ret) + nr_rows * sizeof(*rows), PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (ret != MAP_FAILED) {
+        *ret = table;
+        ret->policies = (struct hmalloc_policy **)(ret + 1);
+        memcpy(ret->policies, rows, nr_rows * sizeof(*rows));
+    } else {
+        ret = NULL;
+    }
+    munmap(rows, rows_size);
+    return ret;
+}
+
+/* a glob of '*' and '?', as fnmatch() can allocate memory in the allocation path */
+static bool glob_match(const char *pattern, const char *name) {
+    const char *star = NULL, *retry = NULL;
+
+    while (*name) {
+        if (*pattern == '*') {
+            star = ++pattern;
+            retry = name;
+        } else if (*pattern == '?' || *pattern == *name) {
+            pattern++;
+            name++;
+        } else if (star) {
+            pattern = star;
+            name = ++retry;
+        } else {
+            return false;
+        }
+    }
+    while (*pattern == '*')
+        pattern++;
+    return *pattern == '\0';
+}
+
+/* a thread pattern is a glob if it has '*' or '?', otherwise a prefix of the name */
+static bool thread_match(const char *pattern, const char *name) {
+    if (strpbrk(pattern, "*?"))
+        return glob_match(pattern, name);
+    return !strncmp(name, pattern, strlen(pattern));
+}
+
+/*
+ * Wrap pthread_setname_np() so that a thread named after its first allocation
+ * takes the rules of its new name.  A name set by prctl(PR_SET_NAME) is only
+ * seen after the rules are compiled again.
+ */
+int pthread_setname_np(pthread_t thread, const char *name) {
+    static int (*setname)(pthread_t, const char *);
+    int ret;
+
+    if (!setname)
+        *(void **)&setname = dlsym(RTLD_NEXT, "pthread_setname_np");
+    if (!setname)
+        return ENOSYS;
+
+    ret = setname(thread, name);
+    if (ret)
+        return ret;
+    if (pthread_equal(thread, pthread_self()))
+        conf_thread_generation = 0;
+    else
+        atomic_fetch_add(&conf_generation, 1);
+    return 0;
+}
+
+/*
+ * The table of the rules whose thread pattern matches the name of the thread,
+ * which keeps the order of all the rules so that the first matching one wins.
+ */
+struct conf_table *conf_thread_table(void) {
+    struct conf_table *table = NULL;
+    char name[CONF_THREAD_LEN];
+    uint64_t matched = 0;
+
+    if (!has_thread_rules || pthread_getname_np(pthread_self(), name, sizeof(name)))
+        return conf_default;
+
+    for (unsigned i = 0; i < nr_rules; i++) {
+        if (rules[i].thread[0] && thread_match(rules[i].thread, name))
+            matched |= 1ULL << i;
+    }
+    if (matched == 0)
+        return conf_default;
+
+    pthread_mutex_lock(&thread_tables_lock);
+    for (unsigned i = 0; i < nr_thread_tables && !table; i++) {
+        if (thread_tables[i]->matched == matched)
+            table = thread_tables[i];
+    }
+    if (!table && nr_thread_tables < CONF_MAX_THREAD_TABLES) {
+        table = table_create(matched);
+        if (table)
+            thread_tables[nr_thread_tables++] = table;
+    }
+    pthread_mutex_unlock(&thread_tables_lock);
+    return table ? table : conf_default;
+}
+
+/*
+ * Compile the rules of HMALLOC_CONF followed by the ones of HMALLOC_CONF_FILE.
+ * All the rules are ignored if any of them is invalid.
+ */
+void conf_init(unsigned narenas) {
+    const char *env = getenv_conf();
+    const char *path = getenv_conf_file();
+    bool ret = true;
+
+    conf_default = NULL;
+    nr_rules = 0;
+    has_thread_rules = false;
+    /* the old tables stay mapped for the threads that still look them up */
+    pthread_mutex_lock(&thread_tables_lock);
+    nr_thread_tables = 0;
+    pthread_mutex_unlock(&thread_tables_lock);
+
+    if (env) {
+        char *str = strdup(env);
+
+        ret = str && parse_rules(str);
+        free(str);
+    }
+    if (ret && path)
+        ret = parse_file(path);
+    if (!ret || nr_rules == 0)
+        return;
+
+    if (narenas > nr_rules)
+        narenas /= nr_rules;
+    else
+        narenas = 1;
+
+    for (unsigned i = 0; i < nr_rules; i++) {
+        rules[i].policy = rule_policy(i, narenas);
+        if (!rules[i].policy)
+            return;
+    }
+
+    for (unsigned i = 0; i < nr_rules; i++)
+        has_thread_rules |= rules[i].thread[0] != '\0';
+
+    /* set at last as it enables the lookup */
+    conf_default = table_create(0);
+    atomic_fetch_add(&conf_generation, 1);
+}
@@ -0,0 +1,210 @@
+/* Copyright (c) 2026 SK hynix, Inc. */
+/* SPDX-License-Identifier: BSD 2-Clause */
+
+/*
+ * The control socket of HMALLOC_CONTROL that lets hmctl --pid change the
+ * memory policy of a running process without restarting it.  A thread named
+ * hmcontrol serves the requests of control.h one connection at a time, and
+ * only the clients of the same user or root are served.
+ */
+
+#include "control.h"
+#include "env.h"
+#include "hmalloc.h"
+#include "internal.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static struct sockaddr_un control_addr;
+static int control_fd = -1;
+static pid_t control_pid;
+static bool control_exit_registered;
+
+/* only the process that created the socket removes it */
+static void control_exit(void) {
+    if (control_fd >= 0 && getpid() == control_pid)
+        unlink(control_addr.sun_path);
+}
+
+/* the socket belongs to the parent, which keeps serving it */
+static void control_atfork_child(void) {
+    if (control_fd >= 0)
+        close(control_fd);
+    control_fd = -1;
+}
+
+static bool peer_allowed(int fd) {
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len))
+        return false;
+    return cred.uid == 0 || cred.uid == geteuid();
+}
+
+/* read a request line, which a client sends at once */
+static ssize_t read_line(int fd, char *buf, size_t size) {
+    size_t len = 0;
+
+    while (len < size - 1) {
+        ssize_t ret = read(fd, buf + len, size - 1 - len);
+
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return -1;
+        len += ret;
+        if (memchr(buf, '\n', len))
+            break;
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+static int control_request(char *line) {
+    nodes_t nodemask;
+    char *nodes;
+    int mode, len;
+
+    line[strcspn(line, "\n")] = '\0';
+    if (sscanf(line, "policy %d%n", &mode, &len) != 1)
+        return EINVAL;
+
+    nodes = line + len;
+    nodes += strspn(nodes, " ");
+    nodes_zero(&nodemask);
+    if (*nodes && !parse_nodes(nodes, &nodemask))
+        return EINVAL;
+    if (hmalloc_set_policy(mode, nodemask.bits, HMALLOC_MAX_NODES))
+        return errno;
+    return 0;
+}
+
+static void control_serve(int fd) {
+    /* a client that does not send its request in time is dropped */
+    struct timeval timeout = {.tv_sec = 1};
+    char buf[HMALLOC_CONTROL_LINE];
+    int len, err = EPERM;
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (peer_allowed(fd)) {
+        if (read_line(fd, buf, sizeof(buf)) < 0)
+            return;
+        err = control_request(buf);
+    }
+
+    len = snprintf(buf, sizeof(buf), "%d\n", err);
+    while (write(fd, buf, len) < 0 && errno == EINTR)
+        ;
+}
+
+static void *control_thread(void *arg) {
+    int fd = (int)(intptr_t)arg;
+
+    for (;;) {
+        int conn = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+
+        if (conn < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            break;
+        }
+        control_serve(conn);
+        close(conn);
+    }
+    return NULL;
+}
+
+/* the process runs on without the socket, which hmctl --pid finds missing otherwise */
+static void control_warn(const char *path) {
+    fprintf(stderr, "hmalloc: cannot create the control socket %s: %s\n", path, strerror(errno));
+}
+
+/*
+ * Create the directory of the sockets shared by the processes of the user.  A
+ * default one may be in a shared place such as /tmp, so it has to be owned by
+ * the user and not be accessible to the others.
+ */
+static bool control_mkdir(const char *dir, bool is_default) {
+    struct stat st;
+
+    if (mkdir(dir, 0700) && errno != EEXIST)
+        return false;
+    if (!is_default)
+        return true;
+    if (lstat(dir, &st))
+        return false;
+    if (!S_ISDIR(st.st_mode) || st.st_uid != geteuid() || (st.st_mode & 077)) {
+        errno = EPERM;
+        return false;
+    }
+    return true;
+}
+
+/* create the socket of HMALLOC_CONTROL and its thread if they do not exist */
+void control_init(void) {
+    const char *dir = getenv_control();
+    char buf[PATH_MAX];
+    pthread_attr_t attr;
+    pthread_t thread;
+    int fd;
+
+    if (dir == NULL || control_fd >= 0)
+        return;
+
+    control_addr.sun_family = AF_UNIX;
+    if (!control_path(control_addr.sun_path, sizeof(control_addr.sun_path), dir, getpid())) {
+        errno = ENAMETOOLONG;
+        control_warn(dir);
+        return;
+    }
+
+    if (!control_mkdir(control_dir(dir, buf, sizeof(buf)), control_default(dir))) {
+        control_warn(control_addr.sun_path);
+        return;
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        control_warn(control_addr.sun_path);
+        return;
+    }
+
+    /* a stale socket of an old process with the same pid */
+    unlink(control_addr.sun_path);
+    if (bind(fd, (struct sockaddr *)&control_addr, sizeof(control_addr)) ||
+        chmod(control_addr.sun_path, 0600) || listen(fd, 4))
+        goto err;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, control_thread, (void *)(intptr_t)fd)) {
+        pthread_attr_destroy(&attr);
+        goto err;
+    }
+    pthread_attr_destroy(&attr);
+    pthread_setname_np(thread, "hmcontrol");
+
+    control_fd = fd;
+    control_pid = getpid();
+    if (!control_exit_registered) {
+        pthread_atfork(NULL, NULL, control_atfork_child);
+        atexit(control_exit);
+        control_exit_registered = true;
+    }
+    return;
+
+err:
+    control_warn(control_addr.sun_path);
+    unlink(control_addr.sun_path);
+    close(fd);
+}
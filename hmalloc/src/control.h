@@ -0,0 +1,69 @@
+/* Copyright (c) 2026 SK hynix, Inc. */
+/* SPDX-License-Identifier: BSD 2-Clause */
+
+/* the control socket shared by hmalloc and hmctl */
+
+#ifndef HMALLOC_CONTROL_H
+#define HMALLOC_CONTROL_H
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/* the directory of the sockets of root without XDG_RUNTIME_DIR */
+#define HMALLOC_CONTROL_DIR "/run/hmalloc"
+
+/*
+ * A client sends a single line of request per connection and the process
+ * replies with 0 or an errno in a line:
+ *
+ *   policy <mode> [nodes]
+ *
+ * where mode is MPOL_* and nodes is a node list as HMALLOC_NODES, which is
+ * omitted for MPOL_DEFAULT and MPOL_LOCAL.  The line fits any node list of
+ * HMALLOC_MAX_NODES nodes.
+ */
+#define HMALLOC_CONTROL_LINE 4096
+
+/* true if HMALLOC_CONTROL or hmctl --control asks for the default directory */
+static inline bool control_default(const char *dir) {
+    return dir == NULL || *dir == '\0' || !strcmp(dir, "1");
+}
+
+/*
+ * The directory of the sockets, which is $XDG_RUNTIME_DIR/hmalloc by default,
+ * or /run/hmalloc for root and /tmp/hmalloc-<uid> for the other users without
+ * XDG_RUNTIME_DIR.  It returns NULL if the path does not fit in buf.
+ */
+static inline const char *control_dir(const char *dir, char *buf, size_t size) {
+    const char *runtime = getenv("XDG_RUNTIME_DIR");
+    int len;
+
+    if (!control_default(dir))
+        return dir;
+    if (runtime && *runtime)
+        len = snprintf(buf, size, "%s/hmalloc", runtime);
+    else if (geteuid() == 0)
+        len = snprintf(buf, size, "%s", HMALLOC_CONTROL_DIR);
+    else
+        len = snprintf(buf, size, "/tmp/hmalloc-%d", (int)geteuid());
+    return len > 0 && (size_t)len < size ? buf : NULL;
+}
+
+/* the socket of process pid, or false if the path is too long */
+static inline bool control_path(char *path, size_t size, const char *dir, pid_t pid) {
+    char buf[PATH_MAX];
+    int len;
+
+    dir = control_dir(dir, buf, sizeof(buf));
+    if (dir == NULL)
+        return false;
+    len = snprintf(path, size, "%s/hmalloc.%d.sock", dir, (int)pid);
+    return len > 0 && (size_t)len < size;
+}
+
+#endif
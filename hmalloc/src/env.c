@@ -1,8 +1,13 @@
 /* Copyright (c) 2024 SK hynix, Inc. */
 /* SPDX-License-Identifier: BSD 2-Clause */
 
+#include "env.h"
+
+#include <limits.h>
 #include <numaif.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -14,12 +19,40 @@ bool getenv_jemalloc(void) {
     return false;
 }
 
-unsigned long getenv_nodemask(void) {
-    char *env = getenv("HMALLOC_NODEMASK");
+/* jemalloc is used only if selected, and HMALLOC_JEMALLOC=1 selects it as well */
+int getenv_backend(void) {
+    char *env = getenv("HMALLOC_BACKEND");
+
+    if (env && !strcmp(env, "slab"))
+        return BACKEND_SLAB;
+    if (env && !strcmp(env, "jemalloc"))
+        return BACKEND_JEMALLOC;
+    return getenv_jemalloc() ? BACKEND_JEMALLOC : BACKEND_SLAB;
+}
+
+/*
+ * The nodes of HMALLOC_NODES as a node list such as "0,2-3,64", or the ones
+ * of HMALLOC_NODEMASK as a decimal mask of the nodes below 64 for the old
+ * users.  The mask is empty if neither is set or valid.
+ */
+void getenv_nodemask(nodes_t *nodemask) {
+    char *env = getenv("HMALLOC_NODES");
+    unsigned long mask;
+    char *end;
 
+    nodes_zero(nodemask);
+    if (env) {
+        if (!parse_nodes(env, nodemask))
+            nodes_zero(nodemask);
+        return;
+    }
+
+    env = getenv("HMALLOC_NODEMASK");
     if (!env)
-        return 0;
-    return atol(env);
+        return;
+    mask = strtoul(env, &end, 10);
+    if (end != env && *end == '\0')
+        nodemask->bits[0] = mask;
 }
 
 int getenv_mpol_mode(void) {
@@ -29,3 +62,285 @@ int getenv_mpol_mode(void) {
         return MPOL_DEFAULT;
     return atoi(env);
 }
+
+bool getenv_tcache(void) {
+    char *env = getenv("HMALLOC_TCACHE");
+
+    if (env && !strcmp(env, "1"))
+        return true;
+    return false;
+}
+
+unsigned getenv_narenas(void) {
+    char *env = getenv("HMALLOC_NARENAS");
+
+    if (!env)
+        return 0;
+    return strtoul(env, NULL, 0);
+}
+
+int getenv_arena_select(void) {
+    char *env = getenv("HMALLOC_ARENA_SELECT");
+
+    if (env && !strcmp(env, "cpu"))
+        return ARENA_SELECT_CPU;
+    return ARENA_SELECT_RR;
+}
+
+bool getenv_socket_local(void) {
+    char *env = getenv("HMALLOC_SOCKET_LOCAL");
+
+    if (env && !strcmp(env, "1"))
+        return true;
+    return false;
+}
+
+int getenv_hugepage(void) {
+    char *env = getenv("HMALLOC_HUGEPAGE");
+
+    if (!env)
+        return HUGEPAGE_NONE;
+    if (!strcmp(env, "thp"))
+        return HUGEPAGE_THP;
+    if (!strcmp(env, "2M"))
+        return HUGEPAGE_2M;
+    if (!strcmp(env, "1G"))
+        return HUGEPAGE_1G;
+    return HUGEPAGE_NONE;
+}
+
+/* parse a size in bytes with an optional K, M or G suffix, endp is set after the suffix */
+size_t parse_size(const char *str, char **endp) {
+    unsigned long long size;
+    char *end;
+
+    size = strtoull(str, &end, 0);
+    switch (*end) {
+    case 'G':
+    case 'g':
+        size <<= 10;
+        /* fall through */
+    case 'M':
+    case 'm':
+        size <<= 10;
+        /* fall through */
+    case 'K':
+    case 'k':
+        size <<= 10;
+        end++;
+        break;
+    }
+    if (endp)
+        *endp = end;
+    return size;
+}
+
+/* a node list such as "0,2-3" of the nodes below HMALLOC_MAX_NODES */
+bool parse_nodes(const char *str, nodes_t *nodemask) {
+    char *end;
+
+    nodes_zero(nodemask);
+    for (;;) {
+        unsigned long first, last;
+
+        first = last = strtoul(str, &end, 10);
+        if (end == str)
+            return false;
+        if (*end == '-') {
+            str = end + 1;
+            last = strtoul(str, &end, 10);
+            if (end == str)
+                return false;
+        }
+        if (first > last || last >= HMALLOC_MAX_NODES)
+            return false;
+        for (unsigned long node = first; node <= last; node++)
+            nodes_set(nodemask, node);
+
+        if (*end == '\0')
+            return true;
+        if (*end != ',')
+            return false;
+        str = end + 1;
+    }
+}
+
+/* the node list of parse_nodes(), or false if it does not fit in buf */
+bool format_nodes(const nodes_t *nodemask, char *buf, size_t size) {
+    size_t len = 0;
+    int node, last;
+
+    if (size == 0)
+        return false;
+    buf[0] = '\0';
+    for_each_node_mask(node, nodemask) {
+        int ret;
+
+        /* fold the following nodes into a range */
+        last = node;
+        while (last + 1 < HMALLOC_MAX_NODES && nodes_isset(nodemask, last + 1))
+            last++;
+        if (last == node)
+            ret = snprintf(buf + len, size - len, "%s%d", len ? "," : "", node);
+        else
+            ret = snprintf(buf + len, size - len, "%s%d-%d", len ? "," : "", node, last);
+        if (ret < 0 || (size_t)ret >= size - len)
+            return false;
+        len += ret;
+        node = last;
+    }
+    return true;
+}
+
+size_t getenv_prefault_threshold(void) {
+    char *env = getenv("HMALLOC_PREFAULT_THRESHOLD");
+
+    if (!env)
+        return 0;
+    return parse_size(env, NULL);
+}
+
+size_t getenv_mremap_threshold(void) {
+    char *env = getenv("HMALLOC_MREMAP_THRESHOLD");
+
+    if (!env)
+        return 0;
+    return parse_size(env, NULL);
+}
+
+unsigned getenv_stats_sample(void) {
+    char *env = getenv("HMALLOC_STATS_SAMPLE");
+
+    if (!env)
+        return 0;
+    return strtoul(env, NULL, 0);
+}
+
+bool getenv_stats_print(void) {
+    char *env = getenv("HMALLOC_STATS_PRINT");
+
+    if (env && !strcmp(env, "1"))
+        return true;
+    return false;
+}
+
+/*
+ * Parse "node:weight,node:weight,..." of HMALLOC_WEIGHTS and return the number
+ * of entries.  The whole string is ignored if any entry is invalid.
+ */
+unsigned getenv_weights(int *nodes, unsigned *weights, unsigned max) {
+    char *env = getenv("HMALLOC_WEIGHTS");
+    unsigned n = 0;
+    char *str, *end;
+
+    if (!env)
+        return 0;
+
+    for (str = env; *str && n < max; str = end) {
+        unsigned long node, weight;
+
+        node = strtoul(str, &end, 10);
+        if (end == str || *end != ':' || node >= HMALLOC_MAX_NODES)
+            return 0;
+        str = end + 1;
+        weight = strtoul(str, &end, 10);
+        if (end == str || weight == 0 || weight > 255 || (*end && *end != ','))
+            return 0;
+        if (*end == ',')
+            end++;
+
+        nodes[n] = node;
+        weights[n++] = weight;
+    }
+    return n;
+}
+
+size_t getenv_weight_chunk(void) {
+    char *env = getenv("HMALLOC_WEIGHT_CHUNK");
+
+    if (!env)
+        return 0;
+    return parse_size(env, NULL);
+}
+
+size_t getenv_preload_threshold(void) {
+    char *env = getenv("HMALLOC_PRELOAD_THRESHOLD");
+
+    if (!env)
+        return 0;
+    return parse_size(env, NULL);
+}
+
+size_t getenv_preload_mmap_threshold(void) {
+    char *env = getenv("HMALLOC_PRELOAD_MMAP_THRESHOLD");
+
+    if (!env)
+        return 0;
+    return parse_size(env, NULL);
+}
+
+const char *getenv_conf(void) {
+    return getenv("HMALLOC_CONF");
+}
+
+const char *getenv_conf_file(void) {
+    return getenv("HMALLOC_CONF_FILE");
+}
+
+/* "nodes" of HMALLOC_FALLBACK, empty if it is not set or invalid */
+void getenv_fallback(nodes_t *nodemask) {
+    char *env = getenv("HMALLOC_FALLBACK");
+
+    if (!env || !parse_nodes(env, nodemask))
+        nodes_zero(nodemask);
+}
+
+/*
+ * Parse "low[:high]" of HMALLOC_FALLBACK_WATERMARK, where each is a size with
+ * an optional K, M or G suffix or a percentage of the memory of a node with
+ * '%'.  A percentage is returned as a negative value.
+ */
+bool getenv_fallback_watermark(long *low, long *high) {
+    char *env = getenv("HMALLOC_FALLBACK_WATERMARK");
+    long *values[2] = {low, high};
+    char *str = env, *end;
+
+    if (!env)
+        return false;
+
+    for (int i = 0; i < 2; i++) {
+        size_t value = parse_size(str, &end);
+
+        if (end == str || value > LONG_MAX)
+            return false;
+        *values[i] = value;
+        if (*end == '%') {
+            if (value > 100)
+                return false;
+            *values[i] = -(long)value;
+            end++;
+        }
+        if (i == 0 && *end == '\0') {
+            /* the default high watermark is twice the low one for hysteresis */
+            *high = *low * 2;
+            return true;
+        }
+        if (i == 0 && *end != ':')
+            return false;
+        str = end + 1;
+    }
+    return *end == '\0';
+}
+
+unsigned getenv_fallback_interval(void) {
+    char *env = getenv("HMALLOC_FALLBACK_INTERVAL");
+
+    if (!env)
+        return 0;
+    return strtoul(env, NULL, 0);
+}
+
+/* the directory of the control socket, "1" for the default one */
+const char *getenv_control(void) {
+    return getenv("HMALLOC_CONTROL");
+}
@@ -1,8 +1,53 @@
 /* Copyright (c) 2024 SK hynix, Inc. */
 /* SPDX-License-Identifier: BSD 2-Clause */
 
+#include "nodemask.h"
+
 #include <stdbool.h>
+#include <stddef.h>
+
+enum arena_select {
+    ARENA_SELECT_RR,  /* assign arenas to threads in round-robin */
+    ARENA_SELECT_CPU, /* pick an arena by the current cpu */
+};
+
+enum backend {
+    BACKEND_JEMALLOC, /* the arenas of jemalloc */
+    BACKEND_SLAB,     /* the built-in slab allocator */
+};
+
+enum hugepage_mode {
+    HUGEPAGE_NONE, /* base pages only */
+    HUGEPAGE_THP,  /* transparent huge pages with MADV_HUGEPAGE */
+    HUGEPAGE_2M,   /* 2MB hugetlb pages */
+    HUGEPAGE_1G,   /* 1GB hugetlb pages */
+    HUGEPAGE_NR,
+};
+
+size_t parse_size(const char *str, char **endp);
+bool parse_nodes(const char *str, nodes_t *nodemask);
+bool format_nodes(const nodes_t *nodemask, char *buf, size_t size);
 
 bool getenv_jemalloc(void);
-unsigned long getenv_nodemask(void);
+int getenv_backend(void);
+void getenv_nodemask(nodes_t *nodemask);
 int getenv_mpol_mode(void);
+bool getenv_tcache(void);
+unsigned getenv_narenas(void);
+int getenv_arena_select(void);
+bool getenv_socket_local(void);
+int getenv_hugepage(void);
+size_t getenv_prefault_threshold(void);
+size_t getenv_mremap_threshold(void);
+unsigned getenv_stats_sample(void);
+bool getenv_stats_print(void);
+unsigned getenv_weights(int *nodes, unsigned *weights, unsigned max);
+size_t getenv_weight_chunk(void);
+size_t getenv_preload_threshold(void);
+size_t getenv_preload_mmap_threshold(void);
+const char *getenv_conf(void);
+const char *getenv_conf_file(void);
+void getenv_fallback(nodes_t *nodemask);
+bool getenv_fallback_watermark(long *low, long *high);
+unsigned getenv_fallback_interval(void);
+const char *getenv_control(void);
@@ -2,167 +2,1153 @@
 /* SPDX-License-Identifier: BSD 2-Clause */
 
 #include "env.h"
+#include "hmalloc.h"
+#include "internal.h"
 
 #include <assert.h>
 #include <errno.h>
+#ifdef HAVE_JEMALLOC
 #include <jemalloc/jemalloc.h>
+#endif
+#include <limits.h>
 #include <numa.h>
 #include <numaif.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
 
-#define likely(x) __builtin_expect(!!(x), 1)
-#define unlikely(x) __builtin_expect(!!(x), 0)
+#define is_pow2(val) (((val) & ((val)-1)) == 0)
 
-#define __unused __attribute__((unused))
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
 
-#define is_pow2(val) (((val) & ((val)-1)) == 0)
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+#define HUGEPAGE_2M_SIZE (2UL << 20)
+#define HUGEPAGE_1G_SIZE (1UL << 30)
+
+#ifndef MPOL_WEIGHTED_INTERLEAVE
+#define MPOL_WEIGHTED_INTERLEAVE 6
+#endif
+
+#ifdef HAVE_JEMALLOC
+/* jemalloc encodes an arena index in 12 bits of MALLOCX_ARENA() flags */
+#define HMALLOC_MAX_ARENAS 1024
+
+void *extent_alloc(extent_hooks_t *extent_hooks, void *new_addr, size_t size, size_t alignment,
+                   bool *zero, bool *commit, unsigned arena_ind);
+static bool extent_dalloc(extent_hooks_t *extent_hooks, void *addr, size_t size, bool committed,
+                          unsigned arena_ind);
+static void extent_destroy(extent_hooks_t *extent_hooks, void *addr, size_t size, bool committed,
+                           unsigned arena_ind);
+static bool extent_commit(extent_hooks_t *extent_hooks, void *addr, size_t size, size_t offset,
+                          size_t length, unsigned arena_ind);
+static bool extent_decommit(extent_hooks_t *extent_hooks, void *addr, size_t size, size_t offset,
+                            size_t length, unsigned arena_ind);
+static bool extent_purge_lazy(extent_hooks_t *extent_hooks, void *addr, size_t size, size_t offset,
+                              size_t length, unsigned arena_ind);
+static bool extent_purge_forced(extent_hooks_t *extent_hooks, void *addr, size_t size,
+                                size_t offset, size_t length, unsigned arena_ind);
+static bool extent_split(extent_hooks_t *extent_hooks, void *addr, size_t size, size_t size_a,
+                         size_t size_b, bool committed, unsigned arena_ind);
+static bool extent_merge(extent_hooks_t *extent_hooks, void *addr_a, size_t size_a, void *addr_b,
+                         size_t size_b, bool committed, unsigned arena_ind);
+
+/* the policy set by HMALLOC_MPOL_MODE and HMALLOC_NODEMASK */
+static struct hmalloc_policy global_policy = {
+    .hooks =
+        {
+            .alloc = extent_alloc,
+            .dalloc = extent_dalloc,
+            .destroy = extent_destroy,
+            .commit = extent_commit,
+            .decommit = extent_decommit,
+            .purge_lazy = extent_purge_lazy,
+            .purge_forced = extent_purge_forced,
+            .split = extent_split,
+            .merge = extent_merge,
+        },
+};
+#else
+static struct hmalloc_policy global_policy;
+#endif
+
+struct hmalloc_policy *_Atomic policy_list = &global_policy;
 
 /* global variables set by environment variables */
-static bool use_jemalloc;
-static unsigned long nodemask;
-static int mpol_mode;
+/* allocate from the slabs of slab.c instead of the arenas of jemalloc */
+bool use_slab;
+static bool use_tcache;
+static int arena_select;
+static bool socket_local;
+static int hugepage;
+static size_t prefault_threshold;
+static size_t mremap_threshold;
+static bool stats_print_registered;
+
+/* weighted interleave of the global policy set by HMALLOC_WEIGHTS */
+static struct hmalloc_weights global_weights;
+
+static atomic_uint npolicies = 1;
+static pthread_mutex_t policy_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* MPOL_BIND policies created by hmalloc_node() indexed by node */
+static struct hmalloc_policy *_Atomic *node_policies;
+
+#ifdef HAVE_JEMALLOC
+/* arenas of all the policies, which are handed out to each policy as a slice */
+static unsigned arena_indices[HMALLOC_MAX_ARENAS];
+static unsigned narenas_used;
+#endif
+
+/* policies of the socket local mode indexed by cpu */
+static struct hmalloc_policy **cpu_policies;
+static int ncpus;
 
-static unsigned arena_index;
-static extent_hooks_t *hooks;
+/* the policy of the current thread set by hmalloc_thread_set_policy() */
+static __tls struct hmalloc_policy *thread_policy;
 
+/* the highest possible node, which sizes node_policies */
 static int maxnode;
 
-void *hmmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset) {
+#ifdef HAVE_JEMALLOC
+/* round-robin ticket of the current thread for ARENA_SELECT_RR, stored as ticket + 1 */
+static __tls unsigned thread_arena;
+static atomic_uint next_arena;
+
+/* explicit tcaches of the current thread per policy, stored as "tcache.create" id + 1 */
+static __tls unsigned tcache_ids[HMALLOC_MAX_POLICIES];
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+
+static inline struct hmalloc_policy *policy_of(extent_hooks_t *extent_hooks) {
+    /* extent_alloc() can be called directly without hooks in tests */
+    if (extent_hooks == NULL)
+        return &global_policy;
+    return (struct hmalloc_policy *)extent_hooks;
+}
+#endif
+
+static inline struct hmalloc_policy *current_policy(void) {
+    if (socket_local) {
+        unsigned cpu = sched_getcpu();
+        if (likely(cpu < (unsigned)ncpus))
+            return cpu_policies[cpu];
+    }
+    return &global_policy;
+}
+
+/*
+ * The policy of hmalloc_thread_set_policy() if set, or the one of the first
+ * HMALLOC_CONF rule matching the allocation.
+ */
+static inline struct hmalloc_policy *size_policy(size_t size, size_t alignment) {
+    struct hmalloc_policy *policy = thread_policy;
+
+    if (unlikely(policy))
+        return policy;
+    if (likely(conf_default == NULL))
+        return current_policy();
+    policy = conf_lookup(size, alignment);
+    return policy ? policy : current_policy();
+}
+
+/* syscall wrappers that count the calls and their failures for hmalloc_stats() */
+static inline void *do_mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset) {
     void *new_addr = mmap(addr, length, prot, flags, fd, offset);
+
+    stat_event(STAT_MMAP, new_addr == MAP_FAILED);
+    return new_addr;
+}
+
+static inline int do_munmap(void *addr, size_t length) {
+    int ret = munmap(addr, length);
+
+    stat_event(STAT_MUNMAP, ret != 0);
+    return ret;
+}
+
+/* the node of the index-th chunk, which is laid out by the weights in turn */
+static inline int weighted_node(const struct hmalloc_weights *weights, size_t index) {
+    unsigned slot = index % weights->total;
+    unsigned i;
+
+    for (i = 0; slot >= weights->weights[i]; i++)
+        slot -= weights->weights[i];
+    return weights->nodes[i];
+}
+
+/*
+ * Bind each chunk of the range to a node by its address so that the chunks
+ * keep the ratio of the weights over the extents wherever they are mapped.
+ * The following chunks on the same node are bound at once, and each node is
+ * preferred rather than bound so that the allocation falls back to the other
+ * nodes as the kernel interleave does.
+ */
+static long weighted_bind(const struct hmalloc_weights *weights, void *addr, size_t length) {
+    uintptr_t start = (uintptr_t)addr, end = start + length;
+    size_t chunk = weights->chunk;
+
+    while (start < end) {
+        int node = weighted_node(weights, start / chunk);
+        uintptr_t next = (start / chunk + 1) * chunk;
+        int mode = MPOL_PREFERRED;
+        nodes_t nodemask;
+        long ret;
+
+        while (next < end && weighted_node(weights, next / chunk) == node)
+            next += chunk;
+        if (next > end)
+            next = end;
+
+        nodes_of(&nodemask, node);
+        pressure_fallback(&mode, &nodemask);
+        ret = mbind((void *)start, next - start, mode, nodemask.bits, NODEMASK_MAXNODE, 0);
+        stat_event(STAT_MBIND, ret != 0);
+        if (ret)
+            return ret;
+        start = next;
+    }
+    return 0;
+}
+
+static inline long policy_bind(struct hmalloc_policy *policy, void *addr, size_t length) {
+    const struct hmalloc_weights *weights;
+    nodes_t nodemask;
+    int mode;
+    long ret;
+
+    policy_load(policy, &mode, &nodemask, &weights);
+    if (weights)
+        return weighted_bind(weights, addr, length);
+    if (nodes_empty(&nodemask) && mode != MPOL_LOCAL)
+        return 0;
+    /* new ranges avoid the nodes under pressure while the old ones stay */
+    pressure_fallback(&mode, &nodemask);
+    ret = mbind(addr, length, mode, nodemask.bits, NODEMASK_MAXNODE, 0);
+    stat_event(STAT_MBIND, ret != 0);
+    return ret;
+}
+
+long policy_bind_range(struct hmalloc_policy *policy, void *addr, size_t length) {
+    return policy_bind(policy, addr, length);
+}
+
+static inline size_t hugetlb_page_size(int mode) {
+    if (mode == HUGEPAGE_2M)
+        return HUGEPAGE_2M_SIZE;
+    if (mode == HUGEPAGE_1G)
+        return HUGEPAGE_1G_SIZE;
+    return 0;
+}
+
+static inline int hugetlb_flags(size_t page_size) {
+    return MAP_HUGETLB | (__builtin_ctzl(page_size) << MAP_HUGE_SHIFT);
+}
+
+/*
+ * Map hugetlb pages if the range can be made of whole huge pages.  It fails
+ * when the hugetlb pool has no free pages so that the caller falls back to
+ * base pages.
+ */
+static void *hugetlb_mmap(void *addr, size_t length, int prot, int flags, size_t page_size) {
+    if (page_size == 0 || (length & (page_size - 1)) || ((uintptr_t)addr & (page_size - 1)))
+        return MAP_FAILED;
+    return do_mmap(addr, length, prot, flags | hugetlb_flags(page_size), -1, 0);
+}
+
+static void *map_aligned(size_t size, size_t alignment, int prot, int flags) {
+    size_t map_size = size + alignment - PAGE_SIZE;
+    uintptr_t aligned, end;
+    void *addr;
+
+    /* try the exact size first as mmap() mostly returns an aligned address */
+    addr = do_mmap(NULL, size, prot, flags, -1, 0);
+    if (addr == MAP_FAILED || ((uintptr_t)addr & (alignment - 1)) == 0)
+        return addr;
+    do_munmap(addr, size);
+
+    /* over-map then trim the unaligned head and the remaining tail */
+    if (map_size < size)
+        return MAP_FAILED;
+    addr = do_mmap(NULL, map_size, prot, flags, -1, 0);
+    if (addr == MAP_FAILED)
+        return addr;
+
+    aligned = ((uintptr_t)addr + alignment - 1) & ~(alignment - 1);
+    end = (uintptr_t)addr + map_size;
+    if (aligned > (uintptr_t)addr)
+        do_munmap(addr, aligned - (uintptr_t)addr);
+    if (end > aligned + size)
+        do_munmap((void *)(aligned + size), end - (aligned + size));
+    return (void *)aligned;
+}
+
+/*
+ * Anonymous mappings of hmmap() with HMAP_HUGEPAGE, which is thp unless set
+ * otherwise.  The kind of pages that back the mapping is returned in kind.
+ */
+static void *hugepage_mmap(void *addr, size_t length, int prot, int flags, int *kind) {
+    int mode = hugepage == HUGEPAGE_NONE ? HUGEPAGE_THP : hugepage;
+    void *new_addr;
+
+    new_addr = hugetlb_mmap(addr, length, prot, flags, hugetlb_page_size(mode));
+    if (new_addr != MAP_FAILED) {
+        *kind = mode;
+        return new_addr;
+    }
+
+    /* align the mapping to let the kernel back it with transparent huge pages */
+    if (addr == NULL && length >= HUGEPAGE_2M_SIZE && !(flags & MAP_FIXED))
+        new_addr = map_aligned(length, HUGEPAGE_2M_SIZE, prot, flags);
+    else
+        new_addr = do_mmap(addr, length, prot, flags, -1, 0);
+    if (new_addr != MAP_FAILED && madvise(new_addr, length, MADV_HUGEPAGE) == 0)
+        *kind = HUGEPAGE_THP;
+    return new_addr;
+}
+
+/* prefault large ranges after they are bound so that mbind() still decides placement */
+static inline void *prefault(void *ptr, size_t size) {
+    if (unlikely(prefault_threshold && size >= prefault_threshold && ptr)) {
+        int old_errno = errno;
+
+        hmmap_populate(ptr, size, 0);
+        errno = old_errno;
+    }
+    return ptr;
+}
+
+static void *policy_mmap(struct hmalloc_policy *policy, void *addr, size_t length, int prot,
+                         int flags, int fd, off_t offset) {
+    int kind = HUGEPAGE_NONE;
+    void *new_addr;
+
+    if ((flags & HMAP_HUGEPAGE) && (flags & MAP_ANONYMOUS))
+        new_addr = hugepage_mmap(addr, length, prot, flags & ~HMAP_HUGEPAGE, &kind);
+    else
+        new_addr = do_mmap(addr, length, prot, flags & ~HMAP_HUGEPAGE, fd, offset);
     if (unlikely(new_addr == MAP_FAILED))
         return MAP_FAILED;
 
-    if (nodemask > 0) {
-        long ret = mbind(new_addr, length, mpol_mode, &nodemask, maxnode, 0);
-        if (unlikely(ret)) {
-            int mbind_errno = errno;
-            munmap(new_addr, length);
-            errno = mbind_errno;
-            return NULL;
-        }
+    if (unlikely(policy_bind(policy, new_addr, length))) {
+        int mbind_errno = errno;
+        do_munmap(new_addr, length);
+        errno = mbind_errno;
+        return NULL;
     }
+    /* the mapping is still usable even if it cannot be shown in the stats */
+    range_register(new_addr, length, kind);
+
+    if ((flags & MAP_ANONYMOUS) && (prot & PROT_WRITE))
+        prefault(new_addr, length);
     return new_addr;
 }
 
+void *hmmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset) {
+    return policy_mmap(size_policy(length, 0), addr, length, prot, flags, fd, offset);
+}
+
+void *hmmap_p(hmalloc_policy_t *policy, void *addr, size_t length, int prot, int flags, int fd,
+              off_t offset) {
+    if (policy == NULL)
+        policy = size_policy(length, 0);
+    return policy_mmap(policy, addr, length, prot, flags, fd, offset);
+}
+
 int hmunmap(void *addr, size_t length) {
-    return munmap(addr, length);
+    int ret = do_munmap(addr, length);
+
+    if (ret == 0)
+        range_unregister(addr, length);
+    return ret;
 }
 
-void *extent_alloc(extent_hooks_t *extent_hooks __unused, void *new_addr, size_t size,
-                   size_t alignment __unused, bool *zero __unused, bool *commit __unused,
-                   unsigned arena_ind __unused) {
-    new_addr = hmmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, 0, 0);
-    return new_addr;
+/* map anonymous memory at new_addr only if the range is not used yet */
+static void *extent_map_fixed(void *new_addr, size_t size) {
+    void *addr = do_mmap(new_addr, size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANON | MAP_FIXED_NOREPLACE, -1, 0);
+
+    /* old kernels take MAP_FIXED_NOREPLACE as a hint so check the address as well */
+    if (addr != MAP_FAILED && addr != new_addr) {
+        do_munmap(addr, size);
+        return MAP_FAILED;
+    }
+    return addr;
 }
 
-static bool extent_dalloc(extent_hooks_t *extent_hooks __unused, void *addr, size_t size,
-                          bool committed __unused, unsigned arena_ind __unused) {
-    return hmunmap(addr, size);
+static void *extent_map_aligned(size_t size, size_t alignment) {
+    return map_aligned(size, alignment, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON);
 }
 
-static extent_hooks_t extent_hooks = {
-    .alloc = extent_alloc,
-    .dalloc = extent_dalloc,
-};
+static inline bool is_hugetlb(int kind) {
+    return kind == HUGEPAGE_2M || kind == HUGEPAGE_1G;
+}
+
+/* the mode of HMALLOC_HUGEPAGE read by update_env() */
+int hugepage_mode(void) {
+    return hugepage;
+}
+
+/* the page size of the hugetlb pages of HMALLOC_HUGEPAGE, or of the base pages */
+size_t hugepage_size(void) {
+    return is_hugetlb(hugepage) ? hugetlb_page_size(hugepage) : PAGE_SIZE;
+}
+
+static void *extent_map_hugetlb(void *new_addr, size_t size, size_t alignment) {
+    size_t page_size = hugetlb_page_size(hugepage);
+    int flags = MAP_PRIVATE | MAP_ANON;
+    void *addr;
+
+    if (page_size == 0 || alignment > page_size)
+        return MAP_FAILED;
+    if (new_addr)
+        flags |= MAP_FIXED_NOREPLACE;
+
+    addr = hugetlb_mmap(new_addr, size, PROT_READ | PROT_WRITE, flags, page_size);
+    if (addr != MAP_FAILED && new_addr && addr != new_addr) {
+        do_munmap(addr, size);
+        return MAP_FAILED;
+    }
+    return addr;
+}
+
+/*
+ * Map an extent bound to policy, which backs the arenas of jemalloc and the
+ * slabs of slab.c.  Fresh anonymous pages are always zero-filled.
+ */
+void *extent_map(struct hmalloc_policy *policy, void *new_addr, size_t size, size_t alignment) {
+    int kind = HUGEPAGE_NONE;
+    void *addr;
+
+    /* tests map extents directly without a policy */
+    if (policy == NULL)
+        policy = &global_policy;
+    if (alignment < PAGE_SIZE)
+        alignment = PAGE_SIZE;
+    /* transparent huge pages are only used for 2MB aligned ranges */
+    if (hugepage == HUGEPAGE_THP && size >= HUGEPAGE_2M_SIZE && alignment < HUGEPAGE_2M_SIZE)
+        alignment = HUGEPAGE_2M_SIZE;
+
+    /* fall back to base pages if the hugetlb pool is exhausted */
+    addr = extent_map_hugetlb(new_addr, size, alignment);
+    if (addr != MAP_FAILED)
+        kind = hugepage;
+    /* jemalloc passes new_addr to grow an existing extent in place */
+    else if (new_addr)
+        addr = extent_map_fixed(new_addr, size);
+    else
+        addr = extent_map_aligned(size, alignment);
+    if (unlikely(addr == MAP_FAILED))
+        return NULL;
+
+    if (unlikely(policy_bind(policy, addr, size))) {
+        do_munmap(addr, size);
+        return NULL;
+    }
+
+    if (hugepage == HUGEPAGE_THP && ((uintptr_t)addr & (HUGEPAGE_2M_SIZE - 1)) == 0 &&
+        size >= HUGEPAGE_2M_SIZE && madvise(addr, size, MADV_HUGEPAGE) == 0)
+        kind = HUGEPAGE_THP;
+
+    /* split and merge of hugetlb extents depend on the registry */
+    if (unlikely(!range_register(addr, size, kind) && is_hugetlb(kind))) {
+        do_munmap(addr, size);
+        return NULL;
+    }
+    return addr;
+}
+
+#ifdef HAVE_JEMALLOC
+void *extent_alloc(extent_hooks_t *extent_hooks, void *new_addr, size_t size, size_t alignment,
+                   bool *zero, bool *commit, unsigned arena_ind __unused) {
+    void *addr = extent_map(policy_of(extent_hooks), new_addr, size, alignment);
+
+    if (unlikely(addr == NULL))
+        return NULL;
+
+    /* fresh anonymous pages are always zero-filled and committed */
+    if (zero)
+        *zero = true;
+    if (commit)
+        *commit = true;
+    return addr;
+}
+
+/*
+ * Opt out of deallocation so that jemalloc retains the address space.  The
+ * retained ranges are already bound to the policy and are recycled for new
+ * extents without mmap(), mbind() and munmap() syscalls.
+ */
+static bool extent_dalloc(extent_hooks_t *extent_hooks __unused, void *addr __unused,
+                          size_t size __unused, bool committed __unused,
+                          unsigned arena_ind __unused) {
+    return true;
+}
+
+static void extent_destroy(extent_hooks_t *extent_hooks __unused, void *addr, size_t size,
+                           bool committed __unused, unsigned arena_ind __unused) {
+    range_unregister(addr, size);
+    do_munmap(addr, size);
+}
+
+/*
+ * Decommit only drops the pages and keeps the mapping untouched so that the
+ * memory policy of the range survives without splitting the VMA.  Thus commit
+ * has nothing to do as the range is always accessible.
+ */
+static bool extent_commit(extent_hooks_t *extent_hooks __unused, void *addr __unused,
+                          size_t size __unused, size_t offset __unused, size_t length __unused,
+                          unsigned arena_ind __unused) {
+    return false;
+}
+
+static bool extent_decommit(extent_hooks_t *extent_hooks __unused, void *addr,
+                            size_t size __unused, size_t offset, size_t length,
+                            unsigned arena_ind __unused) {
+    return madvise((char *)addr + offset, length, MADV_DONTNEED) != 0;
+}
+
+static bool extent_purge_lazy(extent_hooks_t *extent_hooks __unused, void *addr,
+                              size_t size __unused, size_t offset, size_t length,
+                              unsigned arena_ind __unused) {
+    return madvise((char *)addr + offset, length, MADV_FREE) != 0;
+}
+
+static bool extent_purge_forced(extent_hooks_t *extent_hooks __unused, void *addr,
+                                size_t size __unused, size_t offset, size_t length,
+                                unsigned arena_ind __unused) {
+    /* private anonymous pages read back as zero after MADV_DONTNEED */
+    return madvise((char *)addr + offset, length, MADV_DONTNEED) != 0;
+}
+
+/* return the page kind of an extent if hugetlb pages may be used, or HUGEPAGE_NONE */
+static int hugetlb_lookup(void *addr) {
+    if (!is_hugetlb(hugepage))
+        return HUGEPAGE_NONE;
+    return range_lookup(addr);
+}
+
+/*
+ * Base page extents can be split and merged freely, but hugetlb extents can
+ * only be split at a huge page boundary and never be merged with base pages.
+ */
+static bool extent_split(extent_hooks_t *extent_hooks __unused, void *addr, size_t size __unused,
+                         size_t size_a, size_t size_b __unused, bool committed __unused,
+                         unsigned arena_ind __unused) {
+    int kind = hugetlb_lookup(addr);
+
+    return is_hugetlb(kind) && (size_a & (hugetlb_page_size(kind) - 1));
+}
+
+static bool extent_merge(extent_hooks_t *extent_hooks __unused, void *addr_a,
+                         size_t size_a __unused, void *addr_b, size_t size_b __unused,
+                         bool committed __unused, unsigned arena_ind __unused) {
+    int kind_a = hugetlb_lookup(addr_a);
+    int kind_b = hugetlb_lookup(addr_b);
+
+    return (is_hugetlb(kind_a) || is_hugetlb(kind_b)) && kind_a != kind_b;
+}
+
+/*
+ * Remember a tcache of a user policy so that hmalloc_policy_destroy() flushes
+ * the objects cached from its arenas by all the threads.  The table is mapped
+ * directly as malloc() may be interposed by hmalloc itself.
+ */
+static bool tcache_register(struct hmalloc_policy *policy, unsigned id) {
+    bool ret = true;
+
+    pthread_mutex_lock(&policy_lock);
+    if (policy->nr_tcaches == policy->tcaches_size) {
+        unsigned new_size = policy->tcaches_size ? policy->tcaches_size * 2
+                                                 : PAGE_SIZE / sizeof(unsigned);
+        unsigned *tcaches = mmap(NULL, new_size * sizeof(unsigned), PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANON, -1, 0);
+
+        if (tcaches == MAP_FAILED) {
+            ret = false;
+            goto out;
+        }
+        if (policy->tcaches) {
+            memcpy(tcaches, policy->tcaches, policy->nr_tcaches * sizeof(unsigned));
+            munmap(policy->tcaches, policy->tcaches_size * sizeof(unsigned));
+        }
+        policy->tcaches = tcaches;
+        policy->tcaches_size = new_size;
+    }
+    policy->tcaches[policy->nr_tcaches++] = id;
+out:
+    pthread_mutex_unlock(&policy_lock);
+    return ret;
+}
+
+/* destroy a tcache of the exiting thread, which is forgotten by its user policy first */
+static void tcache_unregister(unsigned policy_id, unsigned id) {
+    struct hmalloc_policy *policy = atomic_load(&policy_list);
+
+    while (policy && policy->id != policy_id)
+        policy = policy->next;
+    if (!policy || !policy->user) {
+        /* "tcache.destroy" flushes all the cached objects back to their arenas */
+        mallctl("tcache.destroy", NULL, NULL, &id, sizeof(id));
+        return;
+    }
+
+    pthread_mutex_lock(&policy_lock);
+    for (unsigned i = 0; i < policy->nr_tcaches; i++) {
+        if (policy->tcaches[i] == id) {
+            policy->tcaches[i] = policy->tcaches[--policy->nr_tcaches];
+            break;
+        }
+    }
+    mallctl("tcache.destroy", NULL, NULL, &id, sizeof(id));
+    pthread_mutex_unlock(&policy_lock);
+}
+
+static void tcache_destroy(void *arg __unused) {
+    for (unsigned i = 0; i < HMALLOC_MAX_POLICIES; i++) {
+        if (!tcache_ids[i])
+            continue;
+        tcache_unregister(i, tcache_ids[i] - 1);
+        tcache_ids[i] = 0;
+    }
+}
+
+static void tcache_key_init(void) {
+    int err __unused = pthread_key_create(&tcache_key, tcache_destroy);
+    assert(!err);
+}
+
+static int tcache_create(struct hmalloc_policy *policy) {
+    unsigned id;
+    size_t unsigned_size = sizeof(unsigned);
+
+    if (mallctl("tcache.create", &id, &unsigned_size, NULL, 0))
+        return MALLOCX_TCACHE_NONE;
+    if (policy->user && !tcache_register(policy, id)) {
+        mallctl("tcache.destroy", NULL, NULL, &id, sizeof(id));
+        return MALLOCX_TCACHE_NONE;
+    }
+
+    /* the key destructor destroys the tcaches of this thread at thread exit */
+    tcache_ids[policy->id] = id + 1;
+    pthread_setspecific(tcache_key, tcache_ids);
+    return MALLOCX_TCACHE(id);
+}
+
+/*
+ * Each policy has its own tcache because jemalloc hands out cached objects
+ * regardless of the arena they came from.
+ */
+static inline int tcache_flags(struct hmalloc_policy *policy) {
+    if (!use_tcache || unlikely(policy->id >= HMALLOC_MAX_POLICIES))
+        return MALLOCX_TCACHE_NONE;
+    if (likely(tcache_ids[policy->id]))
+        return MALLOCX_TCACHE(tcache_ids[policy->id] - 1);
+    return tcache_create(policy);
+}
+
+/*
+ * The policy of an object being freed is unknown, so freeing into a tcache is
+ * allowed only when there is no other policy to be mixed with.
+ */
+static inline int tcache_free_flags(void) {
+    if (atomic_load_explicit(&npolicies, memory_order_relaxed) > 1)
+        return MALLOCX_TCACHE_NONE;
+    return tcache_flags(&global_policy);
+}
+
+static inline unsigned hmalloc_arena(struct hmalloc_policy *policy) {
+    unsigned narenas = policy->narenas;
+
+    if (narenas == 1)
+        return policy->arenas[0];
+
+    if (arena_select == ARENA_SELECT_CPU) {
+        /* sched_getcpu() is cheap with vDSO or rseq, and -1 also maps to a valid slot */
+        return policy->arenas[(unsigned)sched_getcpu() % narenas];
+    }
+
+    if (unlikely(!thread_arena))
+        thread_arena = atomic_fetch_add_explicit(&next_arena, 1, memory_order_relaxed) + 1;
+    return policy->arenas[(thread_arena - 1) % narenas];
+}
+
+static inline int policy_flags(struct hmalloc_policy *policy) {
+    return MALLOCX_ARENA(hmalloc_arena(policy)) | tcache_flags(policy);
+}
+
+/* create narenas arenas bound to policy into its slice of arena_indices */
+static unsigned arenas_create(struct hmalloc_policy *policy, unsigned narenas) {
+    size_t unsigned_size = sizeof(unsigned);
+    extent_hooks_t *hooks = &policy->hooks;
+    unsigned i;
+
+    for (i = 0; i < narenas; i++) {
+        if (mallctl("arenas.create", &policy->arenas[i], &unsigned_size, (void *)&hooks,
+                    sizeof(extent_hooks_t *)))
+            break;
+    }
+    return i;
+}
+
+/* "arena.<i>.destroy" discards the extents of the arenas with extent_destroy() */
+static void arenas_destroy(struct hmalloc_policy *policy, unsigned narenas) {
+    char name[64];
+
+    for (unsigned i = 0; i < narenas; i++) {
+        snprintf(name, sizeof(name), "arena.%u.destroy", policy->arenas[i]);
+        mallctl(name, NULL, NULL, NULL, 0);
+    }
+}
+
+static int policy_create_arenas(struct hmalloc_policy *policy, unsigned narenas) {
+    if (narenas > HMALLOC_MAX_ARENAS - narenas_used)
+        narenas = HMALLOC_MAX_ARENAS - narenas_used;
+    if (narenas == 0)
+        return -1;
+
+    policy->arenas = &arena_indices[narenas_used];
+    policy->narenas = arenas_create(policy, narenas);
+    narenas_used += policy->narenas;
+    return policy->narenas ? 0 : -1;
+}
+
+/* the arenas can only be destroyed after the tcaches of all the threads are flushed */
+static void policy_destroy_arenas(struct hmalloc_policy *policy) {
+    for (unsigned i = 0; i < policy->nr_tcaches; i++)
+        mallctl("tcache.flush", NULL, NULL, &policy->tcaches[i], sizeof(unsigned));
+    arenas_destroy(policy, policy->narenas);
+}
+#endif
+
+/* must be called with policy_lock held except in hmalloc_init() */
+struct hmalloc_policy *policy_create(int mode, const nodes_t *nodemask,
+                                     unsigned narenas __unused) {
+    struct hmalloc_policy *policy = calloc(1, sizeof(*policy));
+
+    if (!policy)
+        return NULL;
+
+    policy->mode = mode;
+    policy->nodemask = *nodemask;
+    policy->id = atomic_load(&npolicies);
+
+#ifdef HAVE_JEMALLOC
+    /* the arenas are created for HMALLOC_BACKEND=slab as well to switch backends at runtime */
+    policy->hooks = global_policy.hooks;
+    if (policy_create_arenas(policy, narenas)) {
+        free(policy);
+        errno = EAGAIN;
+        return NULL;
+    }
+#endif
+    atomic_fetch_add(&npolicies, 1);
+
+    policy->next = atomic_load(&policy_list);
+    while (!atomic_compare_exchange_weak(&policy_list, &policy->next, policy))
+        ;
+    return policy;
+}
+
+/* nodes in mask that are the closest to the given cpu node */
+static void nearest_nodes(int node, const nodes_t *mask, nodes_t *nearest) {
+    int min_distance = INT_MAX;
+    int n;
+
+    nodes_zero(nearest);
+    for_each_node_mask(n, mask) {
+        int distance;
+
+        if (!numa_bitmask_isbitset(numa_all_nodes_ptr, n))
+            continue;
+
+        distance = numa_distance(node, n);
+        if (distance < min_distance) {
+            min_distance = distance;
+            nodes_of(nearest, n);
+        } else if (distance == min_distance) {
+            nodes_set(nearest, n);
+        }
+    }
+    if (nodes_empty(nearest))
+        *nearest = *mask;
+}
+
+/*
+ * HMALLOC_WEIGHTS only apply to the global policy, and the kernel weights of
+ * MPOL_WEIGHTED_INTERLEAVE are for all the nodes of the tiers, so the nodes
+ * closest to a socket are interleaved evenly.
+ */
+static inline int socket_local_mode(int mode) {
+    return mode == MPOL_WEIGHTED_INTERLEAVE ? MPOL_INTERLEAVE : mode;
+}
+
+/*
+ * Create a policy for each node that has cpus, which binds to the nodes of the
+ * requested tier that are the closest to the node.
+ */
+static void socket_local_init(unsigned narenas) {
+    struct hmalloc_policy **socket_policies;
+    struct bitmask *cpus;
+    int nsockets = 0;
+    int max_node = numa_max_node();
+
+    ncpus = numa_num_configured_cpus();
+    cpu_policies = calloc(ncpus, sizeof(*cpu_policies));
+    socket_policies = calloc(max_node + 1, sizeof(*socket_policies));
+    cpus = numa_allocate_cpumask();
+    if (!cpu_policies || !socket_policies || !cpus)
+        goto out;
+
+    for (int node = 0; node <= max_node; node++) {
+        if (numa_node_to_cpus(node, cpus) || numa_bitmask_weight(cpus) == 0)
+            continue;
+        nsockets++;
+    }
+
+    for (int node = 0; node <= max_node; node++) {
+        struct hmalloc_policy *policy;
+        nodes_t nearest;
+
+        if (numa_node_to_cpus(node, cpus) || numa_bitmask_weight(cpus) == 0)
+            continue;
+
+        nearest_nodes(node, &global_policy.nodemask, &nearest);
+        policy = policy_create(socket_local_mode(global_policy.mode), &nearest,
+                               narenas > (unsigned)nsockets ? narenas / nsockets : 1);
+        if (!policy)
+            goto out;
+        socket_policies[node] = policy;
+    }
+
+    for (int cpu = 0; cpu < ncpus; cpu++) {
+        int node = numa_node_of_cpu(cpu);
+
+        cpu_policies[cpu] = &global_policy;
+        if (node >= 0 && node <= max_node && socket_policies[node])
+            cpu_policies[cpu] = socket_policies[node];
+    }
+    socket_local = true;
+
+out:
+    if (cpus)
+        numa_free_cpumask(cpus);
+    free(socket_policies);
+}
+
+static void update_weights(void) {
+    struct hmalloc_weights *weights = &global_weights;
+    size_t page_size = hugetlb_page_size(hugepage);
+
+    weights->nr_nodes = getenv_weights(weights->nodes, weights->weights, HMALLOC_MAX_WEIGHTS);
+    if (weights->nr_nodes == 0) {
+        global_policy.weights = NULL;
+        return;
+    }
+
+    weights->total = 0;
+    nodes_zero(&global_policy.nodemask);
+    for (unsigned i = 0; i < weights->nr_nodes; i++) {
+        weights->total += weights->weights[i];
+        nodes_set(&global_policy.nodemask, weights->nodes[i]);
+    }
+
+    /*
+     * Each run of chunks on a node is a vma of its own, so small chunks would
+     * exhaust vm.max_map_count with large mappings.  They are raised to 2M,
+     * which also keeps the transparent huge pages.
+     */
+    weights->chunk = getenv_weight_chunk();
+    if (weights->chunk < HUGEPAGE_2M_SIZE || weights->chunk > HUGEPAGE_1G_SIZE ||
+        (weights->chunk & (HUGEPAGE_2M_SIZE - 1)))
+        weights->chunk = HUGEPAGE_2M_SIZE;
+    /* hugetlb pages cannot be split over nodes */
+    if (weights->chunk < page_size)
+        weights->chunk = page_size;
+
+    /* the mode is not used for binding but shows the policy in the stats */
+    global_policy.mode = MPOL_WEIGHTED_INTERLEAVE;
+    global_policy.weights = weights;
+}
 
 void update_env(void) {
-    use_jemalloc = getenv_jemalloc();
-    nodemask = getenv_nodemask();
-    mpol_mode = getenv_mpol_mode();
+#ifdef HAVE_JEMALLOC
+    use_slab = getenv_backend() == BACKEND_SLAB;
+#else
+    /* the built-in allocator is the only one without jemalloc */
+    use_slab = true;
+#endif
+    getenv_nodemask(&global_policy.nodemask);
+    global_policy.mode = getenv_mpol_mode();
+    use_tcache = getenv_tcache();
+    arena_select = getenv_arena_select();
+    hugepage = getenv_hugepage();
+    prefault_threshold = getenv_prefault_threshold();
+    mremap_threshold = getenv_mremap_threshold();
+    /* hugetlb mappings cannot be grown by mremap() on most kernels */
+    if (is_hugetlb(hugepage))
+        mremap_threshold = 0;
+    stats_sample = getenv_stats_sample();
+    update_weights();
 }
 
 __attribute__((constructor)) void hmalloc_init(void) {
     int err __unused;
-    size_t unsigned_size = sizeof(unsigned);
+    unsigned narenas;
 
     update_env();
 
-    if (use_jemalloc) {
-        maxnode = numa_max_possible_node();
-        hooks = &extent_hooks;
-        err = mallctl("arenas.create", &arena_index, &unsigned_size, (void *)&hooks,
-                      sizeof(extent_hooks_t *));
+    maxnode = numa_max_possible_node();
+    if (!node_policies)
+        node_policies = calloc(maxnode + 1, sizeof(*node_policies));
+
+    narenas = getenv_narenas();
+    if (narenas == 0)
+        narenas = numa_num_configured_cpus();
+
+#ifdef HAVE_JEMALLOC
+    /* hmalloc_init() runs again when tests change the environment */
+    if (!global_policy.narenas) {
+        err = policy_create_arenas(&global_policy, narenas);
         assert(!err);
     }
+
+    pthread_once(&tcache_once, tcache_key_init);
+#endif
+
+    if (getenv_socket_local() && !nodes_empty(&global_policy.nodemask) && !socket_local)
+        socket_local_init(narenas);
+
+    conf_init(narenas);
+
+    pressure_init();
+    control_init();
+
+    if (getenv_stats_print() && !stats_print_registered) {
+        atexit(stats_print);
+        stats_print_registered = true;
+    }
 }
 
-void *hmalloc(size_t size) {
+static inline bool to_huge(size_t size) {
+    /* the built-in allocator maps the allocations larger than its size classes directly */
+    if (use_slab && size > SLAB_MAX_SIZE)
+        return true;
+    return unlikely(mremap_threshold && size >= mremap_threshold);
+}
+
+/* hugetlb pages back the huge allocations of a huge page or larger, see huge.c */
+static inline int huge_flags(size_t size) {
+    if (hugepage == HUGEPAGE_THP)
+        return HMAP_HUGEPAGE;
+    if (is_hugetlb(hugepage) && size >= hugetlb_page_size(hugepage))
+        return HMAP_HUGEPAGE;
+    return 0;
+}
+
+/*
+ * An object of a size class is aligned to the alignment its size is rounded
+ * up to as long as the alignment is a page or smaller, see slab.c.
+ */
+static void *slab_malloc(struct hmalloc_policy *policy, size_t size, size_t alignment, bool zero) {
     void *ptr;
 
-    if (!use_jemalloc)
-        return malloc(size);
+    if (alignment <= PAGE_SIZE && size <= SLAB_MAX_SIZE) {
+        /* a zero-sized object still takes the alignment */
+        if (alignment)
+            size = ((size ? size : 1) + alignment - 1) & ~(alignment - 1);
+        if (size <= SLAB_MAX_SIZE) {
+            ptr = slab_alloc(policy, size);
+            if (ptr && zero)
+                memset(ptr, 0, size);
+            return ptr;
+        }
+    }
+    /* fresh mappings are zero-filled */
+    return huge_alloc(policy, size, alignment, huge_flags(size));
+}
+
+/* allocate from the arenas of jemalloc or the slabs, where alignment is 0 or a power of two */
+static inline void *arena_alloc(struct hmalloc_policy *policy, size_t size, size_t alignment,
+                                bool zero) {
+#ifdef HAVE_JEMALLOC
+    if (!use_slab) {
+        int flags = policy_flags(policy);
+
+        if (alignment)
+            flags |= MALLOCX_ALIGN(alignment);
+        /*
+         * jemalloc skips zeroing memory that is known to be zero-filled such as
+         * fresh extents so that huge allocations are not touched twice.
+         */
+        if (zero)
+            flags |= MALLOCX_ZERO;
+        return mallocx(size, flags);
+    }
+#endif
+    return slab_malloc(policy, size, alignment, zero);
+}
+
+static inline size_t arena_usable_size(void *ptr) {
+#ifdef HAVE_JEMALLOC
+    if (!use_slab)
+        return sallocx(ptr, 0);
+#endif
+    return slab_usable_size(ptr);
+}
+
+/* jemalloc finds the owning arena from the extent so no arena flag is needed */
+static inline void arena_free(void *ptr) {
+#ifdef HAVE_JEMALLOC
+    if (!use_slab) {
+        dallocx(ptr, tcache_free_flags());
+        return;
+    }
+#endif
+    slab_free(ptr);
+}
+
+/* objects move to another size class by a copy, which takes the memory of policy */
+static inline void *arena_realloc(struct hmalloc_policy *policy, void *ptr, size_t size) {
+    size_t old_size;
+    void *new_ptr;
+
+#ifdef HAVE_JEMALLOC
+    if (!use_slab)
+        return rallocx(ptr, size, MALLOCX_ARENA(hmalloc_arena(policy)) | tcache_free_flags());
+#endif
+    old_size = slab_usable_size(ptr);
+    if (size <= SLAB_MAX_SIZE && slab_class_size(size) == old_size)
+        return ptr;
 
-    ptr = mallocx(size, MALLOCX_ARENA(arena_index) | MALLOCX_TCACHE_NONE);
-    if (errno == ENOMEM)
+    new_ptr = slab_malloc(policy, size, 0, false);
+    if (unlikely(new_ptr == NULL))
         return NULL;
-    return ptr;
+    memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+    hfree(ptr);
+    return new_ptr;
 }
 
-void hfree(void *ptr) {
+static inline void *policy_malloc(struct hmalloc_policy *policy, size_t size) {
+    void *ptr;
+
+    if (to_huge(size))
+        return huge_alloc(policy, size, 0, huge_flags(size));
+
+    ptr = arena_alloc(policy, size, 0, false);
     if (unlikely(ptr == NULL))
-        return;
-    if (!use_jemalloc) {
-        free(ptr);
-        return;
+        errno = ENOMEM;
+    return prefault(ptr, size);
+}
+
+static inline void *policy_calloc(struct hmalloc_policy *policy, size_t nmemb, size_t size) {
+    size_t total;
+    void *ptr;
+
+    if (unlikely(__builtin_mul_overflow(nmemb, size, &total))) {
+        errno = ENOMEM;
+        return NULL;
     }
-    dallocx(ptr, MALLOCX_ARENA(arena_index) | MALLOCX_TCACHE_NONE);
+
+    /* fresh mappings are zero-filled */
+    if (to_huge(total))
+        return huge_alloc(policy, total, 0, huge_flags(total));
+
+    ptr = arena_alloc(policy, total ? total : 1, 0, true);
+    if (unlikely(ptr == NULL))
+        errno = ENOMEM;
+    return prefault(ptr, total);
 }
 
-void *hcalloc(size_t nmemb, size_t size) {
-    void *ptr = hmalloc(nmemb * size);
+/* grow an object moved by hmove() from the arena of its new node */
+static void *migrated_realloc(struct hmalloc_policy *policy, void *ptr, size_t size) {
+    size_t old_size = arena_usable_size(ptr);
+    void *new_ptr;
 
-    if (likely(ptr))
-        memset(ptr, 0, nmemb * size);
-    return ptr;
+    if (size <= old_size) {
+        new_ptr = arena_realloc(policy, ptr, size);
+        if (new_ptr && new_ptr != ptr)
+            migrate_forget(ptr);
+        return new_ptr;
+    }
+
+    /* growing in place would take the pages from the arena of the old node */
+    new_ptr = policy_malloc(policy, size);
+    if (unlikely(new_ptr == NULL))
+        return NULL;
+    memcpy(new_ptr, ptr, old_size);
+    hfree(ptr);
+    return new_ptr;
 }
 
-void *hrealloc(void *ptr, size_t size) {
-    if (!use_jemalloc)
-        return realloc(ptr, size);
+/* move an object of the arenas to a huge allocation, which is the last copy while it grows */
+static void *arena_to_huge(struct hmalloc_policy *policy, void *ptr, size_t size) {
+    size_t old_size = arena_usable_size(ptr);
+    void *new_ptr;
 
+    new_ptr = huge_alloc(policy, size, 0, huge_flags(size));
+    if (unlikely(new_ptr == NULL))
+        return NULL;
+    memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+    hfree(ptr);
+    return new_ptr;
+}
+
+static inline void *policy_realloc(struct hmalloc_policy *policy, void *ptr, size_t size) {
     if (ptr == NULL)
-        return hmalloc(size);
+        return policy_malloc(policy, size);
 
     if (size == 0) {
         hfree(ptr);
         return NULL;
     }
-    return rallocx(ptr, size, MALLOCX_ARENA(arena_index) | MALLOCX_TCACHE_NONE);
-}
+    /* huge allocations keep their policy, which hmove() changes, and grow without copying */
+    if (unlikely(huge_lookup(ptr)))
+        return huge_realloc(ptr, size);
+    if (unlikely(atomic_load_explicit(&nr_migrated, memory_order_relaxed))) {
+        int node = migrate_lookup(ptr);
+        struct hmalloc_policy *target;
 
-void *haligned_alloc(size_t alignment, size_t size) {
-    if (!use_jemalloc)
-        return aligned_alloc(alignment, size);
+        if (node >= 0 && (target = node_policy(node)))
+            return migrated_realloc(target, ptr, size);
+    }
+    if (to_huge(size))
+        return arena_to_huge(policy, ptr, size);
+    return arena_realloc(policy, ptr, size);
+}
 
+static inline void *policy_aligned_alloc(struct hmalloc_policy *policy, size_t alignment,
+                                         size_t size) {
     /* NOTE: ptmalloc in glibc ignores all these checks unlike jemalloc */
     if (unlikely(alignment == 0 || !is_pow2(alignment))) {
         errno = EINVAL;
         return NULL;
     }
 
-    return mallocx(size,
-                   MALLOCX_ALIGN(alignment) | MALLOCX_ARENA(arena_index) | MALLOCX_TCACHE_NONE);
+    return prefault(arena_alloc(policy, size, alignment, false), size);
 }
 
-int hposix_memalign(void **memptr, size_t alignment, size_t size) {
-    int old_errno;
-
-    if (!use_jemalloc)
-        return posix_memalign(memptr, alignment, size);
-
-    old_errno = errno;
+static inline int policy_posix_memalign(struct hmalloc_policy *policy, void **memptr,
+                                        size_t alignment, size_t size) {
+    int old_errno = errno;
 
     if (unlikely(alignment == 0 || !is_pow2(alignment))) {
         *memptr = NULL;
         return EINVAL;
     }
 
-    *memptr =
-        mallocx(size, MALLOCX_ALIGN(alignment) | MALLOCX_ARENA(arena_index) | MALLOCX_TCACHE_NONE);
+    *memptr = prefault(arena_alloc(policy, size, alignment, false), size);
 
     if (unlikely(*memptr == NULL)) {
         int ret = errno;
@@ -172,11 +1158,432 @@ int hposix_memalign(void **memptr, size_t alignment, size_t size) {
     return 0;
 }
 
+void *hmalloc(size_t size) {
+    uint64_t start;
+    void *ptr;
+
+    if (likely(!stats_sampled()))
+        return policy_malloc(size_policy(size, 0), size);
+
+    start = stats_clock();
+    ptr = policy_malloc(size_policy(size, 0), size);
+    stats_latency(STAT_LATENCY_MALLOC, start);
+    return ptr;
+}
+
+static inline void policy_free(void *ptr) {
+    if (unlikely(atomic_load_explicit(&nr_migrated, memory_order_relaxed)))
+        migrate_forget(ptr);
+    if (unlikely(huge_lookup(ptr)) && huge_free(ptr))
+        return;
+    arena_free(ptr);
+}
+
+void hfree(void *ptr) {
+    uint64_t start;
+
+    if (unlikely(ptr == NULL))
+        return;
+    if (likely(!stats_sampled())) {
+        policy_free(ptr);
+        return;
+    }
+
+    start = stats_clock();
+    policy_free(ptr);
+    stats_latency(STAT_LATENCY_FREE, start);
+}
+
+/*
+ * The size passed to sdallocx() must be in the same size class as the object, or jemalloc
+ * silently corrupts its metadata, so debug builds check it before freeing.  The slabs find
+ * the size class from the object itself.
+ */
+static inline void policy_free_sized(void *ptr, size_t size __unused, size_t alignment __unused) {
+    if (unlikely(atomic_load_explicit(&nr_migrated, memory_order_relaxed)))
+        migrate_forget(ptr);
+    if (unlikely(huge_lookup(ptr)) && huge_free(ptr))
+        return;
+#ifdef HAVE_JEMALLOC
+    if (!use_slab) {
+        int flags = alignment > 1 ? MALLOCX_ALIGN(alignment) : 0;
+
+        /* a wrong size would put the object in another size class and corrupt it */
+        assert(nallocx(size, flags) == sallocx(ptr, 0));
+        sdallocx(ptr, size, flags | tcache_free_flags());
+        return;
+    }
+#endif
+    slab_free(ptr);
+}
+
+static inline void free_sized(void *ptr, size_t size, size_t alignment) {
+    uint64_t start;
+
+    if (unlikely(ptr == NULL))
+        return;
+    if (likely(!stats_sampled())) {
+        policy_free_sized(ptr, size, alignment);
+        return;
+    }
+
+    start = stats_clock();
+    policy_free_sized(ptr, size, alignment);
+    stats_latency(STAT_LATENCY_FREE, start);
+}
+
+void hfree_sized(void *ptr, size_t size) {
+    free_sized(ptr, size, 0);
+}
+
+void hfree_aligned_sized(void *ptr, size_t alignment, size_t size) {
+    free_sized(ptr, size, alignment);
+}
+
+void *hcalloc(size_t nmemb, size_t size) {
+    /* the product may overflow but policy_calloc() fails then anyway */
+    return policy_calloc(size_policy(nmemb * size, 0), nmemb, size);
+}
+
+void *hrealloc(void *ptr, size_t size) {
+    return policy_realloc(size_policy(size, 0), ptr, size);
+}
+
+void *haligned_alloc(size_t alignment, size_t size) {
+    return policy_aligned_alloc(size_policy(size, alignment), alignment, size);
+}
+
+int hposix_memalign(void **memptr, size_t alignment, size_t size) {
+    return policy_posix_memalign(size_policy(size, alignment), memptr, alignment, size);
+}
+
 size_t hmalloc_usable_size(void *ptr) {
-    if (!use_jemalloc)
-        return malloc_usable_size(ptr);
+    size_t length;
 
     if (unlikely(ptr == NULL))
         return 0;
-    return sallocx(ptr, 0);
+    length = huge_lookup(ptr);
+    if (unlikely(length))
+        return length;
+    return arena_usable_size(ptr);
+}
+
+/* check the arguments of a policy in the form of mbind() and fold the nodemask into mask */
+static int policy_args(int mode, const unsigned long *nodemask, unsigned long maxnode,
+                       nodes_t *mask) {
+    nodes_zero(mask);
+    if (mode < MPOL_DEFAULT || mode > MPOL_WEIGHTED_INTERLEAVE) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (unsigned long n = 0; nodemask && n < maxnode; n++) {
+        if (!(nodemask[n / NODEMASK_LONG_BITS] & (1UL << (n % NODEMASK_LONG_BITS))))
+            continue;
+        if (n >= HMALLOC_MAX_NODES) {
+            errno = EINVAL;
+            return -1;
+        }
+        nodes_set(mask, n);
+    }
+
+    if ((mode == MPOL_DEFAULT || mode == MPOL_LOCAL) != nodes_empty(mask)) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+/* reuse a destroyed policy of the same binding, must be called with policy_lock held */
+static struct hmalloc_policy *policy_revive(int mode, const nodes_t *nodemask) {
+    struct hmalloc_policy *policy;
+
+    for (policy = atomic_load(&policy_list); policy; policy = policy->next) {
+        if (policy->dead && policy->mode == mode && nodes_equal(&policy->nodemask, nodemask))
+            break;
+    }
+    if (!policy)
+        return NULL;
+
+#ifdef HAVE_JEMALLOC
+    unsigned narenas = arenas_create(policy, policy->narenas);
+
+    if (narenas != policy->narenas) {
+        arenas_destroy(policy, narenas);
+        return NULL;
+    }
+#endif
+    __atomic_store_n(&policy->dead, false, __ATOMIC_RELEASE);
+    return policy;
+}
+
+hmalloc_policy_t *hmalloc_policy_create(int mode, const unsigned long *nodemask,
+                                        unsigned long maxnode) {
+    struct hmalloc_policy *policy;
+    nodes_t mask;
+
+    if (policy_args(mode, nodemask, maxnode, &mask))
+        return NULL;
+
+    pthread_mutex_lock(&policy_lock);
+    policy = policy_revive(mode, &mask);
+    if (!policy && (policy = policy_create(mode, &mask, 1)))
+        policy->user = true;
+    pthread_mutex_unlock(&policy_lock);
+    return policy;
+}
+
+/*
+ * The arenas of a user policy are destroyed and its empty slabs are unmapped,
+ * but the policy itself is kept for the next hmalloc_policy_create() of the
+ * same binding as the other threads may still cache a few of its slab objects.
+ */
+int hmalloc_policy_destroy(hmalloc_policy_t *policy) {
+    if (policy == NULL || !policy->user) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    pthread_mutex_lock(&policy_lock);
+    if (policy->dead) {
+        pthread_mutex_unlock(&policy_lock);
+        errno = EINVAL;
+        return -1;
+    }
+#ifdef HAVE_JEMALLOC
+    policy_destroy_arenas(policy);
+#endif
+    slab_release(policy);
+    __atomic_store_n(&policy->dead, true, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&policy_lock);
+
+    if (thread_policy == policy)
+        thread_policy = NULL;
+    return 0;
+}
+
+/* change the binding of a policy for policy_load(), must be called with policy_lock held */
+static void policy_store(struct hmalloc_policy *policy, int mode, const nodes_t *nodemask,
+                         const struct hmalloc_weights *weights) {
+    unsigned seq = atomic_load_explicit(&policy->seq, memory_order_relaxed);
+
+    atomic_store_explicit(&policy->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    __atomic_store_n(&policy->mode, mode, __ATOMIC_RELAXED);
+    for (size_t i = 0; i < HMALLOC_NODEMASK_LONGS; i++)
+        __atomic_store_n(&policy->nodemask.bits[i], nodemask->bits[i], __ATOMIC_RELAXED);
+    __atomic_store_n(&policy->weights, weights, __ATOMIC_RELAXED);
+    atomic_store_explicit(&policy->seq, seq + 2, memory_order_release);
+}
+
+/*
+ * Change the global policy for the extents and the hmmap() mappings created
+ * from now on.  The memory already bound, including the extents cached by
+ * the arenas, keeps its policy.  The policies of HMALLOC_SOCKET_LOCAL follow
+ * the new nodes by their distance as they do at startup.
+ */
+int hmalloc_set_policy(int mode, const unsigned long *nodemask, unsigned long maxnode) {
+    nodes_t mask;
+
+    if (policy_args(mode, nodemask, maxnode, &mask))
+        return -1;
+
+    pthread_mutex_lock(&policy_lock);
+    policy_store(&global_policy, mode, &mask, NULL);
+    for (int cpu = 0; socket_local && cpu < ncpus; cpu++) {
+        struct hmalloc_policy *policy = cpu_policies[cpu];
+        int node = numa_node_of_cpu(cpu);
+        nodes_t nearest;
+
+        if (policy == &global_policy || node < 0)
+            continue;
+        nearest_nodes(node, &mask, &nearest);
+        policy_store(policy, socket_local_mode(mode), &nearest, NULL);
+    }
+    pthread_mutex_unlock(&policy_lock);
+    return 0;
+}
+
+void hmalloc_thread_set_policy(hmalloc_policy_t *policy) {
+    thread_policy = policy;
+}
+
+hmalloc_policy_t *hmalloc_thread_get_policy(void) {
+    return thread_policy;
+}
+
+struct hmalloc_policy *node_policy(int node) {
+    struct hmalloc_policy *policy;
+
+    if (unlikely(node < 0 || node > maxnode || node >= HMALLOC_MAX_NODES || !node_policies)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    policy = atomic_load_explicit(&node_policies[node], memory_order_acquire);
+    if (likely(policy))
+        return policy;
+
+    pthread_mutex_lock(&policy_lock);
+    policy = atomic_load(&node_policies[node]);
+    if (!policy) {
+        nodes_t nodemask;
+
+        nodes_of(&nodemask, node);
+        policy = policy_create(MPOL_BIND, &nodemask, 1);
+        atomic_store_explicit(&node_policies[node], policy, memory_order_release);
+    }
+    pthread_mutex_unlock(&policy_lock);
+    return policy;
+}
+
+void *hmalloc_node(size_t size, int node) {
+    struct hmalloc_policy *policy = node_policy(node);
+
+    if (unlikely(policy == NULL))
+        return NULL;
+    return policy_malloc(policy, size);
+}
+
+void *hmalloc_p(hmalloc_policy_t *policy, size_t size) {
+    if (policy == NULL)
+        policy = size_policy(size, 0);
+    return policy_malloc(policy, size);
+}
+
+void *hcalloc_p(hmalloc_policy_t *policy, size_t nmemb, size_t size) {
+    if (policy == NULL)
+        policy = size_policy(nmemb * size, 0);
+    return policy_calloc(policy, nmemb, size);
+}
+
+void *hrealloc_p(hmalloc_policy_t *policy, void *ptr, size_t size) {
+    if (policy == NULL)
+        policy = size_policy(size, 0);
+    return policy_realloc(policy, ptr, size);
+}
+
+void *haligned_alloc_p(hmalloc_policy_t *policy, size_t alignment, size_t size) {
+    if (policy == NULL)
+        policy = size_policy(size, alignment);
+    return policy_aligned_alloc(policy, alignment, size);
+}
+
+int hposix_memalign_p(hmalloc_policy_t *policy, void **memptr, size_t alignment, size_t size) {
+    if (policy == NULL)
+        policy = size_policy(size, alignment);
+    return policy_posix_memalign(policy, memptr, alignment, size);
+}
+
+#ifdef HAVE_JEMALLOC
+/* the argument of "experimental.batch_alloc" of jemalloc 5.3 */
+struct batch_alloc_args {
+    void **ptrs;
+    size_t num;
+    size_t size;
+    int flags;
+};
+
+static bool batch_alloc_unsupported;
+
+/* return the number of objects allocated to ptrs, which may be less than num on failure */
+static size_t batch_alloc(void **ptrs, size_t num, size_t size, int flags) {
+    struct batch_alloc_args args = { ptrs, num, size, flags };
+    size_t filled = 0, filled_size = sizeof(filled);
+    int err;
+
+    if (!batch_alloc_unsupported) {
+        err = mallctl("experimental.batch_alloc", &filled, &filled_size, &args, sizeof(args));
+        if (err == 0)
+            return filled;
+        /* older jemalloc, allocate one by one with the same flags */
+        if (err == ENOENT)
+            batch_alloc_unsupported = true;
+        filled = 0;
+    }
+
+    for (; filled < num; filled++) {
+        ptrs[filled] = mallocx(size, flags);
+        if (unlikely(ptrs[filled] == NULL))
+            break;
+    }
+    return filled;
+}
+#endif
+
+/* return the number of objects allocated to ptrs, which may be less than num on failure */
+static size_t arena_batch(struct hmalloc_policy *policy, void **ptrs, size_t num, size_t size) {
+    size_t filled;
+
+#ifdef HAVE_JEMALLOC
+    if (!use_slab) {
+        /* the arena and the tcache are resolved once for the whole batch */
+        filled = batch_alloc(ptrs, num, size, policy_flags(policy));
+        for (size_t i = 0; i < filled; i++)
+            prefault(ptrs[i], size);
+        return filled;
+    }
+#endif
+    /* the slabs with the thread caches take no lock for most objects anyway */
+    for (filled = 0; filled < num; filled++) {
+        ptrs[filled] = policy_malloc(policy, size);
+        if (unlikely(ptrs[filled] == NULL))
+            break;
+    }
+    return filled;
+}
+
+static int policy_batch(struct hmalloc_policy *policy, size_t size, size_t count, void **out) {
+    size_t filled;
+
+    if (unlikely(out == NULL && count)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (size == 0)
+        size = 1;
+
+    filled = arena_batch(policy, out, count, size);
+    if (unlikely(filled < count)) {
+        hfree_batch(out, filled);
+        memset(out, 0, count * sizeof(*out));
+        errno = ENOMEM;
+        return -1;
+    }
+    return 0;
+}
+
+int hmalloc_batch(size_t size, size_t count, void **out) {
+    return policy_batch(size_policy(size, 0), size, count, out);
+}
+
+int hmalloc_batch_p(hmalloc_policy_t *policy, size_t size, size_t count, void **out) {
+    if (policy == NULL)
+        policy = size_policy(size, 0);
+    return policy_batch(policy, size, count, out);
+}
+
+void hfree_batch(void **ptrs, size_t count) {
+#ifdef HAVE_JEMALLOC
+    int flags;
+
+    if (!use_slab) {
+        bool migrated = atomic_load_explicit(&nr_migrated, memory_order_relaxed);
+
+        flags = tcache_free_flags();
+        for (size_t i = 0; i < count; i++) {
+            if (unlikely(ptrs[i] == NULL))
+                continue;
+            /* the moved and huge objects are looked up without a lock */
+            if (unlikely(migrated))
+                migrate_forget(ptrs[i]);
+            if (unlikely(huge_lookup(ptrs[i])) && huge_free(ptrs[i]))
+                continue;
+            dallocx(ptrs[i], flags);
+        }
+        return;
+    }
+#endif
+    for (size_t i = 0; i < count; i++)
+        hfree(ptrs[i]);
 }
@@ -1,13 +1,20 @@
 /* Copyright (c) 2024 SK hynix, Inc. */
 /* SPDX-License-Identifier: BSD 2-Clause */
 
+#include "control.h"
+
 #include <argp.h>
+#include <errno.h>
+#include <libgen.h>
+#include <limits.h>
 #include <numa.h>
 #include <numaif.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 #ifndef MPOL_PREFERRED_MANY
@@ -18,6 +25,28 @@
 #define MPOL_WEIGHTED_INTERLEAVE 6
 #endif
 
+#define PRELOAD_LIB "libhmalloc-preload.so"
+
+/* the install path of PRELOAD_LIB, which is defined by the build system */
+#ifndef HMALLOC_PRELOAD_PATH
+#define HMALLOC_PRELOAD_PATH "/usr/local/lib/" PRELOAD_LIB
+#endif
+
+/* keys of the options that have no short option */
+enum {
+    OPT_WEIGHT_CHUNK = 256,
+    OPT_PRELOAD,
+    OPT_PRELOAD_MMAP,
+    OPT_CONF_FILE,
+    OPT_FALLBACK,
+    OPT_FALLBACK_WATERMARK,
+    OPT_CONTROL,
+    OPT_PID,
+    OPT_THREAD,
+    OPT_MREMAP,
+    OPT_BACKEND,
+};
+
 struct opts {
     int idx;
     char *exename;
@@ -27,6 +56,26 @@ struct opts {
     const char *interleave;
     const char *weighted_interleave;
     int preferred;
+    bool tcache;
+    bool socket_local;
+    const char *hugepage;
+    const char *prefault;
+    const char *mremap;
+    const char *backend;
+    const char *weights;
+    const char *weight_chunk;
+    bool preload;
+    const char *preload_threshold;
+    const char *preload_mmap;
+    const char *conf;
+    const char *conf_file;
+    /* the rules of --thread, which come before the ones of --conf */
+    char thread_rules[4096];
+    const char *fallback;
+    const char *fallback_watermark;
+    bool control;
+    const char *control_dir;
+    pid_t pid;
 };
 
 struct opts opts;
@@ -56,6 +105,87 @@ static struct argp_option hmctl_options[] = {
      .arg = "nodes",
      .doc = "Set a weighted memory interleave policy. Memory will be allocated using the weights "
             "specified in its sysfs location"},
+    {.name = "tcache",
+     .key = 't',
+     .doc = "Use per-thread caches for hmalloc family allocations to reduce arena lock "
+            "contention"},
+    {.name = "socket-local",
+     .key = 's',
+     .doc = "Allocate memory from the nodes that are the closest to the socket of the calling "
+            "thread among the nodes given to the memory policy"},
+    {.name = "hugepage",
+     .key = 'H',
+     .arg = "mode",
+     .doc = "Back hmalloc pool with huge pages. mode is one of thp, 2M and 1G"},
+    {.name = "prefault",
+     .key = 'f',
+     .arg = "size",
+     .doc = "Prefault allocations of size or larger in parallel from the cpus near the nodes. "
+            "size can have K, M or G suffix"},
+    {.name = "mremap",
+     .key = OPT_MREMAP,
+     .arg = "size",
+     .doc = "Map allocations of size or larger directly so that hrealloc grows them with "
+            "mremap instead of copying them"},
+    {.name = "backend",
+     .key = OPT_BACKEND,
+     .arg = "name",
+     .doc = "Allocate hmalloc family allocations from name, which is jemalloc or slab, the "
+            "built-in allocator"},
+    {.name = "weights",
+     .key = 'W',
+     .arg = "node:weight,...",
+     .doc = "Interleave hmalloc pool over nodes by the given weights in user space, which "
+            "works without MPOL_WEIGHTED_INTERLEAVE of the kernel"},
+    {.name = "weight-chunk",
+     .key = OPT_WEIGHT_CHUNK,
+     .arg = "size",
+     .doc = "Interleave unit of --weights from 2M to 1G (default: 2M)"},
+    {.name = "conf",
+     .key = 'C',
+     .arg = "rules",
+     .doc = "Place allocations by rules separated by ';', e.g. \"size=-4K default; "
+            "size=2M- membind=2; thread=worker membind=3\". The first matching rule wins"},
+    {.name = "conf-file",
+     .key = OPT_CONF_FILE,
+     .arg = "file",
+     .doc = "Read the rules of --conf from file, one rule per line"},
+    {.name = "thread",
+     .key = OPT_THREAD,
+     .arg = "pattern:policy",
+     .doc = "Place the allocations of the threads whose name starts with pattern, or matches "
+            "it with '*' and '?', by a policy of --conf, e.g. \"compact*:membind=2\". It can "
+            "be given multiple times"},
+    {.name = "preload",
+     .key = OPT_PRELOAD,
+     .arg = "size",
+     .flags = OPTION_ARG_OPTIONAL,
+     .doc = "Run an unmodified program with " PRELOAD_LIB " so that its malloc family "
+            "allocations of size or larger follow the memory policy (default: 0, all)"},
+    {.name = "preload-mmap",
+     .key = OPT_PRELOAD_MMAP,
+     .arg = "size",
+     .doc = "With --preload, also map anonymous mmap() calls of size or larger by hmmap()"},
+    {.name = "fallback",
+     .key = OPT_FALLBACK,
+     .arg = "nodes",
+     .doc = "Bind new extents to nodes, e.g. CXL memory, while the nodes of the memory policy "
+            "are short of free memory"},
+    {.name = "fallback-watermark",
+     .key = OPT_FALLBACK_WATERMARK,
+     .arg = "low[:high]",
+     .doc = "Free memory of a node to fall back below and to return above, in size with K, M "
+            "or G suffix or in percent of the node (default: 5%:10%)"},
+    {.name = "control",
+     .key = OPT_CONTROL,
+     .arg = "dir",
+     .flags = OPTION_ARG_OPTIONAL,
+     .doc = "Create a control socket in dir for --pid (default: $XDG_RUNTIME_DIR/hmalloc)"},
+    {.name = "pid",
+     .key = OPT_PID,
+     .arg = "pid",
+     .doc = "Change the memory policy of the running process pid started with --control to "
+            "the one of -m, -P, -p, -i or -w instead of running a program"},
     {NULL},
 };
 
@@ -64,6 +194,23 @@ static void fail_mpol_conflict(struct argp_state *state, char key) {
     argp_state_help(state, state->out_stream, ARGP_HELP_STD_HELP);
 }
 
+/* turn "pattern:policy" into a rule of --conf */
+static void add_thread_rule(struct argp_state *state, struct opts *opts, const char *arg) {
+    const char *policy = strchr(arg, ':');
+    size_t len = strlen(opts->thread_rules);
+    int pattern_len, ret;
+
+    /* a thread name has at most 15 characters */
+    if (policy == NULL || policy == arg || policy - arg > 15 || policy[1] == '\0')
+        argp_error(state, "invalid thread rule '%s'", arg);
+
+    pattern_len = policy - arg;
+    ret = snprintf(opts->thread_rules + len, sizeof(opts->thread_rules) - len,
+                   "thread=%.*s %s; ", pattern_len, arg, policy + 1);
+    if (ret < 0 || (size_t)ret >= sizeof(opts->thread_rules) - len)
+        argp_error(state, "too many thread rules at '%s'", arg);
+}
+
 static error_t parse_option(int key, char *arg, struct argp_state *state) {
     struct opts *opts = state->input;
 
@@ -94,6 +241,89 @@ static error_t parse_option(int key, char *arg, struct argp_state *state) {
         opts->weighted_interleave = arg;
         break;
 
+    case 't':
+        opts->tcache = true;
+        break;
+
+    case 's':
+        opts->socket_local = true;
+        break;
+
+    case 'H':
+        if (strcmp(arg, "thp") && strcmp(arg, "2M") && strcmp(arg, "1G"))
+            argp_error(state, "invalid hugepage mode '%s'", arg);
+        opts->hugepage = arg;
+        break;
+
+    case 'f':
+        opts->prefault = arg;
+        break;
+
+    case OPT_MREMAP:
+        opts->mremap = arg;
+        break;
+
+    case OPT_BACKEND:
+        if (strcmp(arg, "jemalloc") && strcmp(arg, "slab"))
+            argp_error(state, "invalid backend '%s'", arg);
+        opts->backend = arg;
+        break;
+
+    case 'W':
+        opts->weights = arg;
+        break;
+
+    case OPT_WEIGHT_CHUNK:
+        opts->weight_chunk = arg;
+        break;
+
+    case 'C':
+        opts->conf = arg;
+        break;
+
+    case OPT_CONF_FILE:
+        opts->conf_file = arg;
+        break;
+
+    case OPT_THREAD:
+        add_thread_rule(state, opts, arg);
+        break;
+
+    case OPT_FALLBACK:
+        opts->fallback = arg;
+        break;
+
+    case OPT_FALLBACK_WATERMARK:
+        opts->fallback_watermark = arg;
+        break;
+
+    case OPT_CONTROL:
+        opts->control = true;
+        opts->control_dir = arg;
+        break;
+
+    case OPT_PID:
+        opts->pid = atoi(arg);
+        if (opts->pid <= 0)
+            argp_error(state, "invalid pid '%s'", arg);
+        break;
+
+    case OPT_PRELOAD:
+#ifndef HAVE_JEMALLOC
+        argp_error(state, "--preload needs hmalloc built with jemalloc");
+#endif
+        opts->preload = true;
+        opts->preload_threshold = arg;
+        break;
+
+    case OPT_PRELOAD_MMAP:
+#ifndef HAVE_JEMALLOC
+        argp_error(state, "--preload-mmap needs hmalloc built with jemalloc");
+#endif
+        opts->preload = true;
+        opts->preload_mmap = arg;
+        break;
+
     case ARGP_KEY_ARG:
         if (state->arg_num)
             return ARGP_ERR_UNKNOWN;
@@ -111,8 +341,12 @@ static error_t parse_option(int key, char *arg, struct argp_state *state) {
 
     case ARGP_KEY_NO_ARGS:
     case ARGP_KEY_END:
-        if (state->arg_num < 1)
+        /* --pid changes a running process instead of running a program */
+        if (state->arg_num < 1 && !opts->pid)
             argp_usage(state);
+        /* the preload library takes over malloc() only with jemalloc */
+        if (opts->preload && opts->backend && !strcmp(opts->backend, "slab"))
+            argp_error(state, "--preload needs the jemalloc backend");
         break;
 
     default:
@@ -121,58 +355,227 @@ static error_t parse_option(int key, char *arg, struct argp_state *state) {
     return 0;
 }
 
-static void setup_child_environ(struct opts *opts) {
-    unsigned long nodemask = 0;
-    char buf[4096] = "0";
-    struct bitmask *bm;
+/* find PRELOAD_LIB next to hmctl, in ../lib from it, or in the install path */
+static const char *find_preload_lib(void) {
+    static char path[PATH_MAX];
+    char exe[PATH_MAX];
+    ssize_t len;
+
+    len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    if (len > 0) {
+        const char *dir;
+
+        exe[len] = '\0';
+        dir = dirname(exe);
+
+        snprintf(path, sizeof(path), "%s/%s", dir, PRELOAD_LIB);
+        if (access(path, R_OK) == 0)
+            return path;
+        snprintf(path, sizeof(path), "%s/../lib/%s", dir, PRELOAD_LIB);
+        if (access(path, R_OK) == 0)
+            return path;
+    }
+    return HMALLOC_PRELOAD_PATH;
+}
 
-    if (opts->membind) {
-        snprintf(buf, sizeof(buf), "%d", MPOL_BIND);
-        setenv("HMALLOC_MPOL_MODE", buf, 1);
+static void setup_preload(struct opts *opts) {
+    const char *preload = getenv("LD_PRELOAD");
+    const char *lib = find_preload_lib();
 
-        bm = numa_parse_nodestring(opts->membind);
-        if (bm) {
-            snprintf(buf, sizeof(buf), "%lu", *bm->maskp);
-            setenv("HMALLOC_NODEMASK", buf, 1);
-        }
-    } else if (opts->preferred_many) {
-        snprintf(buf, sizeof(buf), "%d", MPOL_PREFERRED_MANY);
-        setenv("HMALLOC_MPOL_MODE", buf, 1);
+    /* hmalloc has to come first to take over the malloc family */
+    if (preload && *preload) {
+        /* sized for the whole list as a truncated one would preload a wrong path */
+        size_t size = strlen(lib) + strlen(preload) + 2;
+        char *buf = malloc(size);
 
-        bm = numa_parse_nodestring(opts->preferred_many);
-        if (bm) {
-            snprintf(buf, sizeof(buf), "%lu", *bm->maskp);
-            setenv("HMALLOC_NODEMASK", buf, 1);
+        if (!buf) {
+            perror("LD_PRELOAD");
+            exit(EXIT_FAILURE);
         }
+        snprintf(buf, size, "%s:%s", lib, preload);
+        setenv("LD_PRELOAD", buf, 1);
+        free(buf);
+    } else {
+        setenv("LD_PRELOAD", lib, 1);
+    }
+
+    if (opts->preload_threshold)
+        setenv("HMALLOC_PRELOAD_THRESHOLD", opts->preload_threshold, 1);
+    if (opts->preload_mmap)
+        setenv("HMALLOC_PRELOAD_MMAP_THRESHOLD", opts->preload_mmap, 1);
+    /* the preload library takes over malloc() only with jemalloc, over HMALLOC_BACKEND=slab */
+    setenv("HMALLOC_BACKEND", "jemalloc", 1);
+}
+
+/* a node list such as "0,2-3" of HMALLOC_NODES, or false if it does not fit in buf */
+static bool format_bitmask(const struct bitmask *bm, char *buf, size_t size) {
+    size_t len = 0;
+
+    buf[0] = '\0';
+    for (unsigned long node = 0; node < bm->size; node++) {
+        unsigned long last = node;
+        int ret;
+
+        if (!numa_bitmask_isbitset(bm, node))
+            continue;
+        while (last + 1 < bm->size && numa_bitmask_isbitset(bm, last + 1))
+            last++;
+        if (last == node)
+            ret = snprintf(buf + len, size - len, "%s%lu", len ? "," : "", node);
+        else
+            ret = snprintf(buf + len, size - len, "%s%lu-%lu", len ? "," : "", node, last);
+        if (ret < 0 || (size_t)ret >= size - len)
+            return false;
+        len += ret;
+        node = last;
+    }
+    return true;
+}
+
+/* the memory policy of the options as a node list, or false if no policy is given */
+static bool opts_policy(struct opts *opts, int *mode, char *nodes, size_t size) {
+    const char *arg;
+    struct bitmask *bm;
+
+    if (opts->membind) {
+        *mode = MPOL_BIND;
+        arg = opts->membind;
+    } else if (opts->preferred_many) {
+        *mode = MPOL_PREFERRED_MANY;
+        arg = opts->preferred_many;
     } else if (opts->preferred >= 0) {
         /* ignore when --membind is used */
-        snprintf(buf, sizeof(buf), "%d", MPOL_PREFERRED);
-        setenv("HMALLOC_MPOL_MODE", buf, 1);
-
-        nodemask = 1 << opts->preferred;
-        snprintf(buf, sizeof(buf), "%ld", nodemask);
-        setenv("HMALLOC_NODEMASK", buf, 1);
+        *mode = MPOL_PREFERRED;
+        arg = NULL;
     } else if (opts->weighted_interleave) {
-        snprintf(buf, sizeof(buf), "%d", MPOL_WEIGHTED_INTERLEAVE);
-        setenv("HMALLOC_MPOL_MODE", buf, 1);
+        *mode = MPOL_WEIGHTED_INTERLEAVE;
+        arg = opts->weighted_interleave;
+    } else if (opts->interleave) {
+        *mode = MPOL_INTERLEAVE;
+        arg = opts->interleave;
+    } else {
+        return false;
+    }
 
-        bm = numa_parse_nodestring(opts->weighted_interleave);
-        if (bm) {
-            snprintf(buf, sizeof(buf), "%lu", *bm->maskp);
-            setenv("HMALLOC_NODEMASK", buf, 1);
+    if (arg) {
+        bm = numa_parse_nodestring(arg);
+        if (!bm) {
+            fprintf(stderr, "Error: invalid nodes '%s'\n", arg);
+            exit(EXIT_FAILURE);
         }
-    } else if (opts->interleave) {
-        snprintf(buf, sizeof(buf), "%d", MPOL_INTERLEAVE);
+    } else {
+        if (opts->preferred > numa_max_possible_node()) {
+            fprintf(stderr, "Error: invalid node %d\n", opts->preferred);
+            exit(EXIT_FAILURE);
+        }
+        bm = numa_allocate_nodemask();
+        numa_bitmask_setbit(bm, opts->preferred);
+    }
+
+    if (!format_bitmask(bm, nodes, size)) {
+        fprintf(stderr, "Error: too many nodes\n");
+        exit(EXIT_FAILURE);
+    }
+    numa_bitmask_free(bm);
+    return true;
+}
+
+static void setup_child_environ(struct opts *opts) {
+    char buf[4096], nodes[HMALLOC_CONTROL_LINE];
+    int mode;
+
+    if (opts_policy(opts, &mode, nodes, sizeof(nodes))) {
+        snprintf(buf, sizeof(buf), "%d", mode);
         setenv("HMALLOC_MPOL_MODE", buf, 1);
+        setenv("HMALLOC_NODES", nodes, 1);
+    }
 
-        bm = numa_parse_nodestring(opts->interleave);
-        if (bm) {
-            snprintf(buf, sizeof(buf), "%lu", *bm->maskp);
-            setenv("HMALLOC_NODEMASK", buf, 1);
+    if (opts->tcache)
+        setenv("HMALLOC_TCACHE", "1", 1);
+    if (opts->socket_local)
+        setenv("HMALLOC_SOCKET_LOCAL", "1", 1);
+    if (opts->hugepage)
+        setenv("HMALLOC_HUGEPAGE", opts->hugepage, 1);
+    if (opts->prefault)
+        setenv("HMALLOC_PREFAULT_THRESHOLD", opts->prefault, 1);
+    if (opts->mremap)
+        setenv("HMALLOC_MREMAP_THRESHOLD", opts->mremap, 1);
+    if (opts->backend)
+        setenv("HMALLOC_BACKEND", opts->backend, 1);
+    if (opts->weights)
+        setenv("HMALLOC_WEIGHTS", opts->weights, 1);
+    if (opts->weight_chunk)
+        setenv("HMALLOC_WEIGHT_CHUNK", opts->weight_chunk, 1);
+    if (opts->thread_rules[0]) {
+        int len = snprintf(buf, sizeof(buf), "%s%s", opts->thread_rules,
+                           opts->conf ? opts->conf : "");
+
+        if (len < 0 || (size_t)len >= sizeof(buf)) {
+            fprintf(stderr, "Error: --thread and --conf rules are too long\n");
+            exit(EXIT_FAILURE);
+        }
+        setenv("HMALLOC_CONF", buf, 1);
+    } else if (opts->conf) {
+        setenv("HMALLOC_CONF", opts->conf, 1);
+    }
+    if (opts->conf_file)
+        setenv("HMALLOC_CONF_FILE", opts->conf_file, 1);
+    if (opts->fallback)
+        setenv("HMALLOC_FALLBACK", opts->fallback, 1);
+    if (opts->fallback_watermark)
+        setenv("HMALLOC_FALLBACK_WATERMARK", opts->fallback_watermark, 1);
+    if (opts->control) {
+        /* the directory is resolved here so that the program finds the same one */
+        const char *dir = control_dir(opts->control_dir, buf, sizeof(buf));
+
+        if (dir == NULL) {
+            fprintf(stderr, "Error: control directory is too long.\n");
+            exit(EXIT_FAILURE);
         }
+        setenv("HMALLOC_CONTROL", dir, 1);
+    }
+    if (opts->preload)
+        setup_preload(opts);
+}
+
+/* send the memory policy to the control socket of a running process */
+static int send_policy(struct opts *opts) {
+    const char *dir = opts->control ? opts->control_dir : getenv("HMALLOC_CONTROL");
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    char buf[HMALLOC_CONTROL_LINE], nodes[HMALLOC_CONTROL_LINE - 32];
+    int fd, len, mode;
+    ssize_t ret;
+
+    if (!opts_policy(opts, &mode, nodes, sizeof(nodes))) {
+        fprintf(stderr, "Error: --pid needs a memory policy.\n");
+        return -1;
+    }
+    if (!control_path(addr.sun_path, sizeof(addr.sun_path), dir, opts->pid)) {
+        fprintf(stderr, "Error: control directory '%s' is too long.\n", dir ? dir : "");
+        return -1;
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+        perror(addr.sun_path);
+        return -1;
     }
 
-    setenv("HMALLOC_JEMALLOC", "1", 1);
+    len = snprintf(buf, sizeof(buf), "policy %d %s\n", mode, nodes);
+    if (write(fd, buf, len) != len || (ret = read(fd, buf, sizeof(buf) - 1)) <= 0) {
+        perror(addr.sun_path);
+        close(fd);
+        return -1;
+    }
+    close(fd);
+
+    buf[ret] = '\0';
+    errno = atoi(buf);
+    if (errno) {
+        fprintf(stderr, "Error: process %d: %s\n", (int)opts->pid, strerror(errno));
+        return -1;
+    }
+    return 0;
 }
 
 int main(int argc, char *argv[]) {
@@ -189,6 +592,9 @@ int main(int argc, char *argv[]) {
 
     argp_parse(&argp, argc, argv, ARGP_IN_ORDER, NULL, &opts);
 
+    if (opts.pid)
+        return send_policy(&opts);
+
     /* pass only non-hmctl options to execv() */
     argc -= opts.idx;
     argv += opts.idx;
@@ -0,0 +1,432 @@
+/* Copyright (c) 2026 SK hynix, Inc. */
+/* SPDX-License-Identifier: BSD 2-Clause */
+
+/*
+ * Huge allocations of HMALLOC_MREMAP_THRESHOLD bytes or larger, and the ones
+ * larger than the size classes of slab.c, are mapped directly by hmmap()
+ * instead of from the arenas, so that hrealloc() grows them without copying:
+ *
+ *  - the mapping is extended in place if the address space after it is free,
+ *    and only the new tail is bound to the memory policy.
+ *
+ *  - otherwise the mapping is moved to a larger range by mremap(), which moves
+ *    the page tables rather than the pages, and the new tail is bound.
+ *
+ * A multi-GB buffer on CXL memory is neither copied across the memory bus nor
+ * doubled in memory usage while it grows.
+ *
+ * With the hugetlb pages of HMALLOC_HUGEPAGE, HMAP_HUGEPAGE allocations are
+ * made of whole huge pages so that they are mapped from the hugetlb pool, and
+ * their length is kept a multiple of the huge page size as they grow and
+ * shrink.  They fall back to base pages when the pool is exhausted or an
+ * alignment larger than a base page is requested.
+ */
+
+#include "hmalloc.h"
+#include "internal.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/*
+ * Huge allocations and their mappings in an open addressing hash table.
+ * hfree() looks up every page aligned object once there is a huge allocation,
+ * so huge_length() takes no lock: it retries if huges_seq, which the writers
+ * make odd while they change the slots, changes under it.  The tables
+ * replaced by huge_grow() stay mapped for the lookups still in them.
+ */
+struct huge {
+    uintptr_t ptr;
+    size_t length;
+    struct hmalloc_policy *policy;
+    /* the length is a multiple of unit, which is the hugetlb page size if any */
+    unsigned unit;
+    int flags;
+};
+
+/* an entry in the table, whose ptr and length are read without huge_lock */
+struct huge_slot {
+    atomic_uintptr_t ptr;
+    atomic_size_t length;
+    struct hmalloc_policy *policy;
+    unsigned unit;
+    int flags;
+};
+
+/* a page of entries is the initial table, whose size must be a power of two */
+_Static_assert((sizeof(struct huge_slot) & (sizeof(struct huge_slot) - 1)) == 0,
+               "huge entry size");
+
+struct huge_table {
+    size_t size;
+    struct huge_slot slots[];
+};
+
+static _Atomic(struct huge_table *) huges;
+static atomic_uint huges_seq;
+atomic_size_t nr_huge;
+atomic_ulong nr_huge_copies;
+static pthread_mutex_t huge_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline size_t huge_slot(const struct huge_table *table, uintptr_t ptr) {
+    /* huge allocations are page aligned and the multiplication mixes the upper bits */
+    return ((ptr >> 12) * 0x9e3779b97f4a7c15ULL >> 16) & (table->size - 1);
+}
+
+static inline uintptr_t slot_ptr(const struct huge_table *table, size_t i) {
+    return atomic_load_explicit(&table->slots[i].ptr, memory_order_relaxed);
+}
+
+/* copy an entry out of the table, which must be called with huge_lock held */
+static inline void slot_get(const struct huge_table *table, size_t i, struct huge *huge) {
+    const struct huge_slot *slot = &table->slots[i];
+
+    huge->ptr = slot_ptr(table, i);
+    huge->length = atomic_load_explicit(&slot->length, memory_order_relaxed);
+    huge->policy = slot->policy;
+    huge->unit = slot->unit;
+    huge->flags = slot->flags;
+}
+
+static inline void slot_set(struct huge_table *table, size_t i, const struct huge *huge) {
+    struct huge_slot *slot = &table->slots[i];
+
+    atomic_store_explicit(&slot->ptr, huge->ptr, memory_order_relaxed);
+    atomic_store_explicit(&slot->length, huge->length, memory_order_relaxed);
+    slot->policy = huge->policy;
+    slot->unit = huge->unit;
+    slot->flags = huge->flags;
+}
+
+static size_t huge_find(const struct huge_table *table, uintptr_t ptr) {
+    size_t i = huge_slot(table, ptr);
+    uintptr_t slot;
+
+    while ((slot = slot_ptr(table, i)) && slot != ptr)
+        i = (i + 1) & (table->size - 1);
+    return i;
+}
+
+static inline void huge_write_begin(void) {
+    atomic_fetch_add_explicit(&huges_seq, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static inline void huge_write_end(void) {
+    atomic_fetch_add_explicit(&huges_seq, 1, memory_order_release);
+}
+
+/* the table is mapped directly as it is updated from hfree() */
+static bool huge_grow(void) {
+    struct huge_table *old = atomic_load_explicit(&huges, memory_order_relaxed);
+    size_t old_size = old ? old->size : 0;
+    size_t new_size = old_size ? old_size * 2 : PAGE_SIZE / sizeof(struct huge_slot);
+    struct huge_table *table;
+    struct huge huge;
+
+    table = mmap(NULL, sizeof(*table) + new_size * sizeof(struct huge_slot), PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (table == MAP_FAILED)
+        return false;
+
+    table->size = new_size;
+    for (size_t i = 0; i < old_size; i++) {
+        if (!slot_ptr(old, i))
+            continue;
+        slot_get(old, i, &huge);
+        slot_set(table, huge_find(table, huge.ptr), &huge);
+    }
+    /* the lookups see the slots of the new table once they see the table */
+    atomic_store_explicit(&huges, table, memory_order_release);
+    return true;
+}
+
+static bool huge_insert(const struct huge *huge) {
+    struct huge_table *table;
+    bool ret = true;
+
+    pthread_mutex_lock(&huge_lock);
+    table = atomic_load_explicit(&huges, memory_order_relaxed);
+    /* keep the load factor below 1/2 */
+    if (!table || (atomic_load(&nr_huge) + 1) * 2 > table->size) {
+        if (!huge_grow()) {
+            ret = false;
+            goto out;
+        }
+        table = atomic_load_explicit(&huges, memory_order_relaxed);
+    }
+    huge_write_begin();
+    slot_set(table, huge_find(table, huge->ptr), huge);
+    huge_write_end();
+    atomic_fetch_add(&nr_huge, 1);
+out:
+    pthread_mutex_unlock(&huge_lock);
+    return ret;
+}
+
+/* must be called with huge_lock held and in a write section */
+static void huge_delete(struct huge_table *table, size_t i) {
+    struct huge huge;
+    size_t j;
+
+    /* shift back the following entries that cannot be found across the hole */
+    for (j = (i + 1) & (table->size - 1); slot_ptr(table, j); j = (j + 1) & (table->size - 1)) {
+        size_t k = huge_slot(table, slot_ptr(table, j));
+
+        if ((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j)) {
+            slot_get(table, j, &huge);
+            slot_set(table, i, &huge);
+            i = j;
+        }
+    }
+    atomic_store_explicit(&table->slots[i].ptr, 0, memory_order_relaxed);
+}
+
+/* copy the entry of ptr to huge, or return false if ptr is not a huge allocation */
+static bool huge_get(uintptr_t ptr, struct huge *huge, bool remove) {
+    struct huge_table *table;
+    bool ret = false;
+    size_t i;
+
+    pthread_mutex_lock(&huge_lock);
+    table = atomic_load_explicit(&huges, memory_order_relaxed);
+    if (!table)
+        goto out;
+    i = huge_find(table, ptr);
+    if (!slot_ptr(table, i))
+        goto out;
+    slot_get(table, i, huge);
+    ret = true;
+    if (remove) {
+        huge_write_begin();
+        huge_delete(table, i);
+        huge_write_end();
+        atomic_fetch_sub(&nr_huge, 1);
+    }
+out:
+    pthread_mutex_unlock(&huge_lock);
+    return ret;
+}
+
+/* replace the entry of ptr with huge, which may have moved, without growing the table */
+static void huge_update(uintptr_t ptr, const struct huge *huge) {
+    struct huge_table *table;
+
+    pthread_mutex_lock(&huge_lock);
+    table = atomic_load_explicit(&huges, memory_order_relaxed);
+    huge_write_begin();
+    huge_delete(table, huge_find(table, ptr));
+    slot_set(table, huge_find(table, huge->ptr), huge);
+    huge_write_end();
+    pthread_mutex_unlock(&huge_lock);
+}
+
+size_t huge_length(void *ptr) {
+    struct huge_table *table;
+    size_t length;
+    unsigned seq;
+    size_t i;
+
+    do {
+        seq = atomic_load_explicit(&huges_seq, memory_order_acquire);
+        table = atomic_load_explicit(&huges, memory_order_acquire);
+        length = 0;
+        if (table) {
+            i = huge_find(table, (uintptr_t)ptr);
+            if (slot_ptr(table, i))
+                length = atomic_load_explicit(&table->slots[i].length, memory_order_relaxed);
+        }
+        atomic_thread_fence(memory_order_acquire);
+    } while ((seq & 1) || seq != atomic_load_explicit(&huges_seq, memory_order_relaxed));
+    return length;
+}
+
+/*
+ * Change the policy of a huge allocation moved by hmove(), which binds its
+ * pages and the ones it grows by to the new policy.
+ */
+bool huge_set_policy(void *ptr, struct hmalloc_policy *policy) {
+    struct huge_table *table;
+    size_t length = 0;
+    size_t i;
+
+    pthread_mutex_lock(&huge_lock);
+    table = atomic_load_explicit(&huges, memory_order_relaxed);
+    if (table) {
+        i = huge_find(table, (uintptr_t)ptr);
+        if (slot_ptr(table, i)) {
+            table->slots[i].policy = policy;
+            length = atomic_load_explicit(&table->slots[i].length, memory_order_relaxed);
+        }
+    }
+    pthread_mutex_unlock(&huge_lock);
+
+    if (length == 0)
+        return false;
+    policy_bind_range(policy, ptr, length);
+    return true;
+}
+
+/* the bytes of the huge allocations of a policy for hmalloc_stats() */
+size_t huge_allocated(struct hmalloc_policy *policy) {
+    struct huge_table *table;
+    size_t allocated = 0;
+
+    pthread_mutex_lock(&huge_lock);
+    table = atomic_load_explicit(&huges, memory_order_relaxed);
+    for (size_t i = 0; table && i < table->size; i++) {
+        if (slot_ptr(table, i) && table->slots[i].policy == policy)
+            allocated += atomic_load_explicit(&table->slots[i].length, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&huge_lock);
+    return allocated;
+}
+
+static inline size_t huge_round(size_t size, size_t unit) {
+    return (size + unit - 1) & ~(unit - 1);
+}
+
+static inline void *huge_map(struct hmalloc_policy *policy, void *addr, size_t length, int flags) {
+    void *ptr = hmmap_p(policy, addr, length, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+
+    /* hmmap() returns NULL if mbind() fails */
+    return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+/* over-map by the alignment and trim the unaligned head and the remaining tail */
+static void *huge_map_aligned(struct hmalloc_policy *policy, size_t length, size_t alignment,
+                              int flags) {
+    size_t map_length = length + alignment - PAGE_SIZE;
+    uintptr_t addr, aligned, end;
+
+    if (map_length < length)
+        return NULL;
+    addr = (uintptr_t)huge_map(policy, NULL, map_length, flags);
+    if (addr == 0)
+        return NULL;
+
+    aligned = (addr + alignment - 1) & ~(alignment - 1);
+    end = addr + map_length;
+    if (aligned > addr)
+        hmunmap((void *)addr, aligned - addr);
+    if (end > aligned + length)
+        hmunmap((void *)(aligned + length), end - (aligned + length));
+    return (void *)aligned;
+}
+
+/* alignment is 0 or a power of two, and flags are extra hmmap() flags such as HMAP_HUGEPAGE */
+void *huge_alloc(struct hmalloc_policy *policy, size_t size, size_t alignment, int flags) {
+    size_t unit = flags & HMAP_HUGEPAGE ? hugepage_size() : PAGE_SIZE;
+    struct huge huge = {
+        .length = huge_round(size, unit), .policy = policy, .unit = unit, .flags = flags};
+    void *ptr;
+
+    if (unlikely(huge.length < size)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (alignment > PAGE_SIZE)
+        ptr = huge_map_aligned(policy, huge.length, alignment, flags);
+    else
+        ptr = huge_map(policy, NULL, huge.length, flags);
+    if (unlikely(ptr == NULL)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    huge.ptr = (uintptr_t)ptr;
+    if (unlikely(!huge_insert(&huge))) {
+        hmunmap(ptr, huge.length);
+        errno = ENOMEM;
+        return NULL;
+    }
+    return ptr;
+}
+
+bool huge_free(void *ptr) {
+    struct huge huge;
+
+    if (!huge_get((uintptr_t)ptr, &huge, true))
+        return false;
+    hmunmap(ptr, huge.length);
+    return true;
+}
+
+/* extend the mapping of huge in place, which fails if the range after it is in use */
+static bool huge_extend(struct huge *huge, size_t length) {
+    void *tail = (void *)(huge->ptr + huge->length);
+    void *addr;
+
+    addr = huge_map(huge->policy, tail, length - huge->length, huge->flags | MAP_FIXED_NOREPLACE);
+    if (addr == NULL)
+        return false;
+    /* old kernels take MAP_FIXED_NOREPLACE as a hint so check the address as well */
+    if (addr != tail) {
+        hmunmap(addr, length - huge->length);
+        return false;
+    }
+    huge->length = length;
+    return true;
+}
+
+/*
+ * Move the pages of huge to a larger range with mremap(), which keeps them on
+ * the nodes they are on, and bind only the new tail to the memory policy.
+ */
+static bool huge_move(struct huge *huge, size_t length) {
+    void *ptr = (void *)huge->ptr, *new_ptr;
+    int kind = range_lookup(ptr);
+
+    new_ptr = mremap(ptr, huge->length, length, MREMAP_MAYMOVE);
+    stat_event(STAT_MREMAP, new_ptr == MAP_FAILED);
+    if (new_ptr == MAP_FAILED) {
+        /* the mapping is split by the memory policies of its parts, e.g. HMALLOC_WEIGHTS */
+        new_ptr = huge_map(huge->policy, NULL, length, huge->flags);
+        if (new_ptr == NULL)
+            return false;
+        memcpy(new_ptr, ptr, huge->length);
+        hmunmap(ptr, huge->length);
+        atomic_fetch_add_explicit(&nr_huge_copies, 1, memory_order_relaxed);
+    } else {
+        /* the tail takes the policy of the last page otherwise, which is not bound yet */
+        policy_bind_range(huge->policy, (char *)new_ptr + huge->length, length - huge->length);
+        range_unregister(ptr, huge->length);
+        range_register(new_ptr, length, kind);
+    }
+
+    huge->ptr = (uintptr_t)new_ptr;
+    huge->length = length;
+    return true;
+}
+
+void *huge_realloc(void *ptr, size_t size) {
+    struct huge huge;
+    size_t length;
+
+    if (unlikely(!huge_get((uintptr_t)ptr, &huge, false))) {
+        errno = EINVAL;
+        return NULL;
+    }
+    length = huge_round(size, huge.unit);
+    if (unlikely(length < size)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    /* the pages after the new size are returned to the system */
+    if (length < huge.length) {
+        hmunmap((void *)(huge.ptr + length), huge.length - length);
+        huge.length = length;
+    } else if (length > huge.length && !huge_extend(&huge, length) &&
+               !huge_move(&huge, length)) {
+        /* the old allocation is still valid if it cannot grow */
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    huge_update((uintptr_t)ptr, &huge);
+    return (void *)huge.ptr;
+}
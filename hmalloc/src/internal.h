@@ -0,0 +1,276 @@
+/* Copyright (c) 2026 SK hynix, Inc. */
+/* SPDX-License-Identifier: BSD 2-Clause */
+
+#ifndef HMALLOC_INTERNAL_H
+#define HMALLOC_INTERNAL_H
+
+#include "nodemask.h"
+
+#ifdef HAVE_JEMALLOC
+#include <jemalloc/jemalloc.h>
+#endif
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define likely(x) __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+
+#define __unused __attribute__((unused))
+#define __tls __thread __attribute__((tls_model("initial-exec")))
+
+#define PAGE_SIZE 4096UL
+
+/* policies beyond this limit do not use per-thread caches */
+#define HMALLOC_MAX_POLICIES 64
+
+/* the maximum number of nodes that HMALLOC_WEIGHTS can have */
+#define HMALLOC_MAX_WEIGHTS 64
+
+/* user space weighted interleave over the nodes with their weights */
+struct hmalloc_weights {
+    size_t chunk;
+    unsigned total;
+    unsigned nr_nodes;
+    int nodes[HMALLOC_MAX_WEIGHTS];
+    unsigned weights[HMALLOC_MAX_WEIGHTS];
+};
+
+/*
+ * A memory policy applied to all the extents of its arenas or of its slabs.
+ * The extent hooks of jemalloc are embedded as the first member so that each
+ * hook can find the policy of the arena it is called for.
+ */
+struct hmalloc_policy {
+#ifdef HAVE_JEMALLOC
+    extent_hooks_t hooks;
+#endif
+    /* odd while hmalloc_set_policy() changes mode, nodemask and weights */
+    atomic_uint seq;
+    int mode;
+    nodes_t nodemask;
+    unsigned id;
+    unsigned narenas;
+    unsigned *arenas;
+    /* interleave chunks by weights instead of binding the range to mode */
+    const struct hmalloc_weights *weights;
+    /* the slabs of the built-in allocator, created at the first allocation */
+    struct slab_heap *_Atomic heap;
+    /* created by hmalloc_policy_create(), and destroyed until it is created again */
+    bool user;
+    bool dead;
+#ifdef HAVE_JEMALLOC
+    /* the tcaches of all the threads for a user policy, under policy_lock */
+    unsigned *tcaches;
+    unsigned nr_tcaches;
+    unsigned tcaches_size;
+#endif
+    /* policies are never freed, even if destroyed, so the list is only pushed to */
+    struct hmalloc_policy *next;
+};
+
+/* all the policies linked by next, the global policy is the last one */
+extern struct hmalloc_policy *_Atomic policy_list;
+
+/* read a consistent binding of a policy that can be changed at any time */
+static inline void policy_load(struct hmalloc_policy *policy, int *mode, nodes_t *nodemask,
+                               const struct hmalloc_weights **weights) {
+    unsigned seq;
+
+    do {
+        seq = atomic_load_explicit(&policy->seq, memory_order_acquire);
+        *mode = __atomic_load_n(&policy->mode, __ATOMIC_RELAXED);
+        for (size_t i = 0; i < HMALLOC_NODEMASK_LONGS; i++)
+            nodemask->bits[i] = __atomic_load_n(&policy->nodemask.bits[i], __ATOMIC_RELAXED);
+        *weights = __atomic_load_n(&policy->weights, __ATOMIC_RELAXED);
+        atomic_thread_fence(memory_order_acquire);
+    } while ((seq & 1) || seq != atomic_load_explicit(&policy->seq, memory_order_relaxed));
+}
+
+/* an address range mapped by hmalloc and backed by pages of enum hugepage_mode */
+struct map_range {
+    uintptr_t start;
+    uintptr_t end;
+    int kind;
+};
+
+/* hmalloc.c */
+extern bool use_slab;
+
+struct hmalloc_policy *policy_create(int mode, const nodes_t *nodemask, unsigned narenas);
+long policy_bind_range(struct hmalloc_policy *policy, void *addr, size_t length);
+struct hmalloc_policy *node_policy(int node);
+void *extent_map(struct hmalloc_policy *policy, void *new_addr, size_t size, size_t alignment);
+int hugepage_mode(void);
+size_t hugepage_size(void);
+
+/* size classes of the rule tables, four per power of two */
+#define CONF_NR_CLASSES 252
+
+/* a row of policies per alignment of 2^0 to 2^63 bytes */
+#define CONF_NR_ALIGNS 64
+
+/* the length of a thread name including the terminating NUL */
+#define CONF_THREAD_LEN 16
+
+/*
+ * Rules of HMALLOC_CONF compiled for the threads whose name matches the thread
+ * patterns of the rules in matched, which is a bit per rule, and no others.
+ * policies has a row of CONF_NR_CLASSES policies for each distinct alignment
+ * pattern, and the row 0 is for the allocations without alignment.  A NULL
+ * policy means that no rule matches.
+ */
+struct conf_table {
+    uint64_t matched;
+    unsigned char align_rows[CONF_NR_ALIGNS];
+    struct hmalloc_policy **policies;
+};
+
+/* conf.c */
+extern struct conf_table *conf_default;
+extern __tls struct conf_table *conf_thread;
+/* bumped when the rules are compiled again or another thread is renamed */
+extern atomic_uint conf_generation;
+extern __tls unsigned conf_thread_generation;
+
+void conf_init(unsigned narenas);
+struct conf_table *conf_thread_table(void);
+
+/* sizes in [4 * 2^n, 8 * 2^n) are split into 4 classes of the same width */
+static inline unsigned conf_size_class(size_t size) {
+    unsigned lg;
+
+    if (size < 4)
+        return size;
+    lg = 63 - __builtin_clzl(size);
+    return (lg - 1) * 4 + ((size >> (lg - 2)) & 3);
+}
+
+/* the policy of the first rule matching the allocation, must be called with conf_default set */
+static inline struct hmalloc_policy *conf_lookup(size_t size, size_t alignment) {
+    unsigned generation = atomic_load_explicit(&conf_generation, memory_order_acquire);
+    struct conf_table *table = conf_thread;
+    unsigned row = 0;
+
+    /* the table of the thread is looked up again with the new rules or the new name */
+    if (unlikely(conf_thread_generation != generation)) {
+        table = conf_thread = conf_thread_table();
+        conf_thread_generation = generation;
+    }
+    if (alignment)
+        row = table->align_rows[__builtin_ctzl(alignment)];
+    return table->policies[row * CONF_NR_CLASSES + conf_size_class(size)];
+}
+
+/* control.c */
+void control_init(void);
+
+/* huge.c */
+extern atomic_size_t nr_huge;
+extern atomic_ulong nr_huge_copies;
+
+void *huge_alloc(struct hmalloc_policy *policy, size_t size, size_t alignment, int flags);
+void *huge_realloc(void *ptr, size_t size);
+bool huge_free(void *ptr);
+size_t huge_length(void *ptr);
+bool huge_set_policy(void *ptr, struct hmalloc_policy *policy);
+size_t huge_allocated(struct hmalloc_policy *policy);
+
+/* the mapped length of a huge allocation or 0, which is page aligned unlike most objects */
+static inline size_t huge_lookup(void *ptr) {
+    if (likely(atomic_load_explicit(&nr_huge, memory_order_relaxed) == 0) ||
+        ((uintptr_t)ptr & (PAGE_SIZE - 1)))
+        return 0;
+    return huge_length(ptr);
+}
+
+/* slab.c */
+
+/* the largest size class of the slabs, larger allocations are huge ones */
+#define SLAB_MAX_SIZE (256UL << 10)
+
+void *slab_alloc(struct hmalloc_policy *policy, size_t size);
+void slab_free(void *ptr);
+size_t slab_usable_size(void *ptr);
+size_t slab_class_size(size_t size);
+void slab_stats(struct hmalloc_policy *policy, size_t *allocated, size_t *active,
+                size_t *retained);
+void slab_release(struct hmalloc_policy *policy);
+
+/* migrate.c */
+extern atomic_size_t nr_migrated;
+
+int migrate_lookup(void *ptr);
+void migrate_forget(void *ptr);
+
+/* pressure.c */
+extern atomic_int nr_pressured;
+extern atomic_ulong nr_fallbacks;
+extern nodes_t fallback_nodes;
+
+void pressure_init(void);
+void pressure_nodes(nodes_t *nodemask);
+bool pressure_effective(int *mode, nodes_t *nodemask);
+
+/* drop the nodes under pressure from a policy, which costs a load without the pressure */
+static inline void pressure_fallback(int *mode, nodes_t *nodemask) {
+    if (unlikely(atomic_load_explicit(&nr_pressured, memory_order_relaxed)) &&
+        pressure_effective(mode, nodemask))
+        atomic_fetch_add_explicit(&nr_fallbacks, 1, memory_order_relaxed);
+}
+
+/* range.c */
+bool range_register(void *addr, size_t size, int kind);
+int range_unregister(void *addr, size_t size);
+int range_lookup(void *addr);
+size_t range_snapshot(struct map_range **ranges);
+
+/* stats.c */
+enum stat_event {
+    STAT_MMAP,
+    STAT_MMAP_FAILED,
+    STAT_MBIND,
+    STAT_MBIND_FAILED,
+    STAT_MUNMAP,
+    STAT_MUNMAP_FAILED,
+    STAT_MREMAP,
+    STAT_MREMAP_FAILED,
+    NR_STAT_EVENTS,
+};
+
+enum stat_latency {
+    STAT_LATENCY_MALLOC,
+    STAT_LATENCY_FREE,
+    NR_STAT_LATENCIES,
+};
+
+extern const char *const page_kind_names[];
+extern atomic_ulong stat_events[NR_STAT_EVENTS];
+extern unsigned stats_sample;
+extern __tls unsigned stats_countdown;
+
+static inline void stat_event(int event, bool failed) {
+    /* a failure is counted on top of the call */
+    atomic_fetch_add_explicit(&stat_events[event], 1, memory_order_relaxed);
+    if (unlikely(failed))
+        atomic_fetch_add_explicit(&stat_events[event + 1], 1, memory_order_relaxed);
+}
+
+/* whether to measure the latency of the current call, once every stats_sample calls */
+static inline bool stats_sampled(void) {
+    if (likely(stats_sample == 0))
+        return false;
+    if (stats_countdown) {
+        stats_countdown--;
+        return false;
+    }
+    stats_countdown = stats_sample - 1;
+    return true;
+}
+
+uint64_t stats_clock(void);
+void stats_latency(int type, uint64_t start);
+void stats_print(void);
+
+#endif
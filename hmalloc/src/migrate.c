@@ -0,0 +1,412 @@
+/* Copyright (c) 2026 SK hynix, Inc. */
+/* SPDX-License-Identifier: BSD 2-Clause */
+
+/*
+ * Migration of allocated memory between nodes.  hmove() moves the pages of
+ * many ranges with batched move_pages() calls and then updates the memory
+ * policy of each range so that it stays on the new node:
+ *
+ *  - a range given with its length has the memory policy of its whole pages
+ *    changed to MPOL_PREFERRED for the node, so that the pages faulted later
+ *    are allocated there as well.
+ *
+ *  - an object of the hmalloc APIs shares its pages with other objects of the
+ *    same arena, so its node is recorded instead and hrealloc() grows it from
+ *    the arena of the node.
+ *
+ *  - a huge allocation has its own pages, so it takes the policy of the node
+ *    as a whole and hrealloc() binds the pages it grows by to the policy.
+ */
+
+#include "hmalloc.h"
+#include "internal.h"
+
+#include <errno.h>
+#include <numaif.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* the number of pages passed to a move_pages() call */
+#define HMOVE_BATCH 512
+
+/*
+ * hmalloc objects moved by hmove() and their nodes in an open addressing hash
+ * table.  hfree() looks up every object once any is moved, so the lookups
+ * take no lock: they retry if migrated_seq changes while they probe, and the
+ * tables replaced by migrated_grow() stay mapped for the lookups still in
+ * them, which is at most as much memory as the current table.
+ */
+struct migrated {
+    atomic_uintptr_t ptr;
+    atomic_int node;
+};
+
+struct migrated_table {
+    size_t size;
+    struct migrated slots[];
+};
+
+static _Atomic(struct migrated_table *) migrated;
+/* odd while migrate_record() or migrate_forget() changes the slots */
+static atomic_uint migrated_seq;
+atomic_size_t nr_migrated;
+static pthread_mutex_t migrated_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline size_t migrated_slot(const struct migrated_table *table, uintptr_t ptr) {
+    /* objects are at least 8 bytes aligned and the multiplication mixes the upper bits */
+    return ((ptr >> 3) * 0x9e3779b97f4a7c15ULL >> 16) & (table->size - 1);
+}
+
+static inline uintptr_t slot_ptr(const struct migrated_table *table, size_t i) {
+    return atomic_load_explicit(&table->slots[i].ptr, memory_order_relaxed);
+}
+
+static inline void slot_set(struct migrated_table *table, size_t i, uintptr_t ptr, int node) {
+    atomic_store_explicit(&table->slots[i].ptr, ptr, memory_order_relaxed);
+    atomic_store_explicit(&table->slots[i].node, node, memory_order_relaxed);
+}
+
+static size_t migrated_find(const struct migrated_table *table, uintptr_t ptr) {
+    size_t i = migrated_slot(table, ptr);
+    uintptr_t slot;
+
+    while ((slot = slot_ptr(table, i)) && slot != ptr)
+        i = (i + 1) & (table->size - 1);
+    return i;
+}
+
+static inline void migrated_write_begin(void) {
+    atomic_fetch_add_explicit(&migrated_seq, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static inline void migrated_write_end(void) {
+    atomic_fetch_add_explicit(&migrated_seq, 1, memory_order_release);
+}
+
+/* the table is mapped directly as the objects in it are freed from hfree() */
+static bool migrated_grow(void) {
+    struct migrated_table *old = atomic_load_explicit(&migrated, memory_order_relaxed);
+    size_t old_size = old ? old->size : 0;
+    size_t new_size = old_size ? old_size * 2 : PAGE_SIZE / sizeof(old->slots[0]);
+    struct migrated_table *table;
+    uintptr_t ptr;
+
+    table = mmap(NULL, sizeof(*table) + new_size * sizeof(table->slots[0]),
+                 PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (table == MAP_FAILED)
+        return false;
+
+    table->size = new_size;
+    for (size_t i = 0; i < old_size; i++) {
+        ptr = slot_ptr(old, i);
+        if (ptr) {
+            slot_set(table, migrated_find(table, ptr), ptr,
+                     atomic_load_explicit(&old->slots[i].node, memory_order_relaxed));
+        }
+    }
+    /* the lookups see the slots of the new table once they see the table */
+    atomic_store_explicit(&migrated, table, memory_order_release);
+    return true;
+}
+
+static void migrate_record(void *ptr, int node) {
+    struct migrated_table *table;
+    size_t i;
+
+    pthread_mutex_lock(&migrated_lock);
+    table = atomic_load_explicit(&migrated, memory_order_relaxed);
+    /* keep the load factor below 1/2 */
+    if (!table || (atomic_load(&nr_migrated) + 1) * 2 > table->size) {
+        if (!migrated_grow())
+            goto out;
+        table = atomic_load_explicit(&migrated, memory_order_relaxed);
+    }
+
+    migrated_write_begin();
+    i = migrated_find(table, (uintptr_t)ptr);
+    if (!slot_ptr(table, i))
+        atomic_fetch_add(&nr_migrated, 1);
+    slot_set(table, i, (uintptr_t)ptr, node);
+    migrated_write_end();
+out:
+    pthread_mutex_unlock(&migrated_lock);
+}
+
+/* the node that ptr has been moved to, or -1 if it is not moved by hmove() */
+int migrate_lookup(void *ptr) {
+    struct migrated_table *table;
+    unsigned seq;
+    int node;
+    size_t i;
+
+    do {
+        seq = atomic_load_explicit(&migrated_seq, memory_order_acquire);
+        table = atomic_load_explicit(&migrated, memory_order_acquire);
+        node = -1;
+        if (table) {
+            i = migrated_find(table, (uintptr_t)ptr);
+            if (slot_ptr(table, i))
+                node = atomic_load_explicit(&table->slots[i].node, memory_order_relaxed);
+        }
+        atomic_thread_fence(memory_order_acquire);
+    } while ((seq & 1) || seq != atomic_load_explicit(&migrated_seq, memory_order_relaxed));
+    return node;
+}
+
+void migrate_forget(void *ptr) {
+    struct migrated_table *table;
+    size_t i, j;
+
+    /* most of the objects freed are not moved, which is found without the lock */
+    if (migrate_lookup(ptr) < 0)
+        return;
+
+    pthread_mutex_lock(&migrated_lock);
+    table = atomic_load_explicit(&migrated, memory_order_relaxed);
+    i = migrated_find(table, (uintptr_t)ptr);
+    if (!slot_ptr(table, i))
+        goto out;
+
+    migrated_write_begin();
+    /* shift back the following entries that cannot be found across the hole */
+    for (j = (i + 1) & (table->size - 1); slot_ptr(table, j); j = (j + 1) & (table->size - 1)) {
+        size_t k = migrated_slot(table, slot_ptr(table, j));
+
+        if ((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j)) {
+            slot_set(table, i, slot_ptr(table, j),
+                     atomic_load_explicit(&table->slots[j].node, memory_order_relaxed));
+            i = j;
+        }
+    }
+    slot_set(table, i, 0, 0);
+    atomic_fetch_sub(&nr_migrated, 1);
+    migrated_write_end();
+out:
+    pthread_mutex_unlock(&migrated_lock);
+}
+
+/* move a batch of pages and return the number of pages not moved */
+static long move_batch(void **pages, const int *nodes, int **status, unsigned n, int flags,
+                       int *err) {
+    int result[HMOVE_BATCH];
+    long failed = 0;
+
+    if (move_pages(0, n, pages, nodes, result, flags) < 0)
+        return -1;
+
+    for (unsigned i = 0; i < n; i++) {
+        if (status[i])
+            *status[i] = result[i];
+        if (result[i] == nodes[i])
+            continue;
+        if (failed++ == 0 && *err == 0)
+            *err = result[i] < 0 ? -result[i] : EBUSY;
+    }
+    return failed;
+}
+
+static void move_policy(struct hmove *move, size_t page_size) {
+    size_t length = move->length;
+    struct hmalloc_policy *policy;
+    uintptr_t start, end;
+    nodes_t nodemask;
+    long ret;
+
+    if (length == 0) {
+        /* a huge allocation has its own pages and grows with the policy of the new node */
+        length = huge_lookup(move->addr);
+        if (length && (policy = node_policy(move->node)) && huge_set_policy(move->addr, policy))
+            return;
+        if (length == 0) {
+            if (move->addr)
+                migrate_record(move->addr, move->node);
+            return;
+        }
+    }
+
+    start = ((uintptr_t)move->addr + page_size - 1) & ~(page_size - 1);
+    end = ((uintptr_t)move->addr + length) & ~(page_size - 1);
+    if (start >= end)
+        return;
+
+    /* the pages shared with the neighbors are moved but keep their memory policy */
+    nodes_of(&nodemask, move->node);
+    ret = mbind((void *)start, end - start, MPOL_PREFERRED, nodemask.bits, NODEMASK_MAXNODE, 0);
+    stat_event(STAT_MBIND, ret != 0);
+}
+
+long hmove(struct hmove *moves, size_t nr_moves, int flags) {
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    void *pages[HMOVE_BATCH];
+    int nodes[HMOVE_BATCH];
+    int *status[HMOVE_BATCH];
+    long failed = 0, ret;
+    unsigned n = 0;
+    int err = 0;
+
+    if (flags == 0)
+        flags = MPOL_MF_MOVE;
+    if ((moves == NULL && nr_moves) || (flags & ~(MPOL_MF_MOVE | MPOL_MF_MOVE_ALL))) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (size_t i = 0; i < nr_moves; i++) {
+        if (moves[i].node < 0 || moves[i].node >= HMALLOC_MAX_NODES) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    for (size_t i = 0; i < nr_moves; i++) {
+        struct hmove *move = &moves[i];
+        size_t length = move->length ? move->length : hmalloc_usable_size(move->addr);
+        uintptr_t start = (uintptr_t)move->addr & ~(page_size - 1);
+        uintptr_t end = ((uintptr_t)move->addr + length + page_size - 1) & ~(page_size - 1);
+
+        for (size_t page = 0; start + page * page_size < end; page++) {
+            pages[n] = (void *)(start + page * page_size);
+            nodes[n] = move->node;
+            status[n] = move->status ? &move->status[page] : NULL;
+            if (++n < HMOVE_BATCH)
+                continue;
+
+            ret = move_batch(pages, nodes, status, n, flags, &err);
+            if (ret < 0)
+                return -1;
+            failed += ret;
+            n = 0;
+        }
+    }
+    if (n) {
+        ret = move_batch(pages, nodes, status, n, flags, &err);
+        if (ret < 0)
+            return -1;
+        failed += ret;
+    }
+
+    for (size_t i = 0; i < nr_moves; i++)
+        move_policy(&moves[i], page_size);
+
+    if (failed)
+        errno = err;
+    return failed;
+}
+
+int hmalloc_migrate(void *ptr, int node) {
+    struct hmove move = {.addr = ptr, .node = node};
+    long ret;
+
+    if (ptr == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    ret = hmove(&move, 1, 0);
+    return ret ? -1 : 0;
+}
+
+/* requests of hmove_async() handled in order by a background thread */
+struct hmove_work {
+    struct hmove *moves;
+    size_t nr_moves;
+    int flags;
+    hmove_callback_t callback;
+    void *arg;
+    struct hmove_work *next;
+};
+
+static struct hmove_work *work_head;
+static struct hmove_work **work_tail = &work_head;
+static bool worker_running;
+static bool atfork_registered;
+static pthread_mutex_t work_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+
+static void *hmove_worker(void *arg __unused) {
+    for (;;) {
+        struct hmove_work *work;
+        long ret;
+
+        pthread_mutex_lock(&work_lock);
+        while (!work_head)
+            pthread_cond_wait(&work_cond, &work_lock);
+        work = work_head;
+        work_head = work->next;
+        if (!work_head)
+            work_tail = &work_head;
+        pthread_mutex_unlock(&work_lock);
+
+        ret = hmove(work->moves, work->nr_moves, work->flags);
+        if (work->callback)
+            work->callback(work->moves, work->nr_moves, ret, work->arg);
+        free(work);
+    }
+    return NULL;
+}
+
+/* the worker does not exist in the child, and the requests belong to the parent */
+static void hmove_atfork_child(void) {
+    pthread_mutex_init(&work_lock, NULL);
+    work_head = NULL;
+    work_tail = &work_head;
+    worker_running = false;
+}
+
+static int hmove_worker_start(void) {
+    pthread_attr_t attr;
+    pthread_t thread;
+    int err;
+
+    if (!atfork_registered) {
+        pthread_atfork(NULL, NULL, hmove_atfork_child);
+        atfork_registered = true;
+    }
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    err = pthread_create(&thread, &attr, hmove_worker, NULL);
+    pthread_attr_destroy(&attr);
+    if (err)
+        return err;
+
+    pthread_setname_np(thread, "hmove");
+    worker_running = true;
+    return 0;
+}
+
+int hmove_async(struct hmove *moves, size_t nr_moves, int flags, hmove_callback_t callback,
+                void *arg) {
+    struct hmove_work *work;
+    int err = 0;
+
+    if (moves == NULL && nr_moves) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    work = malloc(sizeof(*work));
+    if (!work)
+        return -1;
+    *work = (struct hmove_work){moves, nr_moves, flags, callback, arg, NULL};
+
+    pthread_mutex_lock(&work_lock);
+    if (!worker_running)
+        err = hmove_worker_start();
+    if (!err) {
+        *work_tail = work;
+        work_tail = &work->next;
+        pthread_cond_signal(&work_cond);
+    }
+    pthread_mutex_unlock(&work_lock);
+
+    if (err) {
+        free(work);
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,104 @@
+/* Copyright (c) 2026 SK hynix, Inc. */
+/* SPDX-License-Identifier: BSD 2-Clause */
+
+/*
+ * Node masks of up to HMALLOC_MAX_NODES nodes, which is the limit of the
+ * kernel, in the layout of the nodemask of mbind().  They are fixed in size so
+ * that they can be copied and kept in the allocation path without allocating
+ * memory as the struct bitmask of libnuma does.
+ */
+
+#ifndef HMALLOC_NODEMASK_H
+#define HMALLOC_NODEMASK_H
+
+#include "hmalloc.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#define NODEMASK_LONG_BITS (sizeof(unsigned long) * 8)
+
+/* the maxnode of mbind() and get_mempolicy(), which drop the last bit */
+#define NODEMASK_MAXNODE (HMALLOC_MAX_NODES + 1)
+
+typedef struct {
+    unsigned long bits[HMALLOC_NODEMASK_LONGS];
+} nodes_t;
+
+static inline void nodes_zero(nodes_t *mask) {
+    memset(mask, 0, sizeof(*mask));
+}
+
+static inline bool nodes_isset(const nodes_t *mask, int node) {
+    return mask->bits[node / NODEMASK_LONG_BITS] & (1UL << (node % NODEMASK_LONG_BITS));
+}
+
+static inline void nodes_set(nodes_t *mask, int node) {
+    mask->bits[node / NODEMASK_LONG_BITS] |= 1UL << (node % NODEMASK_LONG_BITS);
+}
+
+static inline void nodes_clear(nodes_t *mask, int node) {
+    mask->bits[node / NODEMASK_LONG_BITS] &= ~(1UL << (node % NODEMASK_LONG_BITS));
+}
+
+/* a mask of a single node */
+static inline void nodes_of(nodes_t *mask, int node) {
+    nodes_zero(mask);
+    nodes_set(mask, node);
+}
+
+static inline bool nodes_empty(const nodes_t *mask) {
+    for (size_t i = 0; i < HMALLOC_NODEMASK_LONGS; i++) {
+        if (mask->bits[i])
+            return false;
+    }
+    return true;
+}
+
+static inline int nodes_weight(const nodes_t *mask) {
+    int weight = 0;
+
+    for (size_t i = 0; i < HMALLOC_NODEMASK_LONGS; i++)
+        weight += __builtin_popcountl(mask->bits[i]);
+    return weight;
+}
+
+static inline bool nodes_equal(const nodes_t *a, const nodes_t *b) {
+    return !memcmp(a, b, sizeof(*a));
+}
+
+static inline bool nodes_intersects(const nodes_t *a, const nodes_t *b) {
+    for (size_t i = 0; i < HMALLOC_NODEMASK_LONGS; i++) {
+        if (a->bits[i] & b->bits[i])
+            return true;
+    }
+    return false;
+}
+
+/* dst = a & ~b */
+static inline void nodes_andnot(nodes_t *dst, const nodes_t *a, const nodes_t *b) {
+    for (size_t i = 0; i < HMALLOC_NODEMASK_LONGS; i++)
+        dst->bits[i] = a->bits[i] & ~b->bits[i];
+}
+
+/* the first node in mask from node, or -1 if there is none */
+static inline int nodes_next(const nodes_t *mask, int node) {
+    while (node < HMALLOC_MAX_NODES) {
+        unsigned long word = mask->bits[node / NODEMASK_LONG_BITS] >> (node % NODEMASK_LONG_BITS);
+
+        if (word)
+            return node + __builtin_ctzl(word);
+        node = (node / NODEMASK_LONG_BITS + 1) * NODEMASK_LONG_BITS;
+    }
+    return -1;
+}
+
+static inline int nodes_first(const nodes_t *mask) {
+    return nodes_next(mask, 0);
+}
+
+#define for_each_node_mask(node, mask)                                                     \
+    for ((node) = nodes_first(mask); (node) >= 0; (node) = nodes_next(mask, (node) + 1))
+
+#endif
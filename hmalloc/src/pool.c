@@ -0,0 +1,492 @@
+/* Copyright (c) 2026 SK hynix, Inc. */
+/* SPDX-License-Identifier: BSD 2-Clause */
+
+/*
+ * Fixed-size object pools that carve objects out of slabs mapped by hmmap(),
+ * so the objects are placed by the memory policy of the pool and packed
+ * without the rounding of the jemalloc size classes.
+ *
+ * Each slab is aligned to its size so that an object finds its slab by masking
+ * its address, and no header is needed per object.  A slab is owned by a
+ * single thread, which allocates and frees its objects without atomics.  The
+ * other threads push the objects they free onto the remote list of the slab,
+ * and the owner takes the whole list at once when its local list runs out.
+ * The slabs of exited threads are left to be adopted by the other threads.
+ *
+ * The owner allocates from the slabs with free space only.  A slab that runs
+ * out is put on the full list, and it is put back when its owner frees an
+ * object to it, or queued to the owner under pool_lock when another thread
+ * frees the first object to it, so the slow path never walks the full slabs.
+ */
+
+#include "env.h"
+#include "hmalloc.h"
+#include "internal.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#define POOL_SLAB_SIZE (2UL << 20)
+
+/* at least 8 objects per slab */
+#define POOL_MAX_OBJ_SIZE (POOL_SLAB_SIZE / 8)
+
+/* the state of a slab, which is changed from POOL_SLAB_FULL by any thread */
+enum {
+    /* the current slab of the owner or on its partial list, or abandoned */
+    POOL_SLAB_PARTIAL,
+    /* on the full list of the owner */
+    POOL_SLAB_FULL,
+    /* on the full list and on the reclaim list of the owner */
+    POOL_SLAB_RECLAIM,
+};
+
+struct pool_slab {
+    struct hmpool *pool;
+    /* the thread_id of the owner thread, or 0 if the owner has exited */
+    _Atomic uintptr_t owner;
+    /* the heap of the owner, which is valid under pool_lock while owner is set */
+    struct pool_heap *heap;
+    _Atomic int state;
+    /* objects freed by the owner */
+    void *free;
+    /* objects freed by the other threads */
+    void *_Atomic remote;
+    /* objects that have never been allocated are carved from bump */
+    char *bump;
+    char *end;
+    /* the slabs of a list of the owner or of the abandoned list */
+    struct pool_slab *next;
+    struct pool_slab *prev;
+    /* the reclaim list of the owner */
+    struct pool_slab *reclaim_next;
+    /* all the slabs of the pool */
+    struct pool_slab *pool_next;
+};
+
+/* the slabs of a pool owned by a thread */
+struct pool_heap {
+    /* NULL once the pool is destroyed */
+    struct hmpool *_Atomic pool;
+    struct pool_slab *current;
+    /* the slabs with free space other than current */
+    struct pool_slab *partial;
+    /* the slabs that ran out, which is doubly linked to take any of them */
+    struct pool_slab *full;
+    /* the full slabs freed to by the other threads, under pool_lock */
+    struct pool_slab *_Atomic reclaim;
+    /* the heaps of the thread */
+    struct pool_heap *next;
+    /* the heaps of the pool */
+    struct pool_heap *pool_next;
+};
+
+struct hmpool {
+    size_t obj_size;
+    /* the offset of the first object in a slab */
+    size_t offset;
+    hmalloc_policy_t *policy;
+    int map_flags;
+    struct pool_slab *slabs;
+    struct pool_slab *abandoned;
+    struct pool_heap *heaps;
+};
+
+/* protects the lists of the pools, which are changed only on slow paths */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_key_t heap_key;
+static pthread_once_t heap_key_once = PTHREAD_ONCE_INIT;
+
+static __tls struct pool_heap *thread_heaps;
+static __tls struct pool_heap *last_heap;
+
+/* only its address is used to identify the thread */
+static __tls char thread_id;
+
+static inline uintptr_t current_thread(void) {
+    return (uintptr_t)&thread_id;
+}
+
+static inline struct pool_slab *slab_of(void *ptr) {
+    return (struct pool_slab *)((uintptr_t)ptr & ~(POOL_SLAB_SIZE - 1));
+}
+
+/* must be called with pool_lock held */
+static void slab_abandon(struct hmpool *pool, struct pool_slab *slab) {
+    atomic_store_explicit(&slab->owner, 0, memory_order_relaxed);
+    atomic_store_explicit(&slab->state, POOL_SLAB_PARTIAL, memory_order_relaxed);
+    slab->next = pool->abandoned;
+    pool->abandoned = slab;
+}
+
+/* give the slabs of an exiting thread to the pools, must be called with pool_lock held */
+static void heap_abandon(struct pool_heap *heap) {
+    struct hmpool *pool = atomic_load_explicit(&heap->pool, memory_order_relaxed);
+    struct pool_heap **p;
+    struct pool_slab *slab, *next;
+
+    if (pool == NULL)
+        return;
+
+    if (heap->current)
+        slab_abandon(pool, heap->current);
+    for (slab = heap->partial; slab; slab = next) {
+        next = slab->next;
+        slab_abandon(pool, slab);
+    }
+    /* the slabs to reclaim are on the full list as well */
+    for (slab = heap->full; slab; slab = next) {
+        next = slab->next;
+        slab_abandon(pool, slab);
+    }
+    for (p = &pool->heaps; *p != heap; p = &(*p)->pool_next)
+        ;
+    *p = heap->pool_next;
+}
+
+static void heap_destructor(void *arg) {
+    struct pool_heap *heap, *next;
+
+    pthread_mutex_lock(&pool_lock);
+    for (heap = arg; heap; heap = heap->next)
+        heap_abandon(heap);
+    pthread_mutex_unlock(&pool_lock);
+
+    for (heap = arg; heap; heap = next) {
+        next = heap->next;
+        free(heap);
+    }
+    thread_heaps = last_heap = NULL;
+}
+
+static void heap_key_create(void) {
+    pthread_key_create(&heap_key, heap_destructor);
+}
+
+static inline struct pool_heap *heap_lookup(struct hmpool *pool) {
+    struct pool_heap *heap = last_heap;
+
+    if (likely(heap && atomic_load_explicit(&heap->pool, memory_order_relaxed) == pool))
+        return heap;
+
+    for (heap = thread_heaps; heap; heap = heap->next) {
+        if (atomic_load_explicit(&heap->pool, memory_order_relaxed) == pool) {
+            last_heap = heap;
+            return heap;
+        }
+    }
+    return NULL;
+}
+
+static struct pool_heap *heap_create(struct hmpool *pool) {
+    struct pool_heap *heap, **p;
+
+    pthread_once(&heap_key_once, heap_key_create);
+
+    /* drop the heaps of the destroyed pools */
+    for (p = &thread_heaps; (heap = *p);) {
+        if (atomic_load_explicit(&heap->pool, memory_order_relaxed) == NULL) {
+            *p = heap->next;
+            free(heap);
+        } else {
+            p = &heap->next;
+        }
+    }
+
+    heap = calloc(1, sizeof(*heap));
+    if (heap == NULL)
+        return NULL;
+    atomic_init(&heap->pool, pool);
+
+    pthread_mutex_lock(&pool_lock);
+    heap->pool_next = pool->heaps;
+    pool->heaps = heap;
+    pthread_mutex_unlock(&pool_lock);
+
+    heap->next = thread_heaps;
+    thread_heaps = last_heap = heap;
+    pthread_setspecific(heap_key, thread_heaps);
+    return heap;
+}
+
+static inline void *pool_slab_alloc(struct pool_slab *slab, size_t obj_size) {
+    void *obj = slab->free;
+
+    if (likely(obj)) {
+        slab->free = *(void **)obj;
+        return obj;
+    }
+    if (likely(slab->bump + obj_size <= slab->end)) {
+        obj = slab->bump;
+        slab->bump += obj_size;
+        return obj;
+    }
+    if (atomic_load_explicit(&slab->remote, memory_order_relaxed)) {
+        obj = atomic_exchange_explicit(&slab->remote, NULL, memory_order_acquire);
+        slab->free = *(void **)obj;
+        return obj;
+    }
+    return NULL;
+}
+
+static inline void slab_push(struct pool_slab **list, struct pool_slab *slab) {
+    slab->prev = NULL;
+    slab->next = *list;
+    if (*list)
+        (*list)->prev = slab;
+    *list = slab;
+}
+
+static inline void slab_unlink(struct pool_slab **list, struct pool_slab *slab) {
+    if (slab->prev)
+        slab->prev->next = slab->next;
+    else
+        *list = slab->next;
+    if (slab->next)
+        slab->next->prev = slab->prev;
+}
+
+/* move a full slab of the owner back to its partial list unless it is queued to reclaim */
+static void slab_refill(struct pool_heap *heap, struct pool_slab *slab) {
+    int state = POOL_SLAB_FULL;
+
+    if (!atomic_compare_exchange_strong(&slab->state, &state, POOL_SLAB_PARTIAL))
+        return;
+    slab_unlink(&heap->full, slab);
+    slab_push(&heap->partial, slab);
+}
+
+/* put a slab that ran out on the full list of the owner */
+static void slab_retire(struct pool_heap *heap, struct pool_slab *slab) {
+    slab_push(&heap->full, slab);
+    atomic_store(&slab->state, POOL_SLAB_FULL);
+    /* an object freed by another thread before the state is set is not queued */
+    if (atomic_load(&slab->remote))
+        slab_refill(heap, slab);
+}
+
+/* queue a full slab to its owner when another thread frees an object to it */
+static void slab_queue(struct pool_slab *slab) {
+    int state = POOL_SLAB_FULL;
+
+    pthread_mutex_lock(&pool_lock);
+    /* an abandoned slab is always partial, so the heap of the owner is alive */
+    if (atomic_compare_exchange_strong(&slab->state, &state, POOL_SLAB_RECLAIM)) {
+        struct pool_heap *heap = slab->heap;
+
+        slab->reclaim_next = atomic_load_explicit(&heap->reclaim, memory_order_relaxed);
+        atomic_store_explicit(&heap->reclaim, slab, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&pool_lock);
+}
+
+/* move the full slabs freed to by the other threads to the partial list */
+static void heap_reclaim(struct pool_heap *heap) {
+    struct pool_slab *slab, *next;
+
+    pthread_mutex_lock(&pool_lock);
+    slab = atomic_load_explicit(&heap->reclaim, memory_order_relaxed);
+    atomic_store_explicit(&heap->reclaim, NULL, memory_order_relaxed);
+    pthread_mutex_unlock(&pool_lock);
+
+    for (; slab; slab = next) {
+        next = slab->reclaim_next;
+        atomic_store_explicit(&slab->state, POOL_SLAB_PARTIAL, memory_order_relaxed);
+        slab_unlink(&heap->full, slab);
+        slab_push(&heap->partial, slab);
+    }
+}
+
+static struct pool_slab *slab_create(struct hmpool *pool, struct pool_heap *heap) {
+    size_t map_size = POOL_SLAB_SIZE * 2;
+    uintptr_t start, aligned, end;
+    struct pool_slab *slab;
+    void *addr;
+
+    /* over-map then trim to align the slab to its size */
+    addr = hmmap_p(pool->policy, NULL, map_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | pool->map_flags, -1, 0);
+    if (addr == MAP_FAILED || addr == NULL)
+        return NULL;
+
+    start = (uintptr_t)addr;
+    end = start + map_size;
+    aligned = (start + POOL_SLAB_SIZE - 1) & ~(POOL_SLAB_SIZE - 1);
+    if (aligned > start)
+        hmunmap(addr, aligned - start);
+    if (end > aligned + POOL_SLAB_SIZE)
+        hmunmap((void *)(aligned + POOL_SLAB_SIZE), end - (aligned + POOL_SLAB_SIZE));
+
+    slab = (struct pool_slab *)aligned;
+    slab->pool = pool;
+    atomic_init(&slab->owner, current_thread());
+    slab->heap = heap;
+    atomic_init(&slab->state, POOL_SLAB_PARTIAL);
+    slab->free = NULL;
+    atomic_init(&slab->remote, NULL);
+    slab->bump = (char *)slab + pool->offset;
+    slab->end = (char *)slab + POOL_SLAB_SIZE;
+
+    pthread_mutex_lock(&pool_lock);
+    slab->pool_next = pool->slabs;
+    pool->slabs = slab;
+    pthread_mutex_unlock(&pool_lock);
+    return slab;
+}
+
+/* take a slab of an exited thread that has free objects */
+static void *slab_adopt(struct hmpool *pool, struct pool_heap *heap) {
+    struct pool_slab *slab;
+    void *obj = NULL;
+
+    pthread_mutex_lock(&pool_lock);
+    while (obj == NULL && (slab = pool->abandoned)) {
+        pool->abandoned = slab->next;
+        atomic_store_explicit(&slab->owner, current_thread(), memory_order_relaxed);
+        slab->heap = heap;
+        obj = pool_slab_alloc(slab, pool->obj_size);
+        if (obj)
+            heap->current = slab;
+        else
+            slab_retire(heap, slab);
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return obj;
+}
+
+static void *pool_alloc_slow(struct hmpool *pool, struct pool_heap *heap) {
+    struct pool_slab *slab;
+    void *obj;
+
+    if (heap->current) {
+        slab_retire(heap, heap->current);
+        heap->current = NULL;
+    }
+    if (atomic_load_explicit(&heap->reclaim, memory_order_relaxed))
+        heap_reclaim(heap);
+
+    /* the slabs that the objects freed since have made room in */
+    while ((slab = heap->partial)) {
+        heap->partial = slab->next;
+        obj = pool_slab_alloc(slab, pool->obj_size);
+        if (obj) {
+            heap->current = slab;
+            return obj;
+        }
+        slab_retire(heap, slab);
+    }
+
+    obj = slab_adopt(pool, heap);
+    if (obj)
+        return obj;
+
+    slab = slab_create(pool, heap);
+    if (slab == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    heap->current = slab;
+    return pool_slab_alloc(slab, pool->obj_size);
+}
+
+hmpool_t *hmpool_create(size_t obj_size, size_t align, hmalloc_policy_t *policy) {
+    struct hmpool *pool;
+
+    if (obj_size < sizeof(void *))
+        obj_size = sizeof(void *);
+    if (align == 0) {
+        /* the natural alignment of a struct of obj_size bytes */
+        align = obj_size & -obj_size;
+        if (align > 16)
+            align = 16;
+    }
+    if (obj_size > POOL_MAX_OBJ_SIZE || (align & (align - 1)) || align > POOL_MAX_OBJ_SIZE) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    pool = calloc(1, sizeof(*pool));
+    if (pool == NULL)
+        return NULL;
+
+    /* objects are packed by the alignment and each holds a free list link when it is freed */
+    if (align < sizeof(void *))
+        align = sizeof(void *);
+    pool->obj_size = (obj_size + align - 1) & ~(align - 1);
+    pool->offset = (sizeof(struct pool_slab) + align - 1) & ~(align - 1);
+    pool->policy = policy;
+    if (hugepage_mode() != HUGEPAGE_NONE)
+        pool->map_flags = HMAP_HUGEPAGE;
+    return pool;
+}
+
+void hmpool_destroy(hmpool_t *pool) {
+    struct pool_slab *slab, *next;
+    struct pool_heap *heap;
+
+    if (pool == NULL)
+        return;
+
+    /* the heaps are freed by their threads later */
+    pthread_mutex_lock(&pool_lock);
+    for (heap = pool->heaps; heap; heap = heap->pool_next)
+        atomic_store_explicit(&heap->pool, NULL, memory_order_relaxed);
+    pthread_mutex_unlock(&pool_lock);
+
+    for (slab = pool->slabs; slab; slab = next) {
+        next = slab->pool_next;
+        hmunmap(slab, POOL_SLAB_SIZE);
+    }
+    free(pool);
+}
+
+void *hmpool_alloc(hmpool_t *pool) {
+    struct pool_heap *heap = heap_lookup(pool);
+    void *obj;
+
+    if (unlikely(heap == NULL)) {
+        heap = heap_create(pool);
+        if (heap == NULL)
+            return NULL;
+    }
+
+    if (likely(heap->current)) {
+        obj = pool_slab_alloc(heap->current, pool->obj_size);
+        if (likely(obj))
+            return obj;
+    }
+    return pool_alloc_slow(pool, heap);
+}
+
+void hmpool_free(hmpool_t *pool, void *ptr) {
+    struct pool_slab *slab;
+    void *head;
+
+    if (unlikely(ptr == NULL))
+        return;
+
+    slab = slab_of(ptr);
+    assert(slab->pool == pool);
+    (void)pool;
+
+    if (likely(atomic_load_explicit(&slab->owner, memory_order_relaxed) == current_thread())) {
+        *(void **)ptr = slab->free;
+        slab->free = ptr;
+        if (unlikely(atomic_load_explicit(&slab->state, memory_order_relaxed) == POOL_SLAB_FULL))
+            slab_refill(slab->heap, slab);
+        return;
+    }
+
+    head = atomic_load_explicit(&slab->remote, memory_order_relaxed);
+    do {
+        *(void **)ptr = head;
+    } while (!atomic_compare_exchange_weak_explicit(&slab->remote, &head, ptr,
+                                                    memory_order_seq_cst, memory_order_relaxed));
+    /* pairs with slab_retire() so that either of them sees the other */
+    if (unlikely(atomic_load(&slab->state) == POOL_SLAB_FULL))
+        slab_queue(slab);
+}
@@ -0,0 +1,256 @@
+/* Copyright (c) 2026 SK hynix, Inc. */
+/* SPDX-License-Identifier: BSD 2-Clause */
+
+#include "hmalloc.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <numa.h>
+#include <numaif.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifndef MADV_POPULATE_READ
+#define MADV_POPULATE_READ 22
+#endif
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+/* unit of work that each worker takes at a time */
+#define PREFAULT_CHUNK (64UL << 20)
+
+/* threads beyond this limit are not created even if more are requested */
+#define PREFAULT_MAX_THREADS 256
+
+struct prefault {
+    char *start;
+    size_t length;
+    size_t page_size;
+    atomic_size_t next;
+    atomic_int error;
+};
+
+/* 1 if the kernel knows MADV_POPULATE_WRITE, which is added in v5.14, -1 if not, 0 if unknown */
+static atomic_int populate_support;
+
+static bool has_populate(char *addr) {
+    int support = atomic_load_explicit(&populate_support, memory_order_relaxed);
+
+    if (support == 0) {
+        /* an empty range only checks if the advice is known */
+        support = madvise(addr, 0, MADV_POPULATE_WRITE) ? -1 : 1;
+        atomic_store_explicit(&populate_support, support, memory_order_relaxed);
+    }
+    return support > 0;
+}
+
+/*
+ * Fault every page of the vmas in the range by writing to the writable ones
+ * without changing their contents, and by reading the others, which would
+ * raise SIGSEGV on a write.  The vmas are read from /proc/self/maps.
+ */
+static int touch(char *addr, size_t length, size_t page_size) {
+    uintptr_t end = (uintptr_t)addr + length;
+    char *line = NULL;
+    size_t len = 0;
+    int err = 0;
+    FILE *fp;
+
+    fp = fopen("/proc/self/maps", "r");
+    if (!fp)
+        return errno;
+
+    while (!err && getline(&line, &len, fp) > 0) {
+        uintptr_t start, stop;
+        char perms[5];
+
+        if (sscanf(line, "%" SCNxPTR "-%" SCNxPTR " %4s", &start, &stop, perms) != 3)
+            continue;
+        if (stop <= (uintptr_t)addr || start >= end)
+            continue;
+        if (start < (uintptr_t)addr)
+            start = (uintptr_t)addr;
+        if (stop > end)
+            stop = end;
+
+        if (perms[1] == 'w') {
+            for (uintptr_t page = start; page < stop; page += page_size)
+                __atomic_fetch_add((char *)page, 0, __ATOMIC_RELAXED);
+        } else if (perms[0] == 'r') {
+            for (uintptr_t page = start; page < stop; page += page_size)
+                (void)*(volatile char *)page;
+        } else {
+            /* same as MADV_POPULATE_READ for PROT_NONE */
+            err = EINVAL;
+        }
+    }
+
+    free(line);
+    fclose(fp);
+    return err;
+}
+
+static int populate(char *addr, size_t length, size_t page_size) {
+    if (has_populate(addr)) {
+        if (madvise(addr, length, MADV_POPULATE_WRITE) == 0)
+            return 0;
+        /* EINVAL is also returned for a range that is not writable, which is read instead */
+        if (errno == EINVAL && madvise(addr, length, MADV_POPULATE_READ) == 0)
+            return 0;
+        return errno;
+    }
+
+    /* make sure the whole range is mapped before touching it */
+    if (msync(addr, length, MS_ASYNC))
+        return errno;
+    return touch(addr, length, page_size);
+}
+
+static void *prefault_worker(void *arg) {
+    struct prefault *pf = arg;
+    size_t offset;
+
+    while ((offset = atomic_fetch_add(&pf->next, PREFAULT_CHUNK)) < pf->length) {
+        size_t length = pf->length - offset;
+        int err;
+
+        if (length > PREFAULT_CHUNK)
+            length = PREFAULT_CHUNK;
+        err = populate(pf->start + offset, length, pf->page_size);
+        if (err) {
+            int expected = 0;
+            atomic_compare_exchange_strong(&pf->error, &expected, err);
+        }
+    }
+    return NULL;
+}
+
+/* the closest node that has cpus, or the node itself if no node has cpus */
+static int nearest_cpu_node(int node, struct bitmask *cpus) {
+    int best = node, best_distance = INT32_MAX;
+
+    for (int n = 0; n <= numa_max_node(); n++) {
+        int distance;
+
+        if (!numa_bitmask_isbitset(numa_all_nodes_ptr, n))
+            continue;
+        if (numa_node_to_cpus(n, cpus) || numa_bitmask_weight(cpus) == 0)
+            continue;
+        distance = numa_distance(node, n);
+        if (distance > 0 && distance < best_distance) {
+            best = n;
+            best_distance = distance;
+        }
+    }
+    return best;
+}
+
+/*
+ * Find the cpus near the nodes of the memory policy of addr.  CXL memory nodes
+ * have no cpus, so the cpus of the closest node are used for them instead.
+ * It returns NULL if the policy does not name any node.
+ */
+static cpu_set_t *prefault_cpus(void *addr, size_t *setsize, int *ncpus) {
+    struct bitmask *nodes = numa_allocate_nodemask();
+    struct bitmask *node_cpus = numa_allocate_cpumask();
+    struct bitmask *allowed = numa_allocate_cpumask();
+    cpu_set_t *set = NULL;
+    int mode;
+
+    if (get_mempolicy(&mode, nodes->maskp, nodes->size + 1, addr, MPOL_F_ADDR) ||
+        mode == MPOL_DEFAULT || numa_bitmask_weight(nodes) == 0)
+        goto out;
+    if (numa_sched_getaffinity(0, allowed) < 0)
+        goto out;
+
+    *setsize = CPU_ALLOC_SIZE(allowed->size);
+    set = CPU_ALLOC(allowed->size);
+    if (set == NULL)
+        goto out;
+    CPU_ZERO_S(*setsize, set);
+
+    for (unsigned node = 0; node < nodes->size; node++) {
+        if (!numa_bitmask_isbitset(nodes, node))
+            continue;
+        if (numa_node_to_cpus(nearest_cpu_node(node, node_cpus), node_cpus))
+            continue;
+        for (unsigned cpu = 0; cpu < node_cpus->size; cpu++) {
+            if (numa_bitmask_isbitset(node_cpus, cpu) && numa_bitmask_isbitset(allowed, cpu))
+                CPU_SET_S(cpu, *setsize, set);
+        }
+    }
+
+    *ncpus = CPU_COUNT_S(*setsize, set);
+    if (*ncpus == 0) {
+        CPU_FREE(set);
+        set = NULL;
+    }
+out:
+    numa_free_cpumask(allowed);
+    numa_free_cpumask(node_cpus);
+    numa_free_nodemask(nodes);
+    return set;
+}
+
+int hmmap_populate(void *addr, size_t length, int nthreads) {
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)addr & ~(page_size - 1);
+    pthread_t threads[PREFAULT_MAX_THREADS];
+    struct prefault pf;
+    pthread_attr_t attr;
+    size_t nchunks, setsize = 0;
+    cpu_set_t *cpus;
+    int ncpus = 0, created = 0;
+
+    if (length == 0)
+        return 0;
+
+    pf.start = (char *)start;
+    pf.length = ((uintptr_t)addr + length - start + page_size - 1) & ~(page_size - 1);
+    pf.page_size = page_size;
+    atomic_init(&pf.next, 0);
+    atomic_init(&pf.error, 0);
+
+    cpus = prefault_cpus(pf.start, &setsize, &ncpus);
+    if (nthreads <= 0)
+        nthreads = cpus ? ncpus : numa_num_task_cpus();
+
+    nchunks = (pf.length + PREFAULT_CHUNK - 1) / PREFAULT_CHUNK;
+    if ((size_t)nthreads > nchunks)
+        nthreads = nchunks;
+    if (nthreads > PREFAULT_MAX_THREADS)
+        nthreads = PREFAULT_MAX_THREADS;
+
+    /* the calling thread works as well so one fewer worker is created */
+    if (nthreads > 1) {
+        pthread_attr_init(&attr);
+        if (cpus)
+            pthread_attr_setaffinity_np(&attr, setsize, cpus);
+        for (; created < nthreads - 1; created++) {
+            if (pthread_create(&threads[created], &attr, prefault_worker, &pf))
+                break;
+        }
+        pthread_attr_destroy(&attr);
+    }
+
+    prefault_worker(&pf);
+    for (int i = 0; i < created; i++)
+        pthread_join(threads[i], NULL);
+
+    if (cpus)
+        CPU_FREE(cpus);
+
+    if (atomic_load(&pf.error)) {
+        errno = atomic_load(&pf.error);
+        return -1;
+    }
+    return 0;
+}
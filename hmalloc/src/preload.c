@@ -0,0 +1,209 @@
+/* Copyright (c) 2026 SK hynix, Inc. */
+/* SPDX-License-Identifier: BSD 2-Clause */
+
+/*
+ * libhmalloc-preload.so interposes the malloc family and large anonymous
+ * mmap() so that unmodified programs allocate from the hmalloc pool.
+ *
+ *   $ hmctl -m 2 --preload=4K ./prog
+ *
+ * Allocations smaller than HMALLOC_PRELOAD_THRESHOLD stay in the default
+ * jemalloc arenas and the rest go to hmalloc APIs.  Anonymous mappings of
+ * HMALLOC_PRELOAD_MMAP_THRESHOLD bytes or larger are mapped by hmmap().
+ */
+
+#include "env.h"
+#include "hmalloc.h"
+#include "internal.h"
+
+#include <errno.h>
+#include <jemalloc/jemalloc.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define is_pow2(val) (((val) & ((val)-1)) == 0)
+
+/* set once hmalloc is initialized with jemalloc, before that all go to the default arenas */
+static bool ready;
+static size_t threshold;
+static size_t mmap_threshold;
+
+/*
+ * Non-zero while the current thread is inside the allocator so that the
+ * mappings of jemalloc and hmalloc themselves are not interposed.
+ */
+static __tls unsigned in_hmalloc;
+
+__attribute__((constructor)) static void preload_init(void) {
+    threshold = getenv_preload_threshold();
+    mmap_threshold = getenv_preload_mmap_threshold();
+    /*
+     * free() cannot tell the slabs of the built-in allocator from the default
+     * arenas, so everything stays in the default arenas unless jemalloc backs
+     * the hmalloc pool as well.
+     */
+    ready = getenv_backend() == BACKEND_JEMALLOC;
+}
+
+static inline bool to_hmalloc(size_t size) {
+    return likely(ready) && size >= threshold;
+}
+
+void *malloc(size_t size) {
+    void *ptr;
+
+    in_hmalloc++;
+    if (to_hmalloc(size))
+        ptr = hmalloc(size);
+    else if (unlikely((ptr = mallocx(size ? size : 1, 0)) == NULL))
+        errno = ENOMEM;
+    in_hmalloc--;
+    return ptr;
+}
+
+void free(void *ptr) {
+    if (unlikely(ptr == NULL))
+        return;
+
+    /* only the allocations of threshold bytes or larger can be from hmalloc */
+    in_hmalloc++;
+    if (!ready || (threshold && !huge_lookup(ptr) && sallocx(ptr, 0) < threshold))
+        dallocx(ptr, 0);
+    else
+        hfree(ptr);
+    in_hmalloc--;
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    size_t total;
+    void *ptr;
+
+    if (unlikely(__builtin_mul_overflow(nmemb, size, &total))) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    in_hmalloc++;
+    if (to_hmalloc(total))
+        ptr = hcalloc(nmemb, size);
+    else if (unlikely((ptr = mallocx(total ? total : 1, MALLOCX_ZERO)) == NULL))
+        errno = ENOMEM;
+    in_hmalloc--;
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size) {
+    void *new_ptr;
+
+    if (ptr == NULL)
+        return malloc(size);
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+
+    in_hmalloc++;
+    /* huge allocations are not in the arenas so they only shrink with hrealloc() */
+    if (to_hmalloc(size) || (ready && huge_lookup(ptr)))
+        new_ptr = hrealloc(ptr, size);
+    else if (unlikely((new_ptr = rallocx(ptr, size, 0)) == NULL))
+        errno = ENOMEM;
+    in_hmalloc--;
+    return new_ptr;
+}
+
+static void *aligned_malloc(size_t alignment, size_t size) {
+    void *ptr;
+
+    if (unlikely(alignment == 0 || !is_pow2(alignment))) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    in_hmalloc++;
+    if (to_hmalloc(size))
+        ptr = haligned_alloc(alignment, size);
+    else if (unlikely((ptr = mallocx(size ? size : 1, MALLOCX_ALIGN(alignment))) == NULL))
+        errno = ENOMEM;
+    in_hmalloc--;
+    return ptr;
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+    int old_errno = errno;
+    void *ptr;
+
+    if (unlikely(alignment < sizeof(void *) || !is_pow2(alignment)))
+        return EINVAL;
+
+    ptr = aligned_malloc(alignment, size);
+    if (unlikely(ptr == NULL)) {
+        int ret = errno;
+        errno = old_errno;
+        return ret;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    return aligned_malloc(alignment, size);
+}
+
+void *memalign(size_t alignment, size_t size) {
+    return aligned_malloc(alignment, size);
+}
+
+void *valloc(size_t size) {
+    return aligned_malloc(PAGE_SIZE, size);
+}
+
+void *pvalloc(size_t size) {
+    return aligned_malloc(PAGE_SIZE, (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1));
+}
+
+size_t malloc_usable_size(void *ptr) {
+    if (unlikely(ptr == NULL))
+        return 0;
+    if (unlikely(huge_lookup(ptr)))
+        return hmalloc_usable_size(ptr);
+    return sallocx(ptr, 0);
+}
+
+static inline bool to_hmmap(size_t length, int flags) {
+    return unlikely(mmap_threshold) && ready && !in_hmalloc && length >= mmap_threshold &&
+           (flags & MAP_ANONYMOUS) && !(flags & (MAP_FIXED | MAP_FIXED_NOREPLACE));
+}
+
+void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset) {
+    void *new_addr;
+
+    if (!to_hmmap(length, flags))
+        return (void *)syscall(SYS_mmap, addr, length, prot, flags, fd, offset);
+
+    in_hmalloc++;
+    new_addr = hmmap(addr, length, prot, flags, fd, offset);
+    in_hmalloc--;
+
+    /* hmmap() returns NULL if mbind() fails but mmap() callers only know MAP_FAILED */
+    return new_addr ? new_addr : MAP_FAILED;
+}
+
+void *mmap64(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
+    __attribute__((alias("mmap")));
+
+int munmap(void *addr, size_t length) {
+    int ret;
+
+    /* the interposed mappings are dropped from the stats of hmalloc */
+    if (likely(!mmap_threshold || !ready || in_hmalloc))
+        return syscall(SYS_munmap, addr, length);
+
+    in_hmalloc++;
+    ret = hmunmap(addr, length);
+    in_hmalloc--;
+    return ret;
+}
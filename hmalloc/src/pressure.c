@@ -0,0 +1,219 @@
+/* Copyright (c) 2026 SK hynix, Inc. */
+/* SPDX-License-Identifier: BSD 2-Clause */
+
+/*
+ * Fall back to the nodes of HMALLOC_FALLBACK, e.g. CXL memory, when a node
+ * of the memory policy runs short of free memory.  A watcher thread reads the
+ * free memory of each node from sysfs and marks the node under pressure below
+ * the low watermark until it recovers above the high watermark.  New extents
+ * and hmmap() mappings are bound without the nodes under pressure, so that
+ * they neither fail nor wait for the reclaim of the node.
+ */
+
+#include "env.h"
+#include "internal.h"
+
+#include <fcntl.h>
+#include <numa.h>
+#include <numaif.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* the default watermarks in percent of the memory of each node */
+#define PRESSURE_LOW_PERCENT 5
+#define PRESSURE_HIGH_PERCENT 10
+
+/* the default interval of the watcher in milliseconds */
+#define PRESSURE_INTERVAL 100
+
+/* the number of nodes in pressured_nodes, which keeps the check cheap without the pressure */
+atomic_int nr_pressured;
+atomic_ulong nr_fallbacks;
+nodes_t fallback_nodes;
+
+/* written by the watcher and read by the binders a word at a time */
+static nodes_t pressured_nodes;
+
+/* the nodes with memory that are watched, i.e. all the nodes but the fallback ones */
+static nodes_t watched_nodes;
+/* a negative watermark is a percentage of the memory of each node */
+static long low_watermark;
+static long high_watermark;
+static unsigned interval;
+
+/* serializes the updates of the watcher with pressure_init() */
+static pthread_mutex_t pressure_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool watcher_running;
+static bool atfork_registered;
+
+/* read MemTotal and MemFree of a node in bytes without allocating memory */
+static bool read_meminfo(int node, size_t *total, size_t *free) {
+    char path[64], buf[4096];
+    unsigned long kb;
+    ssize_t len;
+    char *line;
+    int fd;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/meminfo", node);
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0)
+        return false;
+    buf[len] = '\0';
+
+    *total = *free = 0;
+    /* "Node 0 MemTotal:       32768000 kB" */
+    for (line = buf; line; line = strchr(line, '\n'), line = line ? line + 1 : NULL) {
+        char name[32];
+
+        if (sscanf(line, "Node %*d %31[^:]: %lu kB", name, &kb) != 2)
+            continue;
+        if (!strcmp(name, "MemTotal"))
+            *total = kb << 10;
+        else if (!strcmp(name, "MemFree"))
+            *free = kb << 10;
+    }
+    return *total != 0;
+}
+
+static inline size_t watermark_bytes(long watermark, size_t total) {
+    if (watermark < 0)
+        return total / 100 * -watermark;
+    return watermark;
+}
+
+static void pressure_store(const nodes_t *nodemask) {
+    for (size_t i = 0; i < HMALLOC_NODEMASK_LONGS; i++)
+        __atomic_store_n(&pressured_nodes.bits[i], nodemask->bits[i], __ATOMIC_RELAXED);
+    atomic_store_explicit(&nr_pressured, nodes_weight(nodemask), memory_order_relaxed);
+}
+
+void pressure_nodes(nodes_t *nodemask) {
+    for (size_t i = 0; i < HMALLOC_NODEMASK_LONGS; i++)
+        nodemask->bits[i] = __atomic_load_n(&pressured_nodes.bits[i], __ATOMIC_RELAXED);
+}
+
+/* update pressured_nodes with the hysteresis between the low and high watermarks */
+static void pressure_update(void) {
+    nodes_t pressured;
+    int node;
+
+    pressure_nodes(&pressured);
+    for_each_node_mask(node, &watched_nodes) {
+        size_t total, free;
+
+        if (!read_meminfo(node, &total, &free))
+            continue;
+
+        if (free < watermark_bytes(low_watermark, total))
+            nodes_set(&pressured, node);
+        else if (free > watermark_bytes(high_watermark, total))
+            nodes_clear(&pressured, node);
+    }
+    pressure_store(&pressured);
+}
+
+static void *pressure_watcher(void *arg __unused) {
+    for (;;) {
+        struct timespec ts = {interval / 1000, interval % 1000 * 1000000L};
+
+        pthread_mutex_lock(&pressure_lock);
+        pressure_update();
+        pthread_mutex_unlock(&pressure_lock);
+        nanosleep(&ts, NULL);
+    }
+    return NULL;
+}
+
+/* the watcher does not exist in the child, so it stops falling back */
+static void pressure_atfork_child(void) {
+    nodes_t none;
+
+    nodes_zero(&none);
+    pthread_mutex_init(&pressure_lock, NULL);
+    watcher_running = false;
+    pressure_store(&none);
+}
+
+static void watcher_start(void) {
+    pthread_attr_t attr;
+    pthread_t thread;
+
+    if (!atfork_registered) {
+        pthread_atfork(NULL, NULL, pressure_atfork_child);
+        atfork_registered = true;
+    }
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, pressure_watcher, NULL) == 0) {
+        pthread_setname_np(thread, "hmwatch");
+        watcher_running = true;
+    }
+    pthread_attr_destroy(&attr);
+}
+
+/* read HMALLOC_FALLBACK and its options and start the watcher if needed */
+void pressure_init(void) {
+    nodes_t none;
+    int max_node;
+
+    pthread_mutex_lock(&pressure_lock);
+    getenv_fallback(&fallback_nodes);
+    nodes_zero(&none);
+    pressure_store(&none);
+    nodes_zero(&watched_nodes);
+    if (nodes_empty(&fallback_nodes))
+        goto out;
+
+    if (!getenv_fallback_watermark(&low_watermark, &high_watermark)) {
+        low_watermark = -PRESSURE_LOW_PERCENT;
+        high_watermark = -PRESSURE_HIGH_PERCENT;
+    }
+    interval = getenv_fallback_interval();
+    if (interval == 0)
+        interval = PRESSURE_INTERVAL;
+
+    max_node = numa_max_node();
+    for (int node = 0; node <= max_node && node < HMALLOC_MAX_NODES; node++) {
+        if (numa_bitmask_isbitset(numa_nodes_ptr, node) &&
+            !nodes_isset(&fallback_nodes, node))
+            nodes_set(&watched_nodes, node);
+    }
+
+    /* the first state is ready before any extent is bound */
+    pressure_update();
+    if (!watcher_running)
+        watcher_start();
+out:
+    pthread_mutex_unlock(&pressure_lock);
+}
+
+/*
+ * Drop the nodes under pressure from the policy, or fall back to the fallback
+ * nodes if no node is left.  MPOL_PREFERRED takes a single node, which is the
+ * first fallback node.
+ */
+bool pressure_effective(int *mode, nodes_t *nodemask) {
+    nodes_t pressured, mask;
+
+    pressure_nodes(&pressured);
+    if (!nodes_intersects(nodemask, &pressured))
+        return false;
+
+    nodes_andnot(&mask, nodemask, &pressured);
+    if (nodes_empty(&mask))
+        mask = fallback_nodes;
+    if (*mode == MPOL_PREFERRED && !nodes_empty(&mask))
+        nodes_of(&mask, nodes_first(&mask));
+    *nodemask = mask;
+    return true;
+}
@@ -0,0 +1,162 @@
+/* Copyright (c) 2026 SK hynix, Inc. */
+/* SPDX-License-Identifier: BSD 2-Clause */
+
+/*
+ * Registry of the address ranges mapped by hmalloc.  It is updated from the
+ * extent hooks, which cannot call malloc(), so the sorted array of ranges is
+ * mapped directly with mmap() and grown with mremap().
+ */
+
+#include "internal.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+static struct map_range *ranges;
+static size_t nr_ranges;
+static size_t max_ranges;
+static pthread_mutex_t range_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool range_grow(void) {
+    size_t old_size = max_ranges * sizeof(*ranges);
+    size_t new_size = old_size ? old_size * 2 : 16 * PAGE_SIZE;
+    void *addr;
+
+    if (ranges)
+        addr = mremap(ranges, old_size, new_size, MREMAP_MAYMOVE);
+    else
+        addr = mmap(NULL, new_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (addr == MAP_FAILED)
+        return false;
+
+    ranges = addr;
+    max_ranges = new_size / sizeof(*ranges);
+    return true;
+}
+
+/* index of the first range that ends after addr, must be called with range_lock held */
+static size_t range_search(uintptr_t addr) {
+    size_t lo = 0, hi = nr_ranges;
+
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+
+        if (ranges[mid].end <= addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static void range_insert(size_t i, uintptr_t start, uintptr_t end, int kind) {
+    memmove(&ranges[i + 1], &ranges[i], (nr_ranges - i) * sizeof(*ranges));
+    ranges[i] = (struct map_range){start, end, kind};
+    nr_ranges++;
+}
+
+static void range_remove(size_t i) {
+    memmove(&ranges[i], &ranges[i + 1], (nr_ranges - i - 1) * sizeof(*ranges));
+    nr_ranges--;
+}
+
+bool range_register(void *addr, size_t size, int kind) {
+    uintptr_t start = (uintptr_t)addr, end = start + size;
+    bool ret = true;
+    size_t i;
+
+    pthread_mutex_lock(&range_lock);
+    i = range_search(start);
+
+    /* merge with the adjacent ranges of the same kind to keep the array small */
+    if (i > 0 && ranges[i - 1].end == start && ranges[i - 1].kind == kind) {
+        ranges[i - 1].end = end;
+        if (i < nr_ranges && ranges[i].start == end && ranges[i].kind == kind) {
+            ranges[i - 1].end = ranges[i].end;
+            range_remove(i);
+        }
+    } else if (i < nr_ranges && ranges[i].start == end && ranges[i].kind == kind) {
+        ranges[i].start = start;
+    } else if (nr_ranges < max_ranges || range_grow()) {
+        range_insert(i, start, end, kind);
+    } else {
+        ret = false;
+    }
+    pthread_mutex_unlock(&range_lock);
+    return ret;
+}
+
+/* drop [addr, addr + size) and return the kind of the range it was in, or -1 */
+int range_unregister(void *addr, size_t size) {
+    uintptr_t start = (uintptr_t)addr, end = start + size;
+    int kind = -1;
+    size_t i;
+
+    pthread_mutex_lock(&range_lock);
+    for (i = range_search(start); i < nr_ranges && ranges[i].start < end;) {
+        struct map_range *range = &ranges[i];
+
+        if (kind < 0)
+            kind = range->kind;
+
+        if (range->start < start && range->end > end) {
+            /* punch a hole, the tail is lost if the array cannot grow */
+            if (nr_ranges < max_ranges || range_grow()) {
+                range_insert(i + 1, end, ranges[i].end, ranges[i].kind);
+                ranges[i].end = start;
+            } else {
+                ranges[i].end = start;
+            }
+            break;
+        } else if (range->start < start) {
+            range->end = start;
+            i++;
+        } else if (range->end > end) {
+            range->start = end;
+            break;
+        } else {
+            range_remove(i);
+        }
+    }
+    pthread_mutex_unlock(&range_lock);
+    return kind;
+}
+
+/* return the kind of the range containing addr, or -1 if it is not mapped by hmalloc */
+int range_lookup(void *addr) {
+    uintptr_t start = (uintptr_t)addr;
+    int kind = -1;
+    size_t i;
+
+    pthread_mutex_lock(&range_lock);
+    i = range_search(start);
+    if (i < nr_ranges && ranges[i].start <= start)
+        kind = ranges[i].kind;
+    pthread_mutex_unlock(&range_lock);
+    return kind;
+}
+
+/* copy all the ranges to a buffer that the caller should free() */
+size_t range_snapshot(struct map_range **snapshot) {
+    size_t n = 0;
+
+    /* allocate out of the lock as malloc() may end up in the extent hooks */
+    for (;;) {
+        *snapshot = malloc((n ? n : 1) * sizeof(**snapshot));
+        if (*snapshot == NULL)
+            return 0;
+
+        pthread_mutex_lock(&range_lock);
+        if (nr_ranges <= n) {
+            n = nr_ranges;
+            memcpy(*snapshot, ranges, n * sizeof(**snapshot));
+            pthread_mutex_unlock(&range_lock);
+            return n;
+        }
+        n = nr_ranges;
+        pthread_mutex_unlock(&range_lock);
+        free(*snapshot);
+    }
+}
@@ -0,0 +1,190 @@
+/* Copyright (c) 2026 SK hynix, Inc. */
+/* SPDX-License-Identifier: BSD 2-Clause */
+
+/*
+ * Region allocators of hmarena that bump-allocate from chunks mapped by
+ * hmmap() and free everything at once.  The chunks are kept mapped and bound
+ * on reset and reused in order, so a region that is reset per request pays
+ * for mmap() and mbind() only while it grows.
+ */
+
+#include "env.h"
+#include "hmalloc.h"
+#include "internal.h"
+
+#include <errno.h>
+#include <stdalign.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#ifndef MADV_FREE
+#define MADV_FREE 8
+#endif
+
+#define REGION_CHUNK_SIZE (2UL << 20)
+
+/* the header at the start of each chunk */
+struct region_chunk {
+    struct region_chunk *next;
+    size_t size;
+};
+
+struct hmarena {
+    hmalloc_policy_t *policy;
+    size_t chunk_size;
+    int map_flags;
+    /* all the chunks, the ones after current are free */
+    struct region_chunk *chunks;
+    struct region_chunk *current;
+    uintptr_t ptr;
+    uintptr_t end;
+};
+
+static struct region_chunk *chunk_create(struct hmarena *arena, size_t size) {
+    struct region_chunk *chunk;
+
+    chunk = hmmap_p(arena->policy, NULL, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | arena->map_flags, -1, 0);
+    if (chunk == MAP_FAILED || chunk == NULL)
+        return NULL;
+    chunk->next = NULL;
+    chunk->size = size;
+    return chunk;
+}
+
+static void chunk_use(struct hmarena *arena, struct region_chunk *chunk) {
+    arena->current = chunk;
+    arena->ptr = (uintptr_t)(chunk + 1);
+    arena->end = (uintptr_t)chunk + chunk->size;
+}
+
+hmarena_t *hmarena_create(hmalloc_policy_t *policy, size_t chunk_size) {
+    struct hmarena *arena;
+
+    if (chunk_size == 0)
+        chunk_size = REGION_CHUNK_SIZE;
+    if (chunk_size > SIZE_MAX - PAGE_SIZE) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    arena = calloc(1, sizeof(*arena));
+    if (arena == NULL)
+        return NULL;
+    arena->policy = policy;
+    arena->chunk_size = (chunk_size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    if (hugepage_mode() != HUGEPAGE_NONE)
+        arena->map_flags = HMAP_HUGEPAGE;
+    return arena;
+}
+
+void hmarena_destroy(hmarena_t *arena) {
+    struct region_chunk *chunk, *next;
+
+    if (arena == NULL)
+        return;
+    for (chunk = arena->chunks; chunk; chunk = next) {
+        next = chunk->next;
+        hmunmap(chunk, chunk->size);
+    }
+    free(arena);
+}
+
+/* move to the next free chunk if it fits, or map a new one after the current chunk */
+static void *region_alloc_slow(struct hmarena *arena, size_t alignment, size_t size) {
+    struct region_chunk *chunk = arena->current ? arena->current->next : arena->chunks;
+    size_t need = sizeof(*chunk) + alignment - 1 + size;
+
+    if (need < size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if (chunk == NULL || chunk->size < need) {
+        size_t chunk_size = arena->chunk_size;
+
+        if (chunk_size < need) {
+            chunk_size = (need + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+            if (chunk_size < need) {
+                errno = ENOMEM;
+                return NULL;
+            }
+        }
+        chunk = chunk_create(arena, chunk_size);
+        if (chunk == NULL) {
+            errno = ENOMEM;
+            return NULL;
+        }
+        if (arena->current) {
+            chunk->next = arena->current->next;
+            arena->current->next = chunk;
+        } else {
+            chunk->next = arena->chunks;
+            arena->chunks = chunk;
+        }
+    }
+
+    chunk_use(arena, chunk);
+    return hmarena_aligned_alloc(arena, alignment, size);
+}
+
+void *hmarena_aligned_alloc(hmarena_t *arena, size_t alignment, size_t size) {
+    uintptr_t ptr;
+
+    if (unlikely(arena == NULL || alignment == 0 || (alignment & (alignment - 1)))) {
+        errno = EINVAL;
+        return NULL;
+    }
+    /* every allocation gets a distinct address */
+    if (unlikely(size == 0))
+        size = 1;
+
+    ptr = (arena->ptr + alignment - 1) & ~(alignment - 1);
+    if (likely(ptr >= arena->ptr && ptr <= arena->end && size <= arena->end - ptr)) {
+        arena->ptr = ptr + size;
+        return (void *)ptr;
+    }
+    return region_alloc_slow(arena, alignment, size);
+}
+
+void *hmarena_alloc(hmarena_t *arena, size_t size) {
+    return hmarena_aligned_alloc(arena, alignof(max_align_t), size);
+}
+
+void hmarena_reset(hmarena_t *arena) {
+    if (arena && arena->chunks)
+        chunk_use(arena, arena->chunks);
+}
+
+int hmarena_trim(hmarena_t *arena, size_t keep) {
+    struct region_chunk *chunk;
+    size_t kept = 0;
+    int ret = 0;
+
+    if (arena == NULL)
+        return 0;
+    chunk = arena->current ? arena->current->next : arena->chunks;
+
+    /* the free chunks are kept mapped and bound, only their pages are released */
+    for (; chunk; chunk = chunk->next) {
+        int kind = range_lookup(chunk);
+        size_t len;
+
+        kept += chunk->size;
+        if (kept <= keep)
+            continue;
+        /* hugetlb pages cannot be released in part */
+        if (kind == HUGEPAGE_2M || kind == HUGEPAGE_1G)
+            continue;
+
+        /* keep the header page, which is written right away when the chunk is reused */
+        len = chunk->size - PAGE_SIZE;
+        if (len == 0)
+            continue;
+        /* MADV_FREE is only available since Linux 4.5 */
+        if (madvise((char *)chunk + PAGE_SIZE, len, MADV_FREE) &&
+            madvise((char *)chunk + PAGE_SIZE, len, MADV_DONTNEED))
+            ret = -1;
+    }
+    return ret;
+}
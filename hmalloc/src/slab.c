@@ -0,0 +1,539 @@
+/* Copyright (c) 2026 SK hynix, Inc. */
+/* SPDX-License-Identifier: BSD 2-Clause */
+
+/*
+ * The built-in allocator of the hmalloc pool, which is used instead of
+ * jemalloc with HMALLOC_BACKEND=slab or when hmalloc is built without jemalloc.
+ *
+ * Each policy has a heap of size classes, and each class carves its objects
+ * out of slabs, which are 2MB extents mapped and bound to the policy by
+ * extent_map() just like the extents of jemalloc.  A slab is aligned to its
+ * size and starts with its header, so that hfree() finds the slab and the
+ * policy of an object from its address alone.  Each thread caches a few
+ * objects per class and policy so that most allocations and deallocations
+ * take no lock.  Empty slabs drop their pages but keep their address space,
+ * which is still bound to the policy, for any class of the same heap.
+ * Allocations larger than SLAB_MAX_SIZE are the huge allocations of huge.c.
+ */
+
+#include "hmalloc.h"
+#include "internal.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define SLAB_SIZE (2UL << 20)
+
+/* the objects start after the header page so that they are aligned as their size class */
+#define SLAB_HEADER PAGE_SIZE
+
+/* 8 classes of 16 bytes up to 128 bytes, then 4 classes per power of two up to SLAB_MAX_SIZE */
+#define SLAB_NR_CLASSES 52
+
+/* objects cached per class by each thread, fewer for the larger classes */
+#define SLAB_CACHE_SIZE 32
+#define SLAB_CACHE_BYTES (64UL << 10)
+
+struct slab_bin {
+    pthread_mutex_t lock;
+    struct slab_heap *heap;
+    /* slabs with free objects, the head is allocated from first */
+    struct slab *partial;
+    /* objects out of the slabs including the ones cached by threads */
+    size_t nr_allocated;
+    size_t nr_slabs;
+    unsigned size;
+};
+
+struct slab_heap {
+    struct hmalloc_policy *policy;
+    pthread_mutex_t lock;
+    /* empty slabs without pages, linked by next */
+    struct slab *retained;
+    size_t nr_retained;
+    struct slab_bin bins[SLAB_NR_CLASSES];
+    /* all the heaps linked for fork() */
+    struct slab_heap *next;
+};
+
+/* the header at the start of each slab */
+struct slab {
+    struct slab_bin *bin;
+    struct slab *prev;
+    struct slab *next;
+    /* freed objects linked through their first word */
+    void *free;
+    /* the objects from bump to the end have never been allocated */
+    char *bump;
+    unsigned nr_free;
+    unsigned nr_objs;
+    /* copies from the bin and the policy for hfree() to reach the cache without them */
+    unsigned id;
+    unsigned index;
+    unsigned size;
+    unsigned cache_limit;
+};
+
+/* the objects cached by a thread for a policy */
+struct slab_cache {
+    unsigned nr[SLAB_NR_CLASSES];
+    void *objs[SLAB_NR_CLASSES][SLAB_CACHE_SIZE];
+};
+
+/* the caches of the current thread indexed by the policy id */
+static __tls struct slab_cache *slab_caches[HMALLOC_MAX_POLICIES];
+static pthread_key_t slab_key;
+static pthread_once_t slab_once = PTHREAD_ONCE_INIT;
+
+/* serializes the creation of the heaps and protects the list of them */
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct slab_heap *heaps;
+static bool atfork_registered;
+
+static inline unsigned slab_class(size_t size) {
+    unsigned lg;
+
+    if (size <= 128)
+        return size ? (size - 1) / 16 : 0;
+    /* sizes in (2^lg, 2^(lg+1)] are split into 4 classes of the same width */
+    lg = 63 - __builtin_clzl(size - 1);
+    return 8 + (lg - 7) * 4 + ((size - 1) >> (lg - 2)) - 4;
+}
+
+static inline size_t class_size(unsigned index) {
+    unsigned lg;
+
+    if (index < 8)
+        return (index + 1) * 16;
+    lg = (index - 8) / 4 + 7;
+    return (1UL << lg) + ((size_t)((index - 8) % 4 + 1) << (lg - 2));
+}
+
+static inline unsigned cache_limit(size_t size) {
+    size_t limit = SLAB_CACHE_BYTES / size;
+
+    return limit < SLAB_CACHE_SIZE ? limit : SLAB_CACHE_SIZE;
+}
+
+static inline struct slab *slab_of(void *ptr) {
+    return (struct slab *)((uintptr_t)ptr & ~(SLAB_SIZE - 1));
+}
+
+size_t slab_class_size(size_t size) {
+    return class_size(slab_class(size));
+}
+
+size_t slab_usable_size(void *ptr) {
+    return slab_of(ptr)->size;
+}
+
+/*
+ * Take all the locks of the slabs before fork() so that the child does not
+ * inherit a lock held by another thread, which does not exist in the child.
+ * The bin locks are taken before the heap lock as slab_create() does.
+ */
+static void slab_atfork_prepare(void) {
+    pthread_mutex_lock(&heap_lock);
+    for (struct slab_heap *heap = heaps; heap; heap = heap->next) {
+        for (unsigned i = 0; i < SLAB_NR_CLASSES; i++)
+            pthread_mutex_lock(&heap->bins[i].lock);
+        pthread_mutex_lock(&heap->lock);
+    }
+}
+
+static void slab_atfork_parent(void) {
+    for (struct slab_heap *heap = heaps; heap; heap = heap->next) {
+        pthread_mutex_unlock(&heap->lock);
+        for (unsigned i = 0; i < SLAB_NR_CLASSES; i++)
+            pthread_mutex_unlock(&heap->bins[i].lock);
+    }
+    pthread_mutex_unlock(&heap_lock);
+}
+
+static void slab_atfork_child(void) {
+    for (struct slab_heap *heap = heaps; heap; heap = heap->next) {
+        pthread_mutex_init(&heap->lock, NULL);
+        for (unsigned i = 0; i < SLAB_NR_CLASSES; i++)
+            pthread_mutex_init(&heap->bins[i].lock, NULL);
+    }
+    pthread_mutex_init(&heap_lock, NULL);
+}
+
+static struct slab_heap *heap_create(struct hmalloc_policy *policy) {
+    struct slab_heap *heap;
+
+    pthread_mutex_lock(&heap_lock);
+    heap = atomic_load(&policy->heap);
+    if (heap)
+        goto out;
+
+    if (!atfork_registered) {
+        pthread_atfork(slab_atfork_prepare, slab_atfork_parent, slab_atfork_child);
+        atfork_registered = true;
+    }
+
+    /* mapped directly as malloc() may be interposed by hmalloc itself */
+    heap = mmap(NULL, sizeof(*heap), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (heap == MAP_FAILED) {
+        heap = NULL;
+        goto out;
+    }
+    heap->policy = policy;
+    pthread_mutex_init(&heap->lock, NULL);
+    for (unsigned i = 0; i < SLAB_NR_CLASSES; i++) {
+        pthread_mutex_init(&heap->bins[i].lock, NULL);
+        heap->bins[i].heap = heap;
+        heap->bins[i].size = class_size(i);
+    }
+    heap->next = heaps;
+    heaps = heap;
+    atomic_store_explicit(&policy->heap, heap, memory_order_release);
+out:
+    pthread_mutex_unlock(&heap_lock);
+    return heap;
+}
+
+static inline struct slab_heap *slab_heap(struct hmalloc_policy *policy) {
+    struct slab_heap *heap = atomic_load_explicit(&policy->heap, memory_order_acquire);
+
+    if (likely(heap))
+        return heap;
+    return heap_create(policy);
+}
+
+static inline void slab_push(struct slab_bin *bin, struct slab *slab) {
+    slab->prev = NULL;
+    slab->next = bin->partial;
+    if (bin->partial)
+        bin->partial->prev = slab;
+    bin->partial = slab;
+}
+
+static inline void slab_remove(struct slab_bin *bin, struct slab *slab) {
+    if (slab->prev)
+        slab->prev->next = slab->next;
+    else
+        bin->partial = slab->next;
+    if (slab->next)
+        slab->next->prev = slab->prev;
+}
+
+/* reuse a retained slab or map a new one, must be called with the bin lock held */
+static struct slab *slab_create(struct slab_bin *bin) {
+    struct slab_heap *heap = bin->heap;
+    struct slab *slab;
+
+    pthread_mutex_lock(&heap->lock);
+    slab = heap->retained;
+    if (slab) {
+        heap->retained = slab->next;
+        heap->nr_retained--;
+    }
+    pthread_mutex_unlock(&heap->lock);
+
+    if (!slab) {
+        slab = extent_map(heap->policy, NULL, SLAB_SIZE, SLAB_SIZE);
+        if (unlikely(slab == NULL))
+            return NULL;
+    }
+
+    slab->bin = bin;
+    slab->free = NULL;
+    slab->bump = (char *)slab + SLAB_HEADER;
+    slab->nr_objs = (SLAB_SIZE - SLAB_HEADER) / bin->size;
+    slab->nr_free = slab->nr_objs;
+    slab->id = heap->policy->id;
+    slab->index = bin - heap->bins;
+    slab->size = bin->size;
+    slab->cache_limit = cache_limit(bin->size);
+    slab_push(bin, slab);
+    bin->nr_slabs++;
+    return slab;
+}
+
+/* drop the pages of an empty slab but keep it bound to the policy */
+static void slab_retain(struct slab_heap *heap, struct slab *slab) {
+    madvise((char *)slab + SLAB_HEADER, SLAB_SIZE - SLAB_HEADER, MADV_DONTNEED);
+
+    pthread_mutex_lock(&heap->lock);
+    slab->next = heap->retained;
+    heap->retained = slab;
+    heap->nr_retained++;
+    pthread_mutex_unlock(&heap->lock);
+}
+
+/* retain the slabs emptied under the bin lock after it is released */
+static void slab_retain_list(struct slab_heap *heap, struct slab *slab) {
+    while (slab) {
+        struct slab *next = slab->next;
+
+        slab_retain(heap, slab);
+        slab = next;
+    }
+}
+
+/* must be called with the bin lock held */
+static void *bin_take(struct slab_bin *bin) {
+    struct slab *slab = bin->partial;
+    void *obj;
+
+    if (!slab && !(slab = slab_create(bin)))
+        return NULL;
+
+    if (slab->free) {
+        obj = slab->free;
+        slab->free = *(void **)obj;
+    } else {
+        obj = slab->bump;
+        slab->bump += slab->size;
+    }
+    if (--slab->nr_free == 0)
+        slab_remove(bin, slab);
+    bin->nr_allocated++;
+    return obj;
+}
+
+/* must be called with the bin lock held, and return the slab if it is emptied and retired */
+static struct slab *bin_put(struct slab_bin *bin, void *obj) {
+    struct slab *slab = slab_of(obj);
+
+    *(void **)obj = slab->free;
+    slab->free = obj;
+    bin->nr_allocated--;
+    if (slab->nr_free++ == 0)
+        slab_push(bin, slab);
+
+    /* keep the last slab of the bin even if empty not to churn at the boundary */
+    if (slab->nr_free == slab->nr_objs && (slab->prev || slab->next)) {
+        slab_remove(bin, slab);
+        bin->nr_slabs--;
+        /* the slab is retired alone, not the partial slabs next to it */
+        slab->next = NULL;
+        return slab;
+    }
+    return NULL;
+}
+
+/* return objects to their slabs and chain the retired slabs to retired */
+static struct slab *bin_put_all(struct slab_bin *bin, void **objs, unsigned nr,
+                                struct slab *retired) {
+    for (unsigned i = 0; i < nr; i++) {
+        struct slab *slab = bin_put(bin, objs[i]);
+
+        if (slab) {
+            slab->next = retired;
+            retired = slab;
+        }
+    }
+    return retired;
+}
+
+/* flush all the caches of a thread back to their slabs at thread exit */
+static void cache_destroy(void *arg __unused) {
+    for (unsigned id = 0; id < HMALLOC_MAX_POLICIES; id++) {
+        struct slab_cache *cache = slab_caches[id];
+
+        if (!cache)
+            continue;
+        for (unsigned index = 0; index < SLAB_NR_CLASSES; index++) {
+            struct slab_bin *bin;
+            struct slab *retired;
+
+            if (!cache->nr[index])
+                continue;
+            bin = slab_of(cache->objs[index][0])->bin;
+            pthread_mutex_lock(&bin->lock);
+            retired = bin_put_all(bin, cache->objs[index], cache->nr[index], NULL);
+            pthread_mutex_unlock(&bin->lock);
+            slab_retain_list(bin->heap, retired);
+        }
+        slab_caches[id] = NULL;
+        munmap(cache, sizeof(*cache));
+    }
+}
+
+static void slab_key_init(void) {
+    int err __unused = pthread_key_create(&slab_key, cache_destroy);
+    assert(!err);
+}
+
+static struct slab_cache *cache_create(unsigned id) {
+    struct slab_cache *cache;
+
+    pthread_once(&slab_once, slab_key_init);
+    cache = mmap(NULL, sizeof(*cache), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (cache == MAP_FAILED)
+        return NULL;
+
+    /* the key destructor flushes the caches of this thread at thread exit */
+    slab_caches[id] = cache;
+    pthread_setspecific(slab_key, slab_caches);
+    return cache;
+}
+
+/* take an object from the bin and refill the cache of the current thread by half */
+static void *slab_alloc_slow(struct hmalloc_policy *policy, unsigned index,
+                             struct slab_cache *cache) {
+    struct slab_heap *heap = slab_heap(policy);
+    struct slab_bin *bin;
+    unsigned nr_fill = 0;
+    void *obj;
+
+    if (unlikely(heap == NULL))
+        return NULL;
+    bin = &heap->bins[index];
+
+    if (cache_limit(bin->size) && policy->id < HMALLOC_MAX_POLICIES) {
+        if (!cache)
+            cache = cache_create(policy->id);
+        if (cache)
+            nr_fill = cache_limit(bin->size) / 2;
+    }
+
+    pthread_mutex_lock(&bin->lock);
+    obj = bin_take(bin);
+    while (obj && cache && cache->nr[index] < nr_fill) {
+        void *next = bin_take(bin);
+
+        if (!next)
+            break;
+        cache->objs[index][cache->nr[index]++] = next;
+    }
+    pthread_mutex_unlock(&bin->lock);
+    return obj;
+}
+
+void *slab_alloc(struct hmalloc_policy *policy, size_t size) {
+    unsigned index = slab_class(size);
+    struct slab_cache *cache = NULL;
+
+    if (likely(policy->id < HMALLOC_MAX_POLICIES)) {
+        cache = slab_caches[policy->id];
+        if (likely(cache && cache->nr[index]))
+            return cache->objs[index][--cache->nr[index]];
+    }
+    return slab_alloc_slow(policy, index, cache);
+}
+
+/* free to the bin, or flush the older half of the full cache to make room for the object */
+static void slab_free_slow(struct slab *slab, void *ptr) {
+    struct slab_bin *bin = slab->bin;
+    struct slab_cache *cache = NULL;
+    unsigned index = slab->index;
+    struct slab *retired;
+    unsigned nr_flush;
+
+    if (slab->cache_limit && slab->id < HMALLOC_MAX_POLICIES) {
+        cache = slab_caches[slab->id];
+        if (!cache && (cache = cache_create(slab->id))) {
+            cache->objs[index][cache->nr[index]++] = ptr;
+            return;
+        }
+    }
+
+    pthread_mutex_lock(&bin->lock);
+    if (!cache) {
+        retired = bin_put(bin, ptr);
+        pthread_mutex_unlock(&bin->lock);
+        slab_retain_list(bin->heap, retired);
+        return;
+    }
+
+    nr_flush = (cache->nr[index] + 1) / 2;
+    retired = bin_put_all(bin, cache->objs[index], nr_flush, NULL);
+    pthread_mutex_unlock(&bin->lock);
+
+    cache->nr[index] -= nr_flush;
+    memmove(cache->objs[index], cache->objs[index] + nr_flush,
+            cache->nr[index] * sizeof(cache->objs[index][0]));
+    cache->objs[index][cache->nr[index]++] = ptr;
+    slab_retain_list(bin->heap, retired);
+}
+
+void slab_free(void *ptr) {
+    struct slab *slab = slab_of(ptr);
+
+    if (likely(slab->id < HMALLOC_MAX_POLICIES)) {
+        struct slab_cache *cache = slab_caches[slab->id];
+
+        if (likely(cache && cache->nr[slab->index] < slab->cache_limit)) {
+            cache->objs[slab->index][cache->nr[slab->index]++] = ptr;
+            return;
+        }
+    }
+    slab_free_slow(slab, ptr);
+}
+
+/* add the bytes of the slabs of a policy for hmalloc_stats() */
+void slab_stats(struct hmalloc_policy *policy, size_t *allocated, size_t *active,
+                size_t *retained) {
+    struct slab_heap *heap = atomic_load_explicit(&policy->heap, memory_order_acquire);
+
+    if (!heap)
+        return;
+    for (unsigned i = 0; i < SLAB_NR_CLASSES; i++) {
+        struct slab_bin *bin = &heap->bins[i];
+
+        pthread_mutex_lock(&bin->lock);
+        *allocated += bin->nr_allocated * bin->size;
+        *active += bin->nr_slabs * SLAB_SIZE;
+        pthread_mutex_unlock(&bin->lock);
+    }
+    pthread_mutex_lock(&heap->lock);
+    *retained += heap->nr_retained * SLAB_SIZE;
+    pthread_mutex_unlock(&heap->lock);
+}
+
+/*
+ * Unmap the empty and the retained slabs of a policy being destroyed after
+ * flushing the cache of the current thread.  The objects cached by the other
+ * threads keep their slabs until the policy is created again.
+ */
+void slab_release(struct hmalloc_policy *policy) {
+    struct slab_heap *heap = atomic_load_explicit(&policy->heap, memory_order_acquire);
+    struct slab_cache *cache = NULL;
+    struct slab *empty = NULL, *slab, *next;
+
+    if (!heap)
+        return;
+    if (policy->id < HMALLOC_MAX_POLICIES)
+        cache = slab_caches[policy->id];
+
+    for (unsigned index = 0; index < SLAB_NR_CLASSES; index++) {
+        struct slab_bin *bin = &heap->bins[index];
+
+        pthread_mutex_lock(&bin->lock);
+        if (cache) {
+            empty = bin_put_all(bin, cache->objs[index], cache->nr[index], empty);
+            cache->nr[index] = 0;
+        }
+        /* bin_put() keeps the last slab of a bin even if it is empty */
+        for (slab = bin->partial; slab; slab = next) {
+            next = slab->next;
+            if (slab->nr_free != slab->nr_objs)
+                continue;
+            slab_remove(bin, slab);
+            bin->nr_slabs--;
+            slab->next = empty;
+            empty = slab;
+        }
+        pthread_mutex_unlock(&bin->lock);
+    }
+
+    pthread_mutex_lock(&heap->lock);
+    for (slab = heap->retained; slab; slab = next) {
+        next = slab->next;
+        slab->next = empty;
+        empty = slab;
+    }
+    heap->retained = NULL;
+    heap->nr_retained = 0;
+    pthread_mutex_unlock(&heap->lock);
+
+    for (slab = empty; slab; slab = next) {
+        next = slab->next;
+        hmunmap(slab, SLAB_SIZE);
+    }
+}
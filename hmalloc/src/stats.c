@@ -0,0 +1,405 @@
+/* Copyright (c) 2026 SK hynix, Inc. */
+/* SPDX-License-Identifier: BSD 2-Clause */
+
+#include "env.h"
+#include "hmalloc.h"
+#include "internal.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <numaif.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+_Static_assert((int)HUGEPAGE_NR == (int)HMALLOC_PAGE_KINDS, "page kinds mismatch");
+
+const char *const page_kind_names[HMALLOC_PAGE_KINDS] = {"base", "thp", "2M", "1G"};
+
+atomic_ulong stat_events[NR_STAT_EVENTS];
+unsigned stats_sample;
+__tls unsigned stats_countdown;
+
+static atomic_ulong stat_latencies[NR_STAT_LATENCIES][HMALLOC_LATENCY_BUCKETS];
+
+uint64_t stats_clock(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void stats_latency(int type, uint64_t start) {
+    uint64_t ns = stats_clock() - start;
+    int bucket = ns ? 63 - __builtin_clzll(ns) : 0;
+
+    if (bucket >= HMALLOC_LATENCY_BUCKETS)
+        bucket = HMALLOC_LATENCY_BUCKETS - 1;
+    atomic_fetch_add_explicit(&stat_latencies[type][bucket], 1, memory_order_relaxed);
+}
+
+/* a vma of /proc/self/maps and the bytes of it that are mapped by hmalloc */
+struct vma {
+    uintptr_t start;
+    uintptr_t end;
+    size_t overlap;
+};
+
+static size_t overlap_bytes(const struct map_range *ranges, size_t nr_ranges, uintptr_t start,
+                            uintptr_t end) {
+    size_t lo = 0, hi = nr_ranges, bytes = 0;
+
+    /* find the first range that ends after start */
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+
+        if (ranges[mid].end <= start)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    for (size_t i = lo; i < nr_ranges && ranges[i].start < end; i++) {
+        uintptr_t s = ranges[i].start > start ? ranges[i].start : start;
+        uintptr_t e = ranges[i].end < end ? ranges[i].end : end;
+
+        bytes += e - s;
+    }
+    return bytes;
+}
+
+/* collect the vmas that overlap with the ranges of hmalloc */
+static size_t read_vmas(const struct map_range *ranges, size_t nr_ranges, struct vma **vmas) {
+    size_t nr_vmas = 0, max_vmas = 0;
+    char *line = NULL;
+    size_t len = 0;
+    FILE *fp;
+
+    *vmas = NULL;
+    fp = fopen("/proc/self/maps", "r");
+    if (!fp)
+        return 0;
+
+    while (getline(&line, &len, fp) > 0) {
+        uintptr_t start, end;
+        size_t overlap;
+
+        if (sscanf(line, "%" SCNxPTR "-%" SCNxPTR, &start, &end) != 2)
+            continue;
+        overlap = overlap_bytes(ranges, nr_ranges, start, end);
+        if (overlap == 0)
+            continue;
+
+        if (nr_vmas == max_vmas) {
+            size_t new_max = max_vmas ? max_vmas * 2 : 64;
+            struct vma *new_vmas = realloc(*vmas, new_max * sizeof(**vmas));
+
+            if (!new_vmas)
+                break;
+            *vmas = new_vmas;
+            max_vmas = new_max;
+        }
+        (*vmas)[nr_vmas++] = (struct vma){start, end, overlap};
+    }
+
+    free(line);
+    fclose(fp);
+    return nr_vmas;
+}
+
+static struct vma *find_vma(struct vma *vmas, size_t nr_vmas, uintptr_t start) {
+    size_t lo = 0, hi = nr_vmas;
+
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+
+        if (vmas[mid].start < start)
+            lo = mid + 1;
+        else if (vmas[mid].start > start)
+            hi = mid;
+        else
+            return &vmas[mid];
+    }
+    return NULL;
+}
+
+/*
+ * Count the resident pages per node from /proc/self/numa_maps.  A vma that is
+ * partially mapped by hmalloc, e.g. merged with a neighboring mapping of the
+ * same memory policy, is counted in proportion to the overlapping bytes.
+ */
+static void read_resident(struct hmalloc_stats *stats) {
+    struct map_range *ranges;
+    size_t nr_ranges, nr_vmas;
+    struct vma *vmas = NULL;
+    char *line = NULL;
+    size_t len = 0;
+    FILE *fp;
+
+    nr_ranges = range_snapshot(&ranges);
+    nr_vmas = read_vmas(ranges, nr_ranges, &vmas);
+    if (nr_vmas == 0)
+        goto out;
+
+    fp = fopen("/proc/self/numa_maps", "r");
+    if (!fp)
+        goto out;
+
+    while (getline(&line, &len, fp) > 0) {
+        unsigned long pages[64];
+        unsigned nodes[64];
+        unsigned long page_kb = 4;
+        unsigned nr_nodes = 0;
+        uintptr_t start;
+        struct vma *vma;
+        char *tok, *saveptr;
+
+        if (sscanf(line, "%" SCNxPTR, &start) != 1)
+            continue;
+        vma = find_vma(vmas, nr_vmas, start);
+        if (!vma)
+            continue;
+
+        for (tok = strtok_r(line, " \n", &saveptr); tok; tok = strtok_r(NULL, " \n", &saveptr)) {
+            unsigned node;
+            unsigned long n;
+
+            if (sscanf(tok, "N%u=%lu", &node, &n) == 2 && node < HMALLOC_MAX_NODES &&
+                nr_nodes < 64) {
+                nodes[nr_nodes] = node;
+                pages[nr_nodes++] = n;
+            } else {
+                sscanf(tok, "kernelpagesize_kB=%lu", &page_kb);
+            }
+        }
+
+        for (unsigned i = 0; i < nr_nodes; i++) {
+            double bytes = (double)pages[i] * page_kb * 1024;
+
+            stats->resident[nodes[i]] += bytes * vma->overlap / (vma->end - vma->start);
+        }
+    }
+
+    free(line);
+    fclose(fp);
+out:
+    free(vmas);
+    free(ranges);
+}
+
+#ifdef HAVE_JEMALLOC
+static size_t arena_stat(const char *fmt, unsigned arena) {
+    char name[64];
+    size_t value = 0, size = sizeof(value);
+
+    snprintf(name, sizeof(name), fmt, arena);
+    if (mallctl(name, &value, &size, NULL, 0))
+        return 0;
+    return value;
+}
+#endif
+
+/*
+ * Split the bytes allocated from the arenas or the slabs of each policy, and
+ * by its huge allocations, over the nodes of the policy.
+ */
+static void read_arenas(struct hmalloc_stats *stats) {
+#ifdef HAVE_JEMALLOC
+    size_t page = PAGE_SIZE, size = sizeof(page);
+    uint64_t epoch = 1;
+
+    /* jemalloc stats are only refreshed when the epoch is advanced */
+    if (!use_slab) {
+        mallctl("epoch", NULL, NULL, &epoch, sizeof(epoch));
+        mallctl("arenas.page", &page, &size, NULL, 0);
+    }
+#endif
+
+    for (struct hmalloc_policy *policy = atomic_load(&policy_list); policy;
+         policy = policy->next) {
+        const struct hmalloc_weights *weights;
+        nodes_t nodemask;
+        size_t allocated = huge_allocated(policy);
+        int mode, nr_nodes, node;
+
+        stats->active += allocated;
+        if (use_slab) {
+            size_t slab_allocated = 0, active = 0, retained = 0;
+
+            slab_stats(policy, &slab_allocated, &active, &retained);
+            allocated += slab_allocated;
+            stats->active += active;
+            stats->retained += retained;
+        }
+#ifdef HAVE_JEMALLOC
+        /* the arenas of a destroyed policy are gone and their indices may be reused */
+        if (!use_slab && __atomic_load_n(&policy->dead, __ATOMIC_ACQUIRE))
+            continue;
+        for (unsigned i = 0; !use_slab && i < policy->narenas; i++) {
+            unsigned arena = policy->arenas[i];
+
+            allocated += arena_stat("stats.arenas.%u.small.allocated", arena);
+            allocated += arena_stat("stats.arenas.%u.large.allocated", arena);
+            stats->active += arena_stat("stats.arenas.%u.pactive", arena) * page;
+            stats->dirty += arena_stat("stats.arenas.%u.pdirty", arena) * page;
+            stats->retained += arena_stat("stats.arenas.%u.retained", arena);
+        }
+#endif
+
+        /* the allocations are counted by the current policy of the arenas */
+        policy_load(policy, &mode, &nodemask, &weights);
+        nr_nodes = nodes_weight(&nodemask);
+        if (nr_nodes == 0) {
+            stats->allocated_default += allocated;
+            continue;
+        }
+        if (weights) {
+            for (unsigned i = 0; i < weights->nr_nodes; i++)
+                stats->allocated[weights->nodes[i]] +=
+                    allocated / weights->total * weights->weights[i];
+            continue;
+        }
+        /* a preferred node takes all the memory as long as it has free memory */
+        if (mode == MPOL_PREFERRED) {
+            stats->allocated[nodes_first(&nodemask)] += allocated;
+            continue;
+        }
+        for_each_node_mask(node, &nodemask)
+            stats->allocated[node] += allocated / nr_nodes;
+    }
+}
+
+static void read_pressure(struct hmalloc_stats *stats) {
+    struct hmalloc_policy *policy = atomic_load(&policy_list);
+    const struct hmalloc_weights *weights;
+    nodes_t nodemask;
+
+    /* the global policy is the last one */
+    while (policy->next)
+        policy = policy->next;
+
+    pressure_nodes(&nodemask);
+    memcpy(stats->pressured_nodes, nodemask.bits, sizeof(stats->pressured_nodes));
+    memcpy(stats->fallback_nodes, fallback_nodes.bits, sizeof(stats->fallback_nodes));
+    policy_load(policy, &stats->effective_mode, &nodemask, &weights);
+    if (!nodes_empty(&nodemask))
+        pressure_effective(&stats->effective_mode, &nodemask);
+    memcpy(stats->effective_nodemask, nodemask.bits, sizeof(stats->effective_nodemask));
+    stats->nr_fallbacks = atomic_load_explicit(&nr_fallbacks, memory_order_relaxed);
+    stats->nr_huge_copies = atomic_load_explicit(&nr_huge_copies, memory_order_relaxed);
+}
+
+int hmalloc_stats(struct hmalloc_stats *stats) {
+    struct map_range *ranges;
+    size_t nr_ranges;
+
+    if (stats == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    memset(stats, 0, sizeof(*stats));
+
+    nr_ranges = range_snapshot(&ranges);
+    for (size_t i = 0; i < nr_ranges; i++)
+        stats->mapped[ranges[i].kind] += ranges[i].end - ranges[i].start;
+    free(ranges);
+
+    read_resident(stats);
+    read_arenas(stats);
+
+    stats->nr_mmap = atomic_load_explicit(&stat_events[STAT_MMAP], memory_order_relaxed);
+    stats->nr_mmap_failed =
+        atomic_load_explicit(&stat_events[STAT_MMAP_FAILED], memory_order_relaxed);
+    stats->nr_mbind = atomic_load_explicit(&stat_events[STAT_MBIND], memory_order_relaxed);
+    stats->nr_mbind_failed =
+        atomic_load_explicit(&stat_events[STAT_MBIND_FAILED], memory_order_relaxed);
+    stats->nr_munmap = atomic_load_explicit(&stat_events[STAT_MUNMAP], memory_order_relaxed);
+    stats->nr_munmap_failed =
+        atomic_load_explicit(&stat_events[STAT_MUNMAP_FAILED], memory_order_relaxed);
+    stats->nr_mremap = atomic_load_explicit(&stat_events[STAT_MREMAP], memory_order_relaxed);
+    stats->nr_mremap_failed =
+        atomic_load_explicit(&stat_events[STAT_MREMAP_FAILED], memory_order_relaxed);
+
+    for (int i = 0; i < HMALLOC_LATENCY_BUCKETS; i++) {
+        stats->malloc_latency[i] = atomic_load_explicit(
+            &stat_latencies[STAT_LATENCY_MALLOC][i], memory_order_relaxed);
+        stats->free_latency[i] =
+            atomic_load_explicit(&stat_latencies[STAT_LATENCY_FREE][i], memory_order_relaxed);
+    }
+
+    read_pressure(stats);
+    return 0;
+}
+
+static void print_latency(FILE *fp, const char *name, const unsigned long *latency) {
+    fprintf(fp, "  %s latency (sampled):\n", name);
+    for (int i = 0; i < HMALLOC_LATENCY_BUCKETS; i++) {
+        if (latency[i])
+            fprintf(fp, "    %12lu - %12lu ns: %lu\n", 1UL << i, (2UL << i) - 1, latency[i]);
+    }
+}
+
+/* print a nodemask of the stats as a node list such as "0,2-3", or "-" if empty */
+static void print_nodes(FILE *fp, const unsigned long *bits) {
+    char buf[HMALLOC_MAX_NODES * 4];
+    nodes_t nodemask;
+
+    memcpy(nodemask.bits, bits, sizeof(nodemask.bits));
+    if (nodes_empty(&nodemask) || !format_nodes(&nodemask, buf, sizeof(buf)))
+        strcpy(buf, "-");
+    fputs(buf, fp);
+}
+
+/* dump the stats to stderr at exit if HMALLOC_STATS_PRINT=1 */
+void stats_print(void) {
+    struct hmalloc_stats *stats = malloc(sizeof(*stats));
+    FILE *fp = stderr;
+    nodes_t fallback;
+
+    if (!stats || hmalloc_stats(stats)) {
+        free(stats);
+        return;
+    }
+
+    fprintf(fp, "hmalloc stats:\n");
+    fprintf(fp, "  %4s %16s %16s\n", "node", "resident(KiB)", "allocated(KiB)");
+    for (int node = 0; node < HMALLOC_MAX_NODES; node++) {
+        if (stats->resident[node] || stats->allocated[node])
+            fprintf(fp, "  %4d %16zu %16zu\n", node, stats->resident[node] >> 10,
+                    stats->allocated[node] >> 10);
+    }
+    if (stats->allocated_default)
+        fprintf(fp, "  %4s %16s %16zu\n", "-", "-", stats->allocated_default >> 10);
+
+    fprintf(fp, "  mapped(KiB):");
+    for (int i = 0; i < HMALLOC_PAGE_KINDS; i++)
+        fprintf(fp, " %s %zu", page_kind_names[i], stats->mapped[i] >> 10);
+    fprintf(fp, "\n");
+
+    fprintf(fp,
+            "  syscalls: mmap %lu (failed %lu), mbind %lu (failed %lu), "
+            "munmap %lu (failed %lu), mremap %lu (failed %lu, copied %lu)\n",
+            stats->nr_mmap, stats->nr_mmap_failed, stats->nr_mbind, stats->nr_mbind_failed,
+            stats->nr_munmap, stats->nr_munmap_failed, stats->nr_mremap, stats->nr_mremap_failed,
+            stats->nr_huge_copies);
+    fprintf(fp, "  arenas(KiB): active %zu, dirty %zu, retained %zu\n", stats->active >> 10,
+            stats->dirty >> 10, stats->retained >> 10);
+
+    memcpy(fallback.bits, stats->fallback_nodes, sizeof(fallback.bits));
+    if (!nodes_empty(&fallback)) {
+        fprintf(fp, "  pressure: nodes ");
+        print_nodes(fp, stats->pressured_nodes);
+        fprintf(fp, ", fallback ");
+        print_nodes(fp, stats->fallback_nodes);
+        fprintf(fp, ", effective nodes ");
+        print_nodes(fp, stats->effective_nodemask);
+        fprintf(fp, ", fallbacks %lu\n", stats->nr_fallbacks);
+    }
+
+    if (stats_sample) {
+        print_latency(fp, "hmalloc", stats->malloc_latency);
+        print_latency(fp, "hfree", stats->free_latency);
+    }
+    free(stats);
+}
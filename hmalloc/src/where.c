@@ -0,0 +1,140 @@
+/* Copyright (c) 2026 SK hynix, Inc. */
+/* SPDX-License-Identifier: BSD 2-Clause */
+
+/*
+ * Placement queries that read the node of each page with move_pages() and no
+ * target nodes, so that the callers can check where the memory actually is
+ * rather than what memory policy was asked for.
+ */
+
+#include "hmalloc.h"
+#include "internal.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <numa.h>
+#include <numaif.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* the number of pages passed to a move_pages() call */
+#define WHERE_BATCH 512
+
+/* ranges larger than this number of pages are sampled */
+#define WHERE_MAX_SAMPLES 4096
+
+/*
+ * Add the bytes of nr_pages pages from start to the counts of their nodes and
+ * return the resident bytes.  Only one page out of step pages is queried and
+ * it stands for all of them.
+ */
+static ssize_t where_pages(uintptr_t start, size_t nr_pages, size_t step, size_t page_size,
+                           size_t *counts, size_t nr_nodes) {
+    void *pages[WHERE_BATCH];
+    size_t bytes[WHERE_BATCH];
+    int status[WHERE_BATCH];
+    ssize_t resident = 0;
+    unsigned n = 0;
+
+    for (size_t i = 0; i < nr_pages; i += step) {
+        pages[n] = (void *)(start + i * page_size);
+        bytes[n] = (nr_pages - i < step ? nr_pages - i : step) * page_size;
+        if (++n < WHERE_BATCH && i + step < nr_pages)
+            continue;
+
+        if (move_pages(0, n, pages, NULL, status, 0) < 0)
+            return -1;
+
+        for (unsigned k = 0; k < n; k++) {
+            /* -ENOENT for the pages not faulted in yet */
+            if (status[k] < 0)
+                continue;
+            resident += bytes[k];
+            if ((size_t)status[k] < nr_nodes)
+                counts[status[k]] += bytes[k];
+        }
+        n = 0;
+    }
+    return resident;
+}
+
+static ssize_t where_range(uintptr_t start, uintptr_t end, size_t *counts, size_t nr_nodes) {
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t nr_pages, step = 1;
+
+    start &= ~(page_size - 1);
+    nr_pages = (end - start + page_size - 1) / page_size;
+    if (nr_pages > WHERE_MAX_SAMPLES)
+        step = (nr_pages + WHERE_MAX_SAMPLES - 1) / WHERE_MAX_SAMPLES;
+    return where_pages(start, nr_pages, step, page_size, counts, nr_nodes);
+}
+
+ssize_t hmalloc_where(const void *ptr, size_t length, size_t *counts, size_t nr_nodes) {
+    if (ptr == NULL || (counts == NULL && nr_nodes)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (length == 0)
+        length = hmalloc_usable_size((void *)ptr);
+
+    if (nr_nodes)
+        memset(counts, 0, nr_nodes * sizeof(*counts));
+    if (length == 0)
+        return 0;
+    return where_range((uintptr_t)ptr, (uintptr_t)ptr + length, counts, nr_nodes);
+}
+
+int hmalloc_placement_report(FILE *fp, size_t *counts, size_t nr_nodes) {
+    size_t nr_report = numa_max_node() + 1;
+    size_t *range_counts = NULL;
+    struct map_range *ranges;
+    size_t nr_ranges, total = 0;
+    int ret = -1;
+
+    if (counts == NULL && nr_nodes) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (nr_nodes)
+        memset(counts, 0, nr_nodes * sizeof(*counts));
+    if (nr_report < nr_nodes)
+        nr_report = nr_nodes;
+
+    nr_ranges = range_snapshot(&ranges);
+    range_counts = malloc(nr_report * sizeof(*range_counts));
+    if (!range_counts)
+        goto out;
+
+    for (size_t i = 0; i < nr_ranges; i++) {
+        ssize_t resident;
+
+        memset(range_counts, 0, nr_report * sizeof(*range_counts));
+        resident = where_range(ranges[i].start, ranges[i].end, range_counts, nr_report);
+        if (resident < 0)
+            goto out;
+        total += resident;
+
+        for (size_t node = 0; node < nr_nodes; node++)
+            counts[node] += range_counts[node];
+        if (!fp)
+            continue;
+
+        fprintf(fp, "%" PRIxPTR "-%" PRIxPTR " %s resident=%zu", ranges[i].start, ranges[i].end,
+                page_kind_names[ranges[i].kind], (size_t)resident);
+        for (size_t node = 0; node < nr_report; node++) {
+            if (range_counts[node])
+                fprintf(fp, " N%zu=%zu", node, range_counts[node]);
+        }
+        fprintf(fp, "\n");
+    }
+    if (fp)
+        fprintf(fp, "total resident=%zu in %zu ranges\n", total, nr_ranges);
+    ret = 0;
+
+out:
+    free(range_counts);
+    free(ranges);
+    return ret;
+}
@@ -0,0 +1,152 @@
+/* Copyright (c) 2026 SK hynix, Inc. */
+/* SPDX-License-Identifier: BSD 2-Clause */
+
+#include "catch.hpp"
+
+#include <hmalloc.hpp>
+#include <memory_resource>
+#include <numa.h>
+#include <numaif.h>
+#include <string>
+#include <strings.h>
+#include <unordered_map>
+#include <vector>
+
+static int allowed_node() {
+    struct bitmask *mask = numa_get_mems_allowed();
+    int node = ffs(*mask->maskp) - 1;
+
+    numa_free_nodemask(mask);
+    return node;
+}
+
+static int node_of(void *addr) {
+    int node = -1;
+
+    if (get_mempolicy(&node, nullptr, 0, addr, MPOL_F_NODE | MPOL_F_ADDR))
+        return -1;
+    return node;
+}
+
+TEST_CASE("hmsdk::allocator") {
+    SECTION("std::vector") {
+        std::vector<int, hmsdk::allocator<int>> v;
+
+        for (int i = 0; i < 100000; i++)
+            v.push_back(i);
+        CHECK(v.size() == 100000);
+        CHECK(v[99999] == 99999);
+        CHECK(hmalloc_usable_size(v.data()) >= v.capacity() * sizeof(int));
+
+        v.clear();
+        v.shrink_to_fit();
+        CHECK(v.capacity() == 0);
+    }
+
+    SECTION("std::unordered_map") {
+        using alloc = hmsdk::allocator<std::pair<const int, std::string>>;
+        std::unordered_map<int, std::string, std::hash<int>, std::equal_to<int>, alloc> m;
+
+        for (int i = 0; i < 10000; i++)
+            m.emplace(i, std::to_string(i));
+        CHECK(m.size() == 10000);
+        CHECK(m.at(1234) == "1234");
+
+        for (int i = 0; i < 10000; i += 2)
+            m.erase(i);
+        CHECK(m.size() == 5000);
+    }
+
+    SECTION("over-aligned type") {
+        struct alignas(256) block {
+            char data[256];
+        };
+        std::vector<block, hmsdk::allocator<block>> v(16);
+
+        CHECK(0 == reinterpret_cast<uintptr_t>(v.data()) % 256);
+    }
+
+    SECTION("bind policy") {
+        int node = allowed_node();
+        std::vector<char, hmsdk::allocator<char, hmsdk::bind_policy<0>>> v;
+
+        /* bind_policy takes the nodes at compile time so only node 0 is tested */
+        if (node != 0)
+            return;
+        v.resize(4 << 20, 1);
+        CHECK(0 == node_of(v.data()));
+    }
+
+    SECTION("invalid policy") {
+        std::vector<char, hmsdk::allocator<char, hmsdk::bind_policy<HMALLOC_MAX_NODES>>> v;
+
+        /* the allocation is not placed by the default policy instead */
+        CHECK_THROWS_AS(v.resize(64), std::bad_alloc);
+        CHECK_THROWS_AS(hmsdk::bind_policy<-1>::get(), std::bad_alloc);
+    }
+
+    SECTION("rebind and equality") {
+        hmsdk::allocator<int> a;
+        hmsdk::allocator<long> b(a);
+
+        CHECK(a == b);
+        CHECK_FALSE(a != b);
+    }
+
+    SECTION("overflow") {
+        hmsdk::allocator<long> a;
+
+        CHECK_THROWS_AS(a.allocate(std::numeric_limits<std::size_t>::max() / 2),
+                        std::bad_array_new_length);
+    }
+}
+
+TEST_CASE("hmsdk::memory_resource") {
+    int node = allowed_node();
+    unsigned long nodemask = 1UL << node;
+    hmalloc_policy_t *policy = hmalloc_policy_create(MPOL_BIND, &nodemask, sizeof(nodemask) * 8);
+    REQUIRE(policy);
+
+    hmsdk::memory_resource res(policy);
+    hmsdk::memory_resource other;
+
+    SECTION("std::pmr containers") {
+        std::pmr::vector<int> v(&res);
+        std::pmr::unordered_map<int, int> m(&res);
+
+        v.resize(1 << 20, 1);
+        CHECK(node == node_of(v.data()));
+        for (int i = 0; i < 10000; i++)
+            m[i] = i;
+        CHECK(m.size() == 10000);
+    }
+
+    SECTION("monotonic_buffer_resource") {
+        std::pmr::monotonic_buffer_resource mono(4096, &res);
+        std::pmr::vector<std::pmr::string> v(&mono);
+
+        for (int i = 0; i < 10000; i++)
+            v.emplace_back("a string that does not fit in the small string buffer");
+        CHECK(v.size() == 10000);
+        CHECK(node == node_of(&v.back()));
+    }
+
+    SECTION("alignment") {
+        void *ptr = res.allocate(1000, 4096);
+
+        CHECK(0 == reinterpret_cast<uintptr_t>(ptr) % 4096);
+        res.deallocate(ptr, 1000, 4096);
+
+        ptr = res.allocate(0);
+        CHECK(ptr);
+        res.deallocate(ptr, 0);
+    }
+
+    SECTION("equality") {
+        hmsdk::memory_resource same(policy);
+
+        CHECK(res.is_equal(same));
+        CHECK_FALSE(res.is_equal(other));
+        CHECK_FALSE(res.is_equal(*std::pmr::new_delete_resource()));
+    }
+}
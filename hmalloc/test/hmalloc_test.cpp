@@ -3,16 +3,28 @@
 
 #include "catch.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
 #include <cstdlib>
 #include <cstring>
 #include <fcntl.h>
 #include <hmalloc.h>
+#ifdef HAVE_JEMALLOC
 #include <jemalloc/jemalloc.h>
+#endif
+#include <mutex>
 #include <numa.h>
 #include <numaif.h>
+#include <string>
 #include <strings.h>
 #include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <sys/utsname.h>
+#include <sys/wait.h>
+#include <thread>
 #include <unistd.h>
 #include <vector>
 
@@ -27,20 +39,44 @@
 extern "C" {
 void update_env(void);
 void hmalloc_init(void);
+void conf_init(unsigned narenas);
+void pressure_init(void);
+void control_init(void);
+int migrate_lookup(void *ptr);
+extern void *conf_default;
+#ifdef HAVE_JEMALLOC
 void *extent_alloc(extent_hooks_t *extent_hooks, void *new_addr, size_t size, size_t alignment,
                    bool *zero, bool *commit, unsigned arena_ind);
+#else
+struct hmalloc_policy;
+void *extent_map(struct hmalloc_policy *policy, void *new_addr, size_t size, size_t alignment);
+#endif
+}
+
+#ifndef HAVE_JEMALLOC
+/* the slabs are mapped by the same function as the extent hook of jemalloc */
+static void *extent_alloc(void *, void *new_addr, size_t size, size_t alignment, bool *zero,
+                          bool *commit, unsigned) {
+    void *addr = extent_map(nullptr, new_addr, size, alignment);
+
+    if (addr && zero)
+        *zero = true;
+    if (addr && commit)
+        *commit = true;
+    return addr;
 }
+#endif
 
 static constexpr auto kb = 1024UL;
 static constexpr auto mb = 1024UL * kb;
 static constexpr auto gb = 1024UL * mb;
 
 __attribute__((constructor)) void init() {
-    char *env = getenv("HMALLOC_JEMALLOC");
-    if (!env || !strcmp(env, "1")) {
-        setenv("HMALLOC_JEMALLOC", "1", 1);
-        hmalloc_init();
-    }
+#ifdef HAVE_JEMALLOC
+    /* run the tests on jemalloc unless HMALLOC_JEMALLOC=0 selects the built-in allocator */
+    setenv("HMALLOC_JEMALLOC", "1", 0);
+#endif
+    hmalloc_init();
 }
 
 static void hmalloc_test(const std::vector<size_t> &sizes) {
@@ -62,12 +98,13 @@ static void hmalloc_test(const std::vector<size_t> &sizes) {
 }
 
 static void mempolicy_test(int policy, unsigned long nodemask, int maxnode, void *addr) {
+    unsigned long hnodemask[HMALLOC_NODEMASK_LONGS] = {};
     int hpolicy;
-    unsigned long hnodemask;
 
-    CHECK(0 == get_mempolicy(&hpolicy, &hnodemask, maxnode, addr, MPOL_F_ADDR));
+    REQUIRE(maxnode <= HMALLOC_MAX_NODES);
+    CHECK(0 == get_mempolicy(&hpolicy, hnodemask, maxnode, addr, MPOL_F_ADDR));
     CHECK(policy == hpolicy);
-    CHECK(nodemask == hnodemask);
+    CHECK(nodemask == hnodemask[0]);
 }
 
 TEST_CASE("hmalloc") {
@@ -90,6 +127,224 @@ TEST_CASE("hmalloc") {
     }
 }
 
+TEST_CASE("tcache") {
+    int nthreads = std::max(2U, std::thread::hardware_concurrency());
+
+    SECTION("multi-threaded hmalloc/hfree") {
+        setenv("HMALLOC_TCACHE", "1", 1);
+        update_env();
+
+        std::vector<std::thread> threads;
+        for (int t = 0; t < nthreads; t++) {
+            threads.emplace_back([]() {
+                std::vector<size_t> sizes = {1, 10, 100, 1000, 5000, 10000};
+                for (int i = 0; i < 3; i++)
+                    hmalloc_test(sizes);
+            });
+        }
+        for (auto &thread : threads)
+            thread.join();
+    }
+
+    unsetenv("HMALLOC_TCACHE");
+    update_env();
+}
+
+TEST_CASE("arena select") {
+    int nthreads = std::max(2U, std::thread::hardware_concurrency());
+    std::vector<std::string> modes = {"rr", "cpu"};
+
+    for (auto &mode : modes) {
+        setenv("HMALLOC_ARENA_SELECT", mode.c_str(), 1);
+        update_env();
+
+        std::vector<std::thread> threads;
+        for (int t = 0; t < nthreads; t++) {
+            threads.emplace_back([]() {
+                std::vector<size_t> sizes = {1, 10, 100, 1000, 5000, 10000, 1000000};
+                hmalloc_test(sizes);
+            });
+        }
+        for (auto &thread : threads)
+            thread.join();
+    }
+
+    /* memory allocated by one thread can be freed by another thread */
+    void *ptr = nullptr;
+    std::thread([&ptr]() { ptr = hmalloc(1024); }).join();
+    REQUIRE(ptr);
+    hfree(ptr);
+
+    unsetenv("HMALLOC_ARENA_SELECT");
+    update_env();
+}
+
+TEST_CASE("slab") {
+    setenv("HMALLOC_BACKEND", "slab", 1);
+    update_env();
+
+    SECTION("size classes") {
+        std::vector<size_t> sizes;
+        for (size_t size = 1; size <= 512 * kb; size = size * 3 / 2 + 1)
+            sizes.push_back(size);
+        hmalloc_test(sizes);
+        hmalloc_test({0, 16, 128, 4 * kb, 256 * kb, 256 * kb + 1, 4 * mb});
+
+        for (size_t size : {1UL, 17UL, 1000UL, 100 * kb, 256 * kb, 1 * mb}) {
+            void *ptr = hmalloc(size);
+            REQUIRE(ptr);
+            CHECK(hmalloc_usable_size(ptr) >= size);
+            hfree(ptr);
+        }
+    }
+
+    SECTION("slabs emptied one after another") {
+        for (size_t size : {16UL, 4 * kb, 128 * kb, 256 * kb}) {
+            std::vector<unsigned char *> v(64);
+
+            for (size_t i = 0; i < v.size(); i++) {
+                v[i] = static_cast<unsigned char *>(hmalloc(size));
+                REQUIRE(v[i]);
+                memset(v[i], static_cast<int>(i), size);
+            }
+            /* the objects still allocated keep their contents as the slabs before them empty */
+            for (size_t i = 0; i < v.size(); i++) {
+                for (size_t j = i; j < v.size(); j++)
+                    REQUIRE(v[j][size - 1] == j);
+                hfree(v[i]);
+            }
+        }
+    }
+
+    SECTION("alignment") {
+        for (size_t alignment = 16; alignment <= 64 * kb; alignment *= 2) {
+            for (size_t size : {1UL, alignment - 1, alignment + 1, 3 * alignment}) {
+                void *ptr = haligned_alloc(alignment, size);
+                REQUIRE(ptr);
+                CHECK(0 == reinterpret_cast<uintptr_t>(ptr) % alignment);
+                memset(ptr, 1, size);
+                hfree_aligned_sized(ptr, alignment, size);
+            }
+        }
+    }
+
+    SECTION("hrealloc into a huge allocation") {
+        auto *ptr = static_cast<unsigned char *>(hmalloc(100));
+        REQUIRE(ptr);
+        memset(ptr, 0xab, 100);
+
+        for (size_t size : {110UL, 4 * kb, 300 * kb, 8 * mb, 1000UL}) {
+            ptr = static_cast<unsigned char *>(hrealloc(ptr, size));
+            REQUIRE(ptr);
+            CHECK(hmalloc_usable_size(ptr) >= size);
+            CHECK(ptr[0] == 0xab);
+            CHECK(ptr[99] == 0xab);
+        }
+        hfree(ptr);
+    }
+
+    SECTION("objects freed by other threads") {
+        int nthreads = std::max(2U, std::thread::hardware_concurrency());
+        std::vector<std::vector<void *>> objs(nthreads);
+        std::vector<std::thread> threads;
+
+        for (int t = 0; t < nthreads; t++) {
+            threads.emplace_back([&objs, t]() {
+                for (int i = 0; i < 10000; i++) {
+                    void *ptr = hmalloc(16 + i % 2048);
+                    REQUIRE(ptr);
+                    objs[t].push_back(ptr);
+                }
+            });
+        }
+        for (auto &thread : threads)
+            thread.join();
+        threads.clear();
+
+        for (int t = 0; t < nthreads; t++) {
+            threads.emplace_back([&objs, t, nthreads]() {
+                for (auto *ptr : objs[(t + 1) % nthreads])
+                    hfree(ptr);
+            });
+        }
+        for (auto &thread : threads)
+            thread.join();
+    }
+
+    SECTION("fork while other threads allocate") {
+        int nthreads = std::max(2U, std::thread::hardware_concurrency());
+        std::atomic<bool> stop{false};
+        std::vector<std::thread> threads;
+
+        for (int t = 0; t < nthreads; t++) {
+            threads.emplace_back([&stop]() {
+                std::vector<void *> v(64);
+                for (size_t i = 0; !stop; i++) {
+                    for (auto &ptr : v)
+                        ptr = hmalloc(16 + i * 1024 % (16 * kb));
+                    for (auto *ptr : v)
+                        hfree(ptr);
+                }
+            });
+        }
+        for (int i = 0; i < 20; i++) {
+            int status = -1;
+            pid_t pid = fork();
+
+            REQUIRE(pid >= 0);
+            if (pid == 0) {
+                /* the child hangs on a lock held by another thread of the parent */
+                alarm(10);
+                for (size_t size = 16; size <= 256 * kb; size *= 2) {
+                    std::vector<void *> v(64);
+                    for (auto &ptr : v)
+                        ptr = hmalloc(size);
+                    for (auto *ptr : v)
+                        hfree(ptr);
+                }
+                _exit(0);
+            }
+            REQUIRE(pid == waitpid(pid, &status, 0));
+            CHECK(WIFEXITED(status));
+            CHECK(0 == WEXITSTATUS(status));
+        }
+        stop = true;
+        for (auto &thread : threads)
+            thread.join();
+    }
+
+    SECTION("hmalloc_node") {
+        int node = 0, status = -1;
+        void *ptr = hmalloc_node(64 * kb, node);
+
+        REQUIRE(ptr);
+        memset(ptr, 1, 64 * kb);
+        CHECK(0 == get_mempolicy(&status, nullptr, 0, ptr, MPOL_F_NODE | MPOL_F_ADDR));
+        CHECK(node == status);
+        hfree(ptr);
+    }
+
+    SECTION("hmalloc_stats") {
+        struct hmalloc_stats stats;
+        std::vector<void *> v;
+        size_t allocated = 0;
+
+        for (int i = 0; i < 1000; i++) {
+            v.push_back(hmalloc(1 * kb));
+            REQUIRE(v.back());
+        }
+        REQUIRE(0 == hmalloc_stats(&stats));
+        for (int node = 0; node < HMALLOC_MAX_NODES; node++)
+            allocated += stats.allocated[node];
+        CHECK(allocated + stats.allocated_default >= 1000 * kb);
+        CHECK(stats.active >= 1000 * kb);
+        hfree_batch(v.data(), v.size());
+    }
+
+    unsetenv("HMALLOC_BACKEND");
+    update_env();
+}
+
 TEST_CASE("hcalloc") {
     size_t nmemb = 1 * mb;
     size_t size = sizeof(char);
@@ -106,6 +361,24 @@ TEST_CASE("hcalloc") {
         free(ptr);
         hfree(hptr);
     }
+
+    SECTION("zeroing reused memory") {
+        auto *hptr = static_cast<char *>(hmalloc(nmemb * size));
+        REQUIRE(hptr);
+        memset(hptr, 0xff, nmemb * size);
+        hfree(hptr);
+
+        hptr = static_cast<char *>(hcalloc(nmemb, size));
+        REQUIRE(hptr);
+        for (size_t i = 0; i < nmemb * size; i += 4 * kb)
+            CHECK(0 == hptr[i]);
+        hfree(hptr);
+    }
+
+    SECTION("overflow") {
+        CHECK(nullptr == hcalloc(SIZE_MAX / 2, 3));
+        CHECK(ENOMEM == errno);
+    }
 }
 
 TEST_CASE("hmalloc_usable_size") {
@@ -169,6 +442,144 @@ TEST_CASE("hrealloc") {
     }
 }
 
+TEST_CASE("hrealloc mremap") {
+    struct bitmask *mask = numa_get_mems_allowed();
+    int node = ffs(*mask->maskp) - 1;
+    int maxnode = numa_max_possible_node();
+    size_t size = 16 * mb;
+    struct hmalloc_stats stats;
+
+    numa_free_nodemask(mask);
+    setenv("HMALLOC_MREMAP_THRESHOLD", "16M", 1);
+    update_env();
+
+    SECTION("huge allocations") {
+        auto *ptr = static_cast<char *>(hcalloc(size, sizeof(char)));
+        REQUIRE(ptr);
+        CHECK(((uintptr_t)ptr & 4095) == 0);
+        CHECK(size == hmalloc_usable_size(ptr));
+        CHECK(0 == ptr[size - 1]);
+        hfree(ptr);
+
+        /* an object of the arenas becomes a huge allocation when it grows over the threshold */
+        ptr = static_cast<char *>(hmalloc(1 * mb));
+        REQUIRE(ptr);
+        memset(ptr, 0xab, 1 * mb);
+        ptr = static_cast<char *>(hrealloc(ptr, size));
+        REQUIRE(ptr);
+        CHECK(size == hmalloc_usable_size(ptr));
+        CHECK((char)0xab == ptr[1 * mb - 1]);
+
+        /* shrinking keeps the address and unmaps the tail */
+        auto *new_ptr = static_cast<char *>(hrealloc(ptr, size / 2 + 1));
+        CHECK(new_ptr == ptr);
+        CHECK(size / 2 + 4096 == hmalloc_usable_size(ptr));
+        hfree(ptr);
+    }
+
+    SECTION("grow in place") {
+        auto *ptr = static_cast<char *>(hmalloc_node(size, node));
+        REQUIRE(ptr);
+        memset(ptr, 0xcd, size);
+
+        /* probe whether the address space after the allocation is free to grow there */
+        void *tail = ptr + size;
+        void *probe = mmap(tail, 3 * size, PROT_NONE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+        if (probe != MAP_FAILED)
+            munmap(probe, 3 * size);
+
+        auto *new_ptr = static_cast<char *>(hrealloc(ptr, 4 * size));
+        REQUIRE(new_ptr);
+        if (probe == tail)
+            CHECK(new_ptr == ptr);
+        CHECK((char)0xcd == new_ptr[size - 1]);
+        memset(new_ptr + size, 0, 3 * size);
+        mempolicy_test(MPOL_BIND, 1UL << node, maxnode, new_ptr + size);
+        hfree(new_ptr);
+    }
+
+    SECTION("grow by mremap") {
+        auto *ptr = static_cast<char *>(hmalloc_node(size, node));
+        REQUIRE(ptr);
+        memset(ptr, 0xef, size);
+
+        /* block the address space after the allocation so that it moves */
+        void *tail = ptr + size;
+        void *block = mmap(tail, 4096, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE,
+                           -1, 0);
+        REQUIRE(0 == hmalloc_stats(&stats));
+        unsigned long nr_mremap = stats.nr_mremap;
+
+        auto *new_ptr = static_cast<char *>(hrealloc(ptr, 4 * size));
+        REQUIRE(new_ptr);
+        if (block == tail) {
+            CHECK(new_ptr != ptr);
+            REQUIRE(0 == hmalloc_stats(&stats));
+            CHECK(stats.nr_mremap == nr_mremap + 1);
+            CHECK(stats.nr_mremap_failed == 0);
+        }
+        CHECK((char)0xef == new_ptr[0]);
+        CHECK((char)0xef == new_ptr[size - 1]);
+        memset(new_ptr + size, 0, 3 * size);
+
+        /* the old pages stay and only the new tail is bound */
+        mempolicy_test(MPOL_BIND, 1UL << node, maxnode, new_ptr);
+        mempolicy_test(MPOL_BIND, 1UL << node, maxnode, new_ptr + 2 * size);
+        hfree(new_ptr);
+        if (block != MAP_FAILED)
+            munmap(block, 4096);
+    }
+
+    SECTION("grow after hmove") {
+        auto *ptr = static_cast<char *>(hmalloc(size));
+        REQUIRE(ptr);
+        memset(ptr, 0xef, size);
+
+        /* the huge allocation takes the policy of the node it is moved to */
+        REQUIRE(0 == hmalloc_migrate(ptr, node));
+        mempolicy_test(MPOL_BIND, 1UL << node, maxnode, ptr);
+
+        auto *new_ptr = static_cast<char *>(hrealloc(ptr, 4 * size));
+        REQUIRE(new_ptr);
+        CHECK((char)0xef == new_ptr[size - 1]);
+        memset(new_ptr + size, 0, 3 * size);
+        mempolicy_test(MPOL_BIND, 1UL << node, maxnode, new_ptr + 3 * size);
+        hfree(new_ptr);
+    }
+
+    SECTION("grow by copying") {
+        auto *ptr = static_cast<char *>(hmalloc_node(size, node));
+        unsigned long nodemask = 1UL << node;
+        REQUIRE(ptr);
+        memset(ptr, 0xef, size);
+
+        /* mremap() fails on a mapping split by the memory policies of its parts */
+        REQUIRE(0 == mbind(ptr + size / 2, size / 2, MPOL_PREFERRED, &nodemask,
+                           sizeof(nodemask) * 8, 0));
+        void *tail = ptr + size;
+        void *block = mmap(tail, 4096, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE,
+                           -1, 0);
+        REQUIRE(0 == hmalloc_stats(&stats));
+        unsigned long nr_huge_copies = stats.nr_huge_copies;
+
+        auto *new_ptr = static_cast<char *>(hrealloc(ptr, 4 * size));
+        REQUIRE(new_ptr);
+        if (block == tail) {
+            REQUIRE(0 == hmalloc_stats(&stats));
+            CHECK(stats.nr_huge_copies == nr_huge_copies + 1);
+        }
+        CHECK((char)0xef == new_ptr[0]);
+        CHECK((char)0xef == new_ptr[size - 1]);
+        hfree(new_ptr);
+        if (block != MAP_FAILED)
+            munmap(block, 4096);
+    }
+
+    unsetenv("HMALLOC_MREMAP_THRESHOLD");
+    update_env();
+}
+
 TEST_CASE("haligned_alloc") {
     SECTION("alignment power of two") {
         size_t alignment = 1024;
@@ -269,6 +680,110 @@ TEST_CASE("hfree") {
     }
 }
 
+TEST_CASE("hfree_sized") {
+    SECTION("requested size") {
+        for (size_t size = 1; size <= 4 * mb; size = size * 3 / 2 + 1) {
+            void *ptr = hmalloc(size);
+            REQUIRE(ptr);
+            hfree_sized(ptr, size);
+        }
+    }
+
+    SECTION("usable size") {
+        void *ptr = hmalloc(1000);
+        REQUIRE(ptr);
+        hfree_sized(ptr, hmalloc_usable_size(ptr));
+    }
+
+    SECTION("hcalloc and hrealloc") {
+        void *ptr = hcalloc(10, 100);
+        REQUIRE(ptr);
+        ptr = hrealloc(ptr, 3000);
+        REQUIRE(ptr);
+        hfree_sized(ptr, 3000);
+    }
+
+    SECTION("hfree_aligned_sized") {
+        for (size_t alignment = 16; alignment <= 2 * mb; alignment *= 4) {
+            void *ptr = haligned_alloc(alignment, 100);
+            REQUIRE(ptr);
+            hfree_aligned_sized(ptr, alignment, 100);
+
+            REQUIRE(0 == hposix_memalign(&ptr, alignment, 5000));
+            hfree_aligned_sized(ptr, alignment, 5000);
+        }
+    }
+
+    SECTION("nullptr") {
+        hfree_sized(nullptr, 100);
+        hfree_aligned_sized(nullptr, 64, 100);
+    }
+}
+
+TEST_CASE("hmalloc_batch") {
+    std::vector<void *> ptrs(1000);
+
+    SECTION("small and large objects") {
+        for (size_t size : {1UL, 48UL, 1000UL, 64 * kb, 1 * mb}) {
+            REQUIRE(0 == hmalloc_batch(size, ptrs.size(), ptrs.data()));
+            for (void *ptr : ptrs) {
+                REQUIRE(ptr);
+                CHECK(size <= hmalloc_usable_size(ptr));
+                memset(ptr, 0xff, size);
+            }
+
+            /* all the objects are distinct */
+            std::vector<void *> sorted(ptrs);
+            std::sort(sorted.begin(), sorted.end());
+            CHECK(sorted.end() == std::adjacent_find(sorted.begin(), sorted.end()));
+
+            hfree_batch(ptrs.data(), ptrs.size());
+        }
+    }
+
+    SECTION("policy") {
+        struct bitmask *mask = numa_get_mems_allowed();
+        int node = ffs(*mask->maskp) - 1;
+        numa_free_nodemask(mask);
+
+        unsigned long nodemask = 1UL << node;
+        auto *policy = hmalloc_policy_create(MPOL_BIND, &nodemask, sizeof(nodemask) * 8);
+        REQUIRE(policy);
+
+        REQUIRE(0 == hmalloc_batch_p(policy, 64 * kb, ptrs.size(), ptrs.data()));
+        for (void *ptr : ptrs) {
+            int actual = -1;
+
+            memset(ptr, 1, 64 * kb);
+            REQUIRE(0 == get_mempolicy(&actual, nullptr, 0, ptr, MPOL_F_NODE | MPOL_F_ADDR));
+            CHECK(node == actual);
+        }
+        hfree_batch(ptrs.data(), ptrs.size());
+    }
+
+    SECTION("all or nothing") {
+        /* the batch fails at the first object that does not fit in the address space */
+        REQUIRE(-1 == hmalloc_batch(SIZE_MAX / 4, 8, ptrs.data()));
+        CHECK(ENOMEM == errno);
+        for (size_t i = 0; i < 8; i++)
+            CHECK(nullptr == ptrs[i]);
+    }
+
+    SECTION("empty batch") {
+        CHECK(0 == hmalloc_batch(64, 0, nullptr));
+        CHECK(-1 == hmalloc_batch(64, 1, nullptr));
+        CHECK(EINVAL == errno);
+        hfree_batch(nullptr, 0);
+    }
+
+    SECTION("hfree_batch skips NULL") {
+        REQUIRE(0 == hmalloc_batch(100, 10, ptrs.data()));
+        hfree(ptrs[3]);
+        ptrs[3] = nullptr;
+        hfree_batch(ptrs.data(), 10);
+    }
+}
+
 TEST_CASE("hmmap/hmunmap") {
     SECTION("anonymous") {
         size_t size = 1 * mb;
@@ -298,6 +813,571 @@ TEST_CASE("hmmap/hmunmap") {
     }
 }
 
+TEST_CASE("extent_alloc") {
+    bool zero = false;
+    bool commit = false;
+    size_t size = 4 * mb;
+    void *addr;
+
+    SECTION("alignment") {
+        size_t alignment = 2 * mb;
+        addr = extent_alloc(nullptr, nullptr, size, alignment, &zero, &commit, 0);
+        REQUIRE(addr);
+        CHECK(0 == reinterpret_cast<uintptr_t>(addr) % alignment);
+        CHECK(zero);
+        CHECK(commit);
+        CHECK(0 == munmap(addr, size));
+    }
+
+    SECTION("new_addr") {
+        void *hint = mmap(nullptr, size, PROT_NONE, MAP_PRIVATE | MAP_ANON, -1, 0);
+        REQUIRE(MAP_FAILED != hint);
+        REQUIRE(0 == munmap(hint, size));
+
+        addr = extent_alloc(nullptr, hint, size, 0, &zero, &commit, 0);
+        REQUIRE(addr);
+        CHECK(hint == addr);
+        CHECK(0 == munmap(addr, size));
+    }
+
+    SECTION("new_addr in use") {
+        void *used = mmap(nullptr, size, PROT_NONE, MAP_PRIVATE | MAP_ANON, -1, 0);
+        REQUIRE(MAP_FAILED != used);
+
+        CHECK(nullptr == extent_alloc(nullptr, used, size, 0, &zero, &commit, 0));
+        CHECK(0 == munmap(used, size));
+    }
+}
+
+TEST_CASE("hugepage") {
+    bool zero = false;
+    bool commit = false;
+    size_t size = 4 * mb;
+    void *addr;
+
+    SECTION("thp extent") {
+        setenv("HMALLOC_HUGEPAGE", "thp", 1);
+        update_env();
+
+        addr = extent_alloc(nullptr, nullptr, size, 0, &zero, &commit, 0);
+        REQUIRE(addr);
+        CHECK(0 == reinterpret_cast<uintptr_t>(addr) % (2 * mb));
+        memset(addr, 1, size);
+        CHECK(0 == munmap(addr, size));
+    }
+
+    SECTION("hugetlb extent falls back to base pages") {
+        /* succeeds either from the hugetlb pool or with base pages */
+        setenv("HMALLOC_HUGEPAGE", "2M", 1);
+        update_env();
+
+        addr = extent_alloc(nullptr, nullptr, size, 0, &zero, &commit, 0);
+        REQUIRE(addr);
+        CHECK(zero);
+        CHECK(commit);
+        memset(addr, 1, size);
+        CHECK(0 == munmap(addr, size));
+
+        /* not a multiple of the huge page size */
+        addr = extent_alloc(nullptr, nullptr, size + 4 * kb, 0, &zero, &commit, 0);
+        REQUIRE(addr);
+        CHECK(0 == munmap(addr, size + 4 * kb));
+    }
+
+    SECTION("hmmap with HMAP_HUGEPAGE") {
+        unsetenv("HMALLOC_HUGEPAGE");
+        update_env();
+
+        addr = hmmap(nullptr, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | HMAP_HUGEPAGE, -1, 0);
+        REQUIRE(MAP_FAILED != addr);
+        CHECK(0 == reinterpret_cast<uintptr_t>(addr) % (2 * mb));
+        memset(addr, 1, size);
+        CHECK(0 == hmunmap(addr, size));
+    }
+
+    SECTION("huge allocations of the built-in allocator with hugetlb pages") {
+        struct hmalloc_stats before, after;
+
+        setenv("HMALLOC_BACKEND", "slab", 1);
+        setenv("HMALLOC_HUGEPAGE", "2M", 1);
+        update_env();
+
+        REQUIRE(0 == hmalloc_stats(&before));
+        auto *ptr = static_cast<unsigned char *>(hmalloc(size + 1));
+        REQUIRE(ptr);
+        memset(ptr, 1, size + 1);
+        REQUIRE(0 == hmalloc_stats(&after));
+        /* rounded up to whole huge pages unless the hugetlb pool is exhausted */
+        if (after.mapped[HMALLOC_PAGE_2M] != before.mapped[HMALLOC_PAGE_2M])
+            CHECK(after.mapped[HMALLOC_PAGE_2M] - before.mapped[HMALLOC_PAGE_2M] == 6 * mb);
+
+        ptr = static_cast<unsigned char *>(hrealloc(ptr, 2 * size));
+        REQUIRE(ptr);
+        CHECK(ptr[size] == 1);
+        ptr = static_cast<unsigned char *>(hrealloc(ptr, size / 2 + 1));
+        REQUIRE(ptr);
+        CHECK(ptr[size / 2] == 1);
+        hfree(ptr);
+
+        unsetenv("HMALLOC_BACKEND");
+    }
+
+    unsetenv("HMALLOC_HUGEPAGE");
+    update_env();
+}
+
+TEST_CASE("hmmap_populate") {
+    size_t size = 256 * mb;
+    std::vector<unsigned char> vec(size / (4 * kb));
+    char *addr;
+
+    addr = static_cast<char *>(
+        hmmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    REQUIRE(MAP_FAILED != addr);
+
+    SECTION("populate in parallel") {
+        addr[size / 2] = 42;
+        CHECK(0 == hmmap_populate(addr, size, 4));
+        REQUIRE(0 == mincore(addr, size, vec.data()));
+        CHECK(std::all_of(vec.begin(), vec.end(), [](unsigned char v) { return v & 1; }));
+        CHECK(42 == addr[size / 2]);
+    }
+
+    SECTION("unaligned range") {
+        CHECK(0 == hmmap_populate(addr + 100, 4 * kb, 0));
+        REQUIRE(0 == mincore(addr, 8 * kb, vec.data()));
+        CHECK(vec[0] & 1);
+        CHECK(vec[1] & 1);
+    }
+
+    SECTION("unmapped range") {
+        CHECK(0 == hmunmap(addr + size / 2, size / 2));
+        CHECK(-1 == hmmap_populate(addr, size, 2));
+        size /= 2;
+    }
+
+    SECTION("read-only range") {
+        addr[0] = 42;
+        REQUIRE(0 == mprotect(addr, size / 2, PROT_READ));
+        CHECK(0 == hmmap_populate(addr, size, 2));
+        CHECK(42 == addr[0]);
+        CHECK(0 == addr[size / 4]);
+        REQUIRE(0 == mincore(addr + size / 2, size / 2, vec.data()));
+        CHECK(std::all_of(vec.begin(), vec.begin() + vec.size() / 2,
+                          [](unsigned char v) { return v & 1; }));
+
+        REQUIRE(0 == mprotect(addr, size / 2, PROT_NONE));
+        CHECK(-1 == hmmap_populate(addr, size / 2, 1));
+        CHECK(EINVAL == errno);
+    }
+
+    CHECK(0 == hmunmap(addr, size));
+}
+
+TEST_CASE("hmalloc_stats") {
+    struct hmalloc_stats stats;
+    size_t size = 64 * mb;
+
+    SECTION("NULL stats") {
+        errno = 0;
+        CHECK(-1 == hmalloc_stats(nullptr));
+        CHECK(EINVAL == errno);
+    }
+
+    SECTION("resident and allocated bytes") {
+        char *ptr = static_cast<char *>(hmalloc(size));
+        size_t resident = 0, allocated = 0;
+
+        REQUIRE(ptr);
+        memset(ptr, 1, size);
+
+        REQUIRE(0 == hmalloc_stats(&stats));
+        for (int node = 0; node < HMALLOC_MAX_NODES; node++) {
+            resident += stats.resident[node];
+            allocated += stats.allocated[node];
+        }
+        CHECK(resident >= size);
+        CHECK(allocated + stats.allocated_default >= size);
+        CHECK(stats.active >= size);
+        CHECK(stats.mapped[HMALLOC_PAGE_BASE] >= size);
+        CHECK(stats.nr_mmap > 0);
+        CHECK(stats.nr_mmap >= stats.nr_mmap_failed);
+        hfree(ptr);
+    }
+
+    SECTION("hmmap") {
+        char *addr = static_cast<char *>(
+            hmmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+        size_t mapped;
+
+        REQUIRE(MAP_FAILED != addr);
+        REQUIRE(0 == hmalloc_stats(&stats));
+        mapped = stats.mapped[HMALLOC_PAGE_BASE];
+        CHECK(mapped >= size);
+
+        CHECK(0 == hmunmap(addr, size));
+        REQUIRE(0 == hmalloc_stats(&stats));
+        CHECK(mapped - size == stats.mapped[HMALLOC_PAGE_BASE]);
+    }
+
+    SECTION("sampled latency") {
+        unsigned long nr_malloc = 0, nr_free = 0;
+
+        setenv("HMALLOC_STATS_SAMPLE", "1", 1);
+        update_env();
+        for (int i = 0; i < 100; i++)
+            hfree(hmalloc(64));
+        unsetenv("HMALLOC_STATS_SAMPLE");
+        update_env();
+
+        REQUIRE(0 == hmalloc_stats(&stats));
+        for (int i = 0; i < HMALLOC_LATENCY_BUCKETS; i++) {
+            nr_malloc += stats.malloc_latency[i];
+            nr_free += stats.free_latency[i];
+        }
+        CHECK(nr_malloc >= 100);
+        CHECK(nr_free >= 100);
+    }
+}
+
+TEST_CASE("weighted interleave") {
+    size_t chunk = 4 * mb, size = 32 * chunk;
+    int maxnode = sizeof(unsigned long) * 8;
+    std::string weights = "0:3";
+    int other = -1;
+    char *addr;
+
+    for (int node = 1; node <= numa_max_node() && node < maxnode; node++) {
+        if (numa_bitmask_isbitset(numa_all_nodes_ptr, node)) {
+            other = node;
+            weights += "," + std::to_string(node) + ":1";
+            break;
+        }
+    }
+    setenv("HMALLOC_WEIGHTS", weights.c_str(), 1);
+    setenv("HMALLOC_WEIGHT_CHUNK", "4M", 1);
+    update_env();
+
+    addr = static_cast<char *>(
+        hmmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    REQUIRE(MAP_FAILED != addr);
+    for (size_t offset = 0; offset < size; offset += chunk) {
+        size_t index = (reinterpret_cast<uintptr_t>(addr) + offset) / chunk;
+        int node = (other > 0 && index % 4 == 3) ? other : 0;
+
+        mempolicy_test(MPOL_PREFERRED, 1UL << node, maxnode, addr + offset);
+    }
+    CHECK(0 == hmunmap(addr, size));
+
+    SECTION("invalid weights") {
+        setenv("HMALLOC_WEIGHTS", "0:3,1", 1);
+        update_env();
+
+        addr = static_cast<char *>(
+            hmmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+        REQUIRE(MAP_FAILED != addr);
+        mempolicy_test(MPOL_DEFAULT, 0, maxnode, addr);
+        CHECK(0 == hmunmap(addr, size));
+    }
+
+    SECTION("socket local") {
+        unsigned long weighted = 1UL | (other > 0 ? 1UL << other : 0);
+        int status = -1;
+        pid_t pid = fork();
+
+        REQUIRE(pid >= 0);
+        if (pid == 0) {
+            /* HMALLOC_SOCKET_LOCAL cannot be turned off, so it is tested in a child */
+            unsigned long hnodemask[HMALLOC_NODEMASK_LONGS] = {};
+            int hpolicy = -1;
+
+            setenv("HMALLOC_SOCKET_LOCAL", "1", 1);
+            hmalloc_init();
+            addr = static_cast<char *>(
+                hmmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+            if (addr == MAP_FAILED)
+                _exit(1);
+            memset(addr, 0xff, size);
+            if (get_mempolicy(&hpolicy, hnodemask, maxnode, addr, MPOL_F_ADDR))
+                _exit(2);
+            /* the weights are not copied to the nearest nodes of the socket */
+            if (hpolicy != MPOL_INTERLEAVE)
+                _exit(3);
+            if (hnodemask[0] == 0 || (hnodemask[0] & ~weighted))
+                _exit(4);
+            _exit(0);
+        }
+        REQUIRE(pid == waitpid(pid, &status, 0));
+        CHECK(WIFEXITED(status));
+        CHECK(0 == WEXITSTATUS(status));
+    }
+
+    unsetenv("HMALLOC_WEIGHTS");
+    unsetenv("HMALLOC_WEIGHT_CHUNK");
+    update_env();
+}
+
+TEST_CASE("hmalloc_policy") {
+    struct bitmask *mask = numa_get_mems_allowed();
+    int node = ffs(*mask->maskp) - 1;
+    unsigned long nodemask = 1UL << node;
+    unsigned long maxnode = sizeof(nodemask) * 8;
+    size_t size = 4 * mb;
+    void *ptr;
+
+    SECTION("invalid arguments") {
+        CHECK(nullptr == hmalloc_policy_create(-1, &nodemask, maxnode));
+        CHECK(EINVAL == errno);
+        CHECK(nullptr == hmalloc_policy_create(MPOL_BIND, nullptr, 0));
+        CHECK(EINVAL == errno);
+        CHECK(nullptr == hmalloc_node(size, -1));
+        CHECK(EINVAL == errno);
+    }
+
+    SECTION("MPOL_BIND policy") {
+        hmalloc_policy_t *policy = hmalloc_policy_create(MPOL_BIND, &nodemask, maxnode);
+        REQUIRE(policy);
+
+        ptr = hmalloc_p(policy, size);
+        REQUIRE(ptr);
+        memset(ptr, 0xff, size);
+        mempolicy_test(MPOL_BIND, nodemask, maxnode, ptr);
+
+        ptr = hrealloc_p(policy, ptr, size * 2);
+        REQUIRE(ptr);
+        memset(ptr, 0xff, size * 2);
+        mempolicy_test(MPOL_BIND, nodemask, maxnode, ptr);
+        hfree(ptr);
+
+        ptr = hcalloc_p(policy, size, sizeof(char));
+        REQUIRE(ptr);
+        CHECK(0 == static_cast<char *>(ptr)[size - 1]);
+        mempolicy_test(MPOL_BIND, nodemask, maxnode, ptr);
+        hfree(ptr);
+
+        ptr = haligned_alloc_p(policy, 1024, size);
+        REQUIRE(ptr);
+        CHECK(0 == reinterpret_cast<uintptr_t>(ptr) % 1024);
+        hfree(ptr);
+
+        REQUIRE(0 == hposix_memalign_p(policy, &ptr, 1024, size));
+        CHECK(0 == reinterpret_cast<uintptr_t>(ptr) % 1024);
+        hfree(ptr);
+
+        ptr = hmmap_p(policy, NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, 0, 0);
+        REQUIRE(MAP_FAILED != ptr);
+        memset(ptr, 0xff, size);
+        mempolicy_test(MPOL_BIND, nodemask, maxnode, ptr);
+        CHECK(0 == hmunmap(ptr, size));
+
+        CHECK(0 == hmalloc_policy_destroy(policy));
+    }
+
+    SECTION("hmalloc_policy_destroy") {
+        struct hmalloc_stats before, after;
+        std::vector<void *> v(1000);
+
+        CHECK(-1 == hmalloc_policy_destroy(nullptr));
+        CHECK(EINVAL == errno);
+
+        REQUIRE(0 == hmalloc_stats(&before));
+        hmalloc_policy_t *policy = hmalloc_policy_create(MPOL_PREFERRED, &nodemask, maxnode);
+        REQUIRE(policy);
+        for (auto &obj : v) {
+            obj = hmalloc_p(policy, 4 * kb);
+            REQUIRE(obj);
+            memset(obj, 0xff, 4 * kb);
+        }
+        for (auto *obj : v)
+            hfree(obj);
+
+        hmalloc_thread_set_policy(policy);
+        CHECK(0 == hmalloc_policy_destroy(policy));
+        CHECK(nullptr == hmalloc_thread_get_policy());
+        CHECK(-1 == hmalloc_policy_destroy(policy));
+        CHECK(EINVAL == errno);
+
+        /* the memory of the policy is returned to the system */
+        REQUIRE(0 == hmalloc_stats(&after));
+        CHECK(after.active == before.active);
+        CHECK(after.retained == before.retained);
+
+        /* a destroyed policy is created again for the same binding */
+        hmalloc_policy_t *again = hmalloc_policy_create(MPOL_PREFERRED, &nodemask, maxnode);
+        REQUIRE(again);
+        CHECK(policy == again);
+        ptr = hmalloc_p(again, size);
+        REQUIRE(ptr);
+        memset(ptr, 0xff, size);
+        mempolicy_test(MPOL_PREFERRED, nodemask, maxnode, ptr);
+        hfree(ptr);
+        CHECK(0 == hmalloc_policy_destroy(again));
+    }
+
+    SECTION("hmalloc_node") {
+        ptr = hmalloc_node(size, node);
+        REQUIRE(ptr);
+        memset(ptr, 0xff, size);
+        mempolicy_test(MPOL_BIND, nodemask, maxnode, ptr);
+        hfree(ptr);
+    }
+
+    SECTION("NULL policy") {
+        ptr = hmalloc_p(nullptr, size);
+        REQUIRE(ptr);
+        hfree(ptr);
+    }
+
+    numa_free_nodemask(mask);
+}
+
+TEST_CASE("hmalloc_thread_set_policy") {
+    struct bitmask *mask = numa_get_mems_allowed();
+    int node = ffs(*mask->maskp) - 1;
+    unsigned long nodemask = 1UL << node;
+    unsigned long maxnode = sizeof(nodemask) * 8;
+    size_t size = 4 * mb;
+    void *ptr;
+
+    numa_free_nodemask(mask);
+
+    hmalloc_policy_t *policy = hmalloc_policy_create(MPOL_BIND, &nodemask, maxnode);
+    REQUIRE(policy);
+    REQUIRE(nullptr == hmalloc_thread_get_policy());
+
+    hmalloc_thread_set_policy(policy);
+    CHECK(policy == hmalloc_thread_get_policy());
+
+    ptr = hmalloc(size);
+    REQUIRE(ptr);
+    memset(ptr, 0xff, size);
+    mempolicy_test(MPOL_BIND, nodemask, maxnode, ptr);
+    hfree(ptr);
+
+    ptr = hmmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    REQUIRE(MAP_FAILED != ptr);
+    mempolicy_test(MPOL_BIND, nodemask, maxnode, ptr);
+    CHECK(0 == hmunmap(ptr, size));
+
+    /* the other threads keep the global policy */
+    std::thread([&] {
+        CHECK(nullptr == hmalloc_thread_get_policy());
+        void *addr = hmmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+        REQUIRE(MAP_FAILED != addr);
+        mempolicy_test(MPOL_DEFAULT, 0, maxnode, addr);
+        CHECK(0 == hmunmap(addr, size));
+    }).join();
+
+    hmalloc_thread_set_policy(nullptr);
+    CHECK(nullptr == hmalloc_thread_get_policy());
+}
+
+/* send a request to the control socket of the current process and return its reply */
+static int control_send(const char *dir, const std::string &request) {
+    struct sockaddr_un addr = {};
+    char buf[64] = "";
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/hmalloc.%d.sock", dir, getpid());
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+        write(fd, request.c_str(), request.size()) != (ssize_t)request.size() ||
+        read(fd, buf, sizeof(buf) - 1) <= 0) {
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    return atoi(buf);
+}
+
+TEST_CASE("hmalloc_set_policy") {
+    struct bitmask *mask = numa_get_mems_allowed();
+    int node = ffs(*mask->maskp) - 1;
+    unsigned long nodemask = 1UL << node;
+    unsigned long maxnode = sizeof(nodemask) * 8;
+    struct hmalloc_stats stats;
+    size_t size = 2 * mb;
+    void *addr;
+
+    numa_free_nodemask(mask);
+
+    SECTION("invalid arguments") {
+        CHECK(-1 == hmalloc_set_policy(-1, &nodemask, maxnode));
+        CHECK(EINVAL == errno);
+        CHECK(-1 == hmalloc_set_policy(MPOL_BIND, nullptr, 0));
+        CHECK(EINVAL == errno);
+        CHECK(-1 == hmalloc_set_policy(MPOL_DEFAULT, &nodemask, maxnode));
+        CHECK(EINVAL == errno);
+    }
+
+    SECTION("new extents") {
+        REQUIRE(0 == hmalloc_set_policy(MPOL_BIND, &nodemask, maxnode));
+        REQUIRE(0 == hmalloc_stats(&stats));
+        CHECK(stats.effective_mode == MPOL_BIND);
+        CHECK(stats.effective_nodemask[0] == nodemask);
+
+        addr = extent_alloc(nullptr, nullptr, size, 0, nullptr, nullptr, 0);
+        REQUIRE(addr);
+        mempolicy_test(MPOL_BIND, nodemask, maxnode, addr);
+        CHECK(0 == munmap(addr, size));
+
+        REQUIRE(0 == hmalloc_set_policy(MPOL_DEFAULT, nullptr, 0));
+        addr = extent_alloc(nullptr, nullptr, size, 0, nullptr, nullptr, 0);
+        REQUIRE(addr);
+        mempolicy_test(MPOL_DEFAULT, 0, maxnode, addr);
+        CHECK(0 == munmap(addr, size));
+    }
+
+    SECTION("control socket") {
+        char dir[] = "/tmp/hmalloc_test.XXXXXX";
+        REQUIRE(mkdtemp(dir));
+        setenv("HMALLOC_CONTROL", dir, 1);
+        control_init();
+
+        CHECK(0 == control_send(dir, "policy 2 " + std::to_string(node) + "\n"));
+        REQUIRE(0 == hmalloc_stats(&stats));
+        CHECK(stats.effective_mode == MPOL_BIND);
+        CHECK(stats.effective_nodemask[0] == nodemask);
+
+        CHECK(EINVAL == control_send(dir, "policy 2\n"));
+        CHECK(EINVAL == control_send(dir, "policy 2 1-0\n"));
+        CHECK(EINVAL == control_send(dir, "bogus\n"));
+        unsetenv("HMALLOC_CONTROL");
+        unlink((std::string(dir) + "/hmalloc." + std::to_string(getpid()) + ".sock").c_str());
+        rmdir(dir);
+    }
+
+    SECTION("default control directory") {
+        char dir[] = "/tmp/hmalloc_test.XXXXXX";
+        std::string sock;
+        int status = -1;
+        pid_t pid;
+
+        REQUIRE(mkdtemp(dir));
+        sock = std::string(dir) + "/hmalloc";
+        pid = fork();
+        REQUIRE(pid >= 0);
+        if (pid == 0) {
+            /* the socket of the parent is not inherited, so the child creates its own */
+            setenv("XDG_RUNTIME_DIR", dir, 1);
+            setenv("HMALLOC_CONTROL", "1", 1);
+            control_init();
+            _exit(control_send(sock.c_str(), "policy 0\n"));
+        }
+        REQUIRE(pid == waitpid(pid, &status, 0));
+        CHECK(WIFEXITED(status));
+        CHECK(0 == WEXITSTATUS(status));
+
+        unlink((sock + "/hmalloc." + std::to_string(pid) + ".sock").c_str());
+        rmdir(sock.c_str());
+        rmdir(dir);
+    }
+
+    /* back to the policy of the environment */
+    update_env();
+}
+
 TEST_CASE("mbind") {
     /* skip this test when the system has a single numa node */
     int maxnode = numa_max_possible_node();
@@ -323,6 +1403,17 @@ TEST_CASE("mbind") {
         memset(new_addr, 0, size);
 
         mempolicy_test(MPOL_BIND, nodemask, maxnode, new_addr);
+
+        /* every resident page is on one of the nodes */
+        std::vector<size_t> counts(HMALLOC_MAX_NODES);
+        ssize_t resident = hmalloc_where(new_addr, size, counts.data(), counts.size());
+        size_t bound = 0;
+        CHECK(resident > 0);
+        for (int node = 0; node < (int)sizeof(nodemask) * 8; node++) {
+            if (nodemask & (1UL << node))
+                bound += counts[node];
+        }
+        CHECK((size_t)resident == bound);
         CHECK(0 == munmap(new_addr, size));
     }
 
@@ -398,3 +1489,788 @@ TEST_CASE("mbind") {
         CHECK(0 == munmap(new_addr, size));
     }
 }
+
+TEST_CASE("nodes") {
+    struct bitmask *mask = numa_get_mems_allowed();
+    int node = ffs(*mask->maskp) - 1;
+    int maxnode = numa_max_possible_node();
+    struct hmalloc_stats stats;
+    size_t size = 2 * mb;
+    std::string nodes;
+
+    for (unsigned n = 0; n < mask->size; n++) {
+        if (numa_bitmask_isbitset(mask, n))
+            nodes += (nodes.empty() ? "" : ",") + std::to_string(n);
+    }
+    numa_free_nodemask(mask);
+
+    SECTION("HMALLOC_NODES") {
+        setenv("HMALLOC_MPOL_MODE", "1", 1); /* MPOL_PREFERRED is 1 */
+        setenv("HMALLOC_NODES", std::to_string(node).c_str(), 1);
+        /* the node list takes precedence over the old decimal mask */
+        setenv("HMALLOC_NODEMASK", "0", 1);
+        update_env();
+
+        REQUIRE(0 == hmalloc_stats(&stats));
+        CHECK(stats.effective_mode == MPOL_PREFERRED);
+        CHECK(stats.effective_nodemask[0] == 1UL << node);
+
+        void *addr = extent_alloc(nullptr, nullptr, size, 0, nullptr, nullptr, 0);
+        REQUIRE(addr);
+        mempolicy_test(MPOL_PREFERRED, 1UL << node, maxnode + 1, addr);
+        CHECK(0 == munmap(addr, size));
+
+        setenv("HMALLOC_MPOL_MODE", "2", 1); /* MPOL_BIND is 2 */
+        setenv("HMALLOC_NODES", nodes.c_str(), 1);
+        update_env();
+        REQUIRE(0 == hmalloc_stats(&stats));
+        CHECK(stats.effective_nodemask[0] != 0);
+
+        /* an invalid node list leaves the policy without nodes */
+        setenv("HMALLOC_NODES", "0-", 1);
+        update_env();
+        REQUIRE(0 == hmalloc_stats(&stats));
+        for (auto word : stats.effective_nodemask)
+            CHECK(word == 0);
+    }
+
+    SECTION("beyond 64 nodes") {
+        unsigned long nodemask[HMALLOC_NODEMASK_LONGS + 1] = {};
+
+        /* nodes above 63 are kept in the policy rather than dropped or shifted out */
+        nodemask[100 / 64] = 1UL << (100 % 64);
+        CHECK(hmalloc_policy_create(MPOL_BIND, nodemask, HMALLOC_MAX_NODES) != nullptr);
+
+        /* the kernel does not have more than HMALLOC_MAX_NODES nodes */
+        nodemask[HMALLOC_NODEMASK_LONGS] = 1;
+        CHECK(hmalloc_policy_create(MPOL_BIND, nodemask, HMALLOC_MAX_NODES + 64) == nullptr);
+        CHECK(EINVAL == errno);
+    }
+
+    unsetenv("HMALLOC_MPOL_MODE");
+    unsetenv("HMALLOC_NODES");
+    unsetenv("HMALLOC_NODEMASK");
+    update_env();
+}
+
+#ifdef HMALLOC_PRELOAD_LIB
+static int preload_run(const std::string &env, const std::string &cmd) {
+    std::string line = "env LD_PRELOAD=" HMALLOC_PRELOAD_LIB " HMALLOC_JEMALLOC=1 " + env + " " +
+                       cmd + " > /dev/null";
+    int status = std::system(line.c_str());
+
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+TEST_CASE("preload") {
+    const std::string cmd = "sh -c 'ls -lR /usr/include | sort | uniq -c'";
+
+    SECTION("all allocations") {
+        CHECK(0 == preload_run("", cmd));
+    }
+
+    SECTION("threshold") {
+        CHECK(0 == preload_run("HMALLOC_PRELOAD_THRESHOLD=4K", cmd));
+        CHECK(0 == preload_run("HMALLOC_PRELOAD_THRESHOLD=4K HMALLOC_PRELOAD_MMAP_THRESHOLD=64K",
+                               "dd if=/dev/zero bs=1M count=16"));
+    }
+
+    SECTION("without jemalloc") {
+        CHECK(0 == preload_run("HMALLOC_JEMALLOC=0", cmd));
+    }
+
+    SECTION("slab backend") {
+        CHECK(0 == preload_run("HMALLOC_BACKEND=slab", cmd));
+    }
+}
+#endif
+
+TEST_CASE("conf") {
+    struct bitmask *mask = numa_get_mems_allowed();
+    int node = ffs(*mask->maskp) - 1;
+    unsigned long nodemask = 1UL << node;
+    unsigned long maxnode = sizeof(nodemask) * 8;
+    std::string bind = "membind=" + std::to_string(node);
+
+    SECTION("size and alignment") {
+        std::string conf = "align=64K- " + bind + "; size=-1M default; size=1M- " + bind;
+
+        setenv("HMALLOC_CONF", conf.c_str(), 1);
+        conf_init(1);
+
+        /* a new thread looks up the rules that are just compiled */
+        std::thread([&] {
+            void *ptr = hmalloc(4 * mb);
+            REQUIRE(ptr);
+            memset(ptr, 0xff, 4 * mb);
+            mempolicy_test(MPOL_BIND, nodemask, maxnode, ptr);
+            hfree(ptr);
+
+            ptr = hmalloc(256 * kb);
+            REQUIRE(ptr);
+            memset(ptr, 0xff, 256 * kb);
+            mempolicy_test(MPOL_DEFAULT, 0, maxnode, ptr);
+            hfree(ptr);
+
+            ptr = haligned_alloc(64 * kb, 256 * kb);
+            REQUIRE(ptr);
+            memset(ptr, 0xff, 256 * kb);
+            mempolicy_test(MPOL_BIND, nodemask, maxnode, ptr);
+            hfree(ptr);
+        }).join();
+    }
+
+    SECTION("thread name") {
+        std::string conf = "thread=hmtest " + bind;
+
+        setenv("HMALLOC_CONF", conf.c_str(), 1);
+        conf_init(1);
+
+        std::thread([&] {
+            pthread_setname_np(pthread_self(), "hmtest-worker");
+
+            void *ptr = hmalloc(256 * kb);
+            REQUIRE(ptr);
+            memset(ptr, 0xff, 256 * kb);
+            mempolicy_test(MPOL_BIND, nodemask, maxnode, ptr);
+            hfree(ptr);
+        }).join();
+    }
+
+    SECTION("thread renamed") {
+        std::string conf = "thread=hmtest " + bind;
+
+        setenv("HMALLOC_CONF", conf.c_str(), 1);
+        conf_init(1);
+
+        std::thread([&] {
+            void *ptr = hmalloc(256 * kb);
+            REQUIRE(ptr);
+            memset(ptr, 0xff, 256 * kb);
+            mempolicy_test(MPOL_DEFAULT, 0, maxnode, ptr);
+            hfree(ptr);
+
+            /* the thread is named after its first allocation */
+            pthread_setname_np(pthread_self(), "hmtest-worker");
+            ptr = hmalloc(256 * kb);
+            REQUIRE(ptr);
+            memset(ptr, 0xff, 256 * kb);
+            mempolicy_test(MPOL_BIND, nodemask, maxnode, ptr);
+            hfree(ptr);
+
+            /* the rules compiled again are looked up by the running thread */
+            setenv("HMALLOC_CONF", "size=4K- default", 1);
+            conf_init(1);
+            ptr = hmalloc(256 * kb);
+            REQUIRE(ptr);
+            memset(ptr, 0xff, 256 * kb);
+            mempolicy_test(MPOL_DEFAULT, 0, maxnode, ptr);
+            hfree(ptr);
+        }).join();
+    }
+
+    SECTION("policies reused") {
+        std::string conf = "size=1M- " + bind;
+
+        setenv("HMALLOC_CONF", conf.c_str(), 1);
+        /* more than the 64 policies of hmalloc if each call created its policy */
+        for (int i = 0; i < 65; i++)
+            conf_init(1);
+
+        std::thread([&] {
+            void *ptr = hmalloc(4 * mb);
+            REQUIRE(ptr);
+            memset(ptr, 0xff, 4 * mb);
+            mempolicy_test(MPOL_BIND, nodemask, maxnode, ptr);
+            hfree(ptr);
+        }).join();
+    }
+
+    SECTION("thread pattern") {
+        std::string conf = "thread=hm*-w?rker " + bind;
+
+        setenv("HMALLOC_CONF", conf.c_str(), 1);
+        conf_init(1);
+
+        std::thread([&] {
+            pthread_setname_np(pthread_self(), "hmtest-worker");
+
+            void *ptr = hmalloc(256 * kb);
+            REQUIRE(ptr);
+            memset(ptr, 0xff, 256 * kb);
+            mempolicy_test(MPOL_BIND, nodemask, maxnode, ptr);
+            hfree(ptr);
+        }).join();
+
+        std::thread([&] {
+            pthread_setname_np(pthread_self(), "hmtest-workers");
+
+            void *ptr = hmalloc(256 * kb);
+            REQUIRE(ptr);
+            memset(ptr, 0xff, 256 * kb);
+            mempolicy_test(MPOL_DEFAULT, 0, maxnode, ptr);
+            hfree(ptr);
+        }).join();
+    }
+
+    SECTION("thread patterns overlap") {
+        std::string conf = "thread=hm* size=-1M default; thread=hmtest size=1M- " + bind;
+
+        setenv("HMALLOC_CONF", conf.c_str(), 1);
+        conf_init(1);
+
+        /* a thread matching both patterns takes the rules of both */
+        std::thread([&] {
+            pthread_setname_np(pthread_self(), "hmtest-worker");
+
+            void *ptr = hmalloc(256 * kb);
+            REQUIRE(ptr);
+            memset(ptr, 0xff, 256 * kb);
+            mempolicy_test(MPOL_DEFAULT, 0, maxnode, ptr);
+            hfree(ptr);
+
+            ptr = hmalloc(4 * mb);
+            REQUIRE(ptr);
+            memset(ptr, 0xff, 4 * mb);
+            mempolicy_test(MPOL_BIND, nodemask, maxnode, ptr);
+            hfree(ptr);
+        }).join();
+
+        std::thread([&] {
+            pthread_setname_np(pthread_self(), "hmother");
+
+            void *ptr = hmalloc(4 * mb);
+            REQUIRE(ptr);
+            memset(ptr, 0xff, 4 * mb);
+            mempolicy_test(MPOL_DEFAULT, 0, maxnode, ptr);
+            hfree(ptr);
+        }).join();
+    }
+
+    SECTION("invalid rules") {
+        setenv("HMALLOC_CONF", "size=4K-2M membind=0 bogus", 1);
+        conf_init(1);
+        CHECK(nullptr == conf_default);
+    }
+
+    unsetenv("HMALLOC_CONF");
+    conf_init(1);
+    numa_free_nodemask(mask);
+}
+
+/* the number of pages in [ptr, ptr + size) that are not on node */
+static size_t pages_not_on(void *ptr, size_t size, int node) {
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t start = reinterpret_cast<uintptr_t>(ptr) & ~(page_size - 1);
+    uintptr_t end = reinterpret_cast<uintptr_t>(ptr) + size;
+    std::vector<void *> pages;
+
+    for (uintptr_t page = start; page < end; page += page_size)
+        pages.push_back(reinterpret_cast<void *>(page));
+    std::vector<int> status(pages.size());
+
+    REQUIRE(0 == move_pages(0, pages.size(), pages.data(), nullptr, status.data(), 0));
+    return std::count_if(status.begin(), status.end(), [=](int s) { return s != node; });
+}
+
+TEST_CASE("hmove") {
+    struct bitmask *mask = numa_get_mems_allowed();
+    int first = ffs(*mask->maskp) - 1;
+    int last = first;
+    size_t size = 4 * mb;
+
+    for (int node = first; node < (int)sizeof(*mask->maskp) * 8; node++) {
+        if (*mask->maskp & (1UL << node))
+            last = node;
+    }
+
+    SECTION("invalid arguments") {
+        struct hmove move = {nullptr, 0, -1, nullptr};
+
+        CHECK(-1 == hmalloc_migrate(nullptr, first));
+        CHECK(EINVAL == errno);
+        CHECK(-1 == hmove(&move, 1, 0));
+        CHECK(EINVAL == errno);
+        CHECK(-1 == hmove(nullptr, 1, 0));
+        CHECK(EINVAL == errno);
+        CHECK(0 == hmove(nullptr, 0, 0));
+    }
+
+    SECTION("hmalloc_migrate") {
+        if (first == last) {
+            WARN("hmalloc_migrate needs two memory nodes");
+            return;
+        }
+
+        /* an object of the arenas or the slabs, and a huge one mapped on its own */
+        for (size_t obj_size : {32 * kb, size}) {
+            auto *ptr = static_cast<char *>(hmalloc_node(obj_size, first));
+            REQUIRE(ptr);
+            memset(ptr, 0xff, obj_size);
+
+            CHECK(0 == hmalloc_migrate(ptr, last));
+            CHECK(0 == pages_not_on(ptr, obj_size, last));
+
+            /* the object grows on the node it is moved to */
+            ptr = static_cast<char *>(hrealloc(ptr, obj_size * 4));
+            REQUIRE(ptr);
+            memset(ptr + obj_size, 0xff, obj_size * 3);
+            CHECK(0 == pages_not_on(ptr + obj_size, obj_size * 3, last));
+            hfree(ptr);
+        }
+    }
+
+    SECTION("concurrent frees") {
+        std::vector<void *> objs(1000);
+        std::vector<std::thread> threads;
+        std::atomic<bool> done{false};
+        std::atomic<int> found{0};
+
+        /* the objects not moved are freed while the table of the moved ones grows */
+        for (int t = 0; t < 4; t++) {
+            threads.emplace_back([&] {
+                while (!done.load()) {
+                    void *obj = hmalloc(256);
+                    if (obj && migrate_lookup(obj) != -1)
+                        found++;
+                    hfree(obj);
+                }
+            });
+        }
+        for (auto &obj : objs) {
+            obj = hmalloc_node(256, first);
+            REQUIRE(obj);
+            memset(obj, 0xff, 256);
+            CHECK(0 == hmalloc_migrate(obj, last));
+        }
+        done = true;
+        for (auto &thread : threads)
+            thread.join();
+        threads.clear();
+        CHECK(0 == found.load());
+
+        for (auto obj : objs)
+            CHECK(last == migrate_lookup(obj));
+        for (int t = 0; t < 4; t++) {
+            threads.emplace_back([&, t] {
+                for (size_t i = t; i < objs.size(); i += 4)
+                    hfree(objs[i]);
+            });
+        }
+        for (auto &thread : threads)
+            thread.join();
+        for (auto obj : objs)
+            CHECK(-1 == migrate_lookup(obj));
+    }
+
+    SECTION("batch with status") {
+        void *ptr = hmmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+        void *obj = hmalloc(size);
+        std::vector<int> status(size / sysconf(_SC_PAGESIZE));
+        REQUIRE(MAP_FAILED != ptr);
+        REQUIRE(obj);
+        memset(ptr, 0xff, size);
+        memset(obj, 0xff, size);
+
+        struct hmove moves[] = {
+            {ptr, size, last, status.data()},
+            {obj, 0, last, nullptr},
+        };
+        CHECK(0 == hmove(moves, 2, 0));
+        CHECK(std::all_of(status.begin(), status.end(), [=](int s) { return s == last; }));
+        CHECK(0 == pages_not_on(ptr, size, last));
+        CHECK(0 == pages_not_on(obj, size, last));
+
+        /* the pages faulted later follow the new memory policy */
+        mempolicy_test(MPOL_PREFERRED, 1UL << last, sizeof(unsigned long) * 8, ptr);
+
+        CHECK(0 == hmunmap(ptr, size));
+        hfree(obj);
+    }
+
+    SECTION("hmove_async") {
+        void *ptr = hmalloc(size);
+        REQUIRE(ptr);
+        memset(ptr, 0xff, size);
+
+        struct result {
+            std::mutex lock;
+            std::condition_variable cond;
+            bool done = false;
+            long ret = -1;
+        } result;
+
+        struct hmove move = {ptr, 0, last, nullptr};
+        auto callback = [](struct hmove *, size_t, long ret, void *arg) {
+            auto *r = static_cast<struct result *>(arg);
+            std::lock_guard<std::mutex> guard(r->lock);
+            r->ret = ret;
+            r->done = true;
+            r->cond.notify_one();
+        };
+        REQUIRE(0 == hmove_async(&move, 1, 0, callback, &result));
+
+        std::unique_lock<std::mutex> guard(result.lock);
+        result.cond.wait(guard, [&] { return result.done; });
+        CHECK(0 == result.ret);
+        CHECK(0 == pages_not_on(ptr, size, last));
+        hfree(ptr);
+    }
+
+    numa_free_nodemask(mask);
+}
+
+TEST_CASE("hmalloc_where") {
+    struct bitmask *mask = numa_get_mems_allowed();
+    int node = ffs(*mask->maskp) - 1;
+    std::vector<size_t> counts(HMALLOC_MAX_NODES);
+    size_t size = 4 * mb;
+
+    SECTION("invalid arguments") {
+        CHECK(-1 == hmalloc_where(nullptr, size, counts.data(), counts.size()));
+        CHECK(EINVAL == errno);
+        CHECK(-1 == hmalloc_where(&size, sizeof(size), nullptr, 1));
+        CHECK(EINVAL == errno);
+        CHECK(-1 == hmalloc_placement_report(nullptr, nullptr, 1));
+        CHECK(EINVAL == errno);
+    }
+
+    SECTION("object") {
+        void *ptr = hmalloc_node(size, node);
+        REQUIRE(ptr);
+
+        memset(ptr, 0xff, size);
+
+        /* the object may not start at a page boundary */
+        ssize_t resident = hmalloc_where(ptr, 0, counts.data(), counts.size());
+        CHECK(resident >= (ssize_t)size);
+        CHECK((size_t)resident == counts[node]);
+        hfree(ptr);
+    }
+
+    SECTION("sampled range") {
+        size_t large = 256 * mb;
+        void *ptr = hmmap(NULL, large, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+        REQUIRE(MAP_FAILED != ptr);
+        memset(ptr, 0xff, large / 2);
+
+        /* sampled pages stand for their neighbors so only the total is exact */
+        ssize_t resident = hmalloc_where(ptr, large, counts.data(), counts.size());
+        CHECK(resident >= (ssize_t)(large / 2 - large / 64));
+        CHECK(resident <= (ssize_t)(large / 2 + large / 64));
+        CHECK(0 == hmunmap(ptr, large));
+    }
+
+    SECTION("placement report") {
+        void *ptr = hmalloc_node(size, node);
+        char *buf = nullptr;
+        size_t len = 0;
+        REQUIRE(ptr);
+        memset(ptr, 0xff, size);
+
+        FILE *fp = open_memstream(&buf, &len);
+        REQUIRE(fp);
+        CHECK(0 == hmalloc_placement_report(fp, counts.data(), counts.size()));
+        fclose(fp);
+        CHECK(size <= counts[node]);
+        CHECK(nullptr != strstr(buf, "total resident="));
+        free(buf);
+        hfree(ptr);
+    }
+
+    numa_free_nodemask(mask);
+}
+
+TEST_CASE("hmpool") {
+    SECTION("alloc and free") {
+        hmpool_t *pool = hmpool_create(40, 0, nullptr);
+        std::vector<void *> objs;
+        REQUIRE(pool);
+
+        /* more than a slab */
+        for (int i = 0; i < 100000; i++) {
+            void *obj = hmpool_alloc(pool);
+            REQUIRE(obj);
+            CHECK(0 == reinterpret_cast<uintptr_t>(obj) % 8);
+            memset(obj, 0xff, 40);
+            objs.push_back(obj);
+        }
+
+        /* objects are packed without headers or size class rounding */
+        std::sort(objs.begin(), objs.end());
+        CHECK(40 == static_cast<char *>(objs[1]) - static_cast<char *>(objs[0]));
+
+        for (void *obj : objs)
+            hmpool_free(pool, obj);
+
+        /* freed objects are reused */
+        void *obj = hmpool_alloc(pool);
+        CHECK(std::binary_search(objs.begin(), objs.end(), obj));
+        hmpool_free(pool, obj);
+        hmpool_free(pool, nullptr);
+
+        hmpool_destroy(pool);
+    }
+
+    SECTION("alignment") {
+        hmpool_t *pool = hmpool_create(100, 256, nullptr);
+        REQUIRE(pool);
+
+        for (int i = 0; i < 100; i++) {
+            void *obj = hmpool_alloc(pool);
+            REQUIRE(obj);
+            CHECK(0 == reinterpret_cast<uintptr_t>(obj) % 256);
+        }
+        hmpool_destroy(pool);
+
+        CHECK(nullptr == hmpool_create(64, 48, nullptr));
+        CHECK(EINVAL == errno);
+        CHECK(nullptr == hmpool_create(1 * gb, 0, nullptr));
+        CHECK(EINVAL == errno);
+    }
+
+    SECTION("remote free") {
+        hmpool_t *pool = hmpool_create(64, 0, nullptr);
+        std::vector<void *> objs(10000);
+        REQUIRE(pool);
+
+        std::thread([&]() {
+            for (auto &obj : objs)
+                obj = hmpool_alloc(pool);
+        }).join();
+
+        /* the owner has exited, so its slab is adopted with the remote frees */
+        for (void *obj : objs)
+            hmpool_free(pool, obj);
+        std::sort(objs.begin(), objs.end());
+
+        /* the rest of the slab is carved first, which is less than 2MB / 64 objects */
+        int reused = 0;
+        for (int i = 0; i < 40000; i++) {
+            if (std::binary_search(objs.begin(), objs.end(), hmpool_alloc(pool)))
+                reused++;
+        }
+        CHECK(10000 == reused);
+
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; t++) {
+            threads.emplace_back([pool]() {
+                for (int i = 0; i < 10000; i++)
+                    hmpool_free(pool, hmpool_alloc(pool));
+            });
+        }
+        for (auto &thread : threads)
+            thread.join();
+        hmpool_destroy(pool);
+    }
+
+    SECTION("full slabs") {
+        /* 31 objects fill a slab, so the objects of a slab are 31 in a row of the address */
+        hmpool_t *pool = hmpool_create(64 * kb, 0, nullptr);
+        std::vector<void *> objs(31 * 4), local, remote;
+        REQUIRE(pool);
+
+        for (auto &obj : objs) {
+            obj = hmpool_alloc(pool);
+            REQUIRE(obj);
+        }
+        std::sort(objs.begin(), objs.end());
+        local.assign(objs.begin(), objs.begin() + 31);
+        remote.assign(objs.begin() + 31, objs.begin() + 62);
+
+        /* the full slabs are taken again instead of new ones */
+        for (void *obj : local)
+            hmpool_free(pool, obj);
+        std::thread([&]() {
+            for (void *obj : remote)
+                hmpool_free(pool, obj);
+        }).join();
+
+        std::vector<void *> reused(62);
+        for (auto &obj : reused)
+            obj = hmpool_alloc(pool);
+        std::sort(reused.begin(), reused.end());
+        CHECK(std::equal(reused.begin(), reused.end(), objs.begin()));
+        hmpool_destroy(pool);
+    }
+
+    SECTION("policy") {
+        struct bitmask *mask = numa_get_mems_allowed();
+        int node = ffs(*mask->maskp) - 1;
+        numa_free_nodemask(mask);
+
+        unsigned long nodemask = 1UL << node;
+        auto *policy = hmalloc_policy_create(MPOL_BIND, &nodemask, sizeof(nodemask) * 8);
+        REQUIRE(policy);
+
+        hmpool_t *pool = hmpool_create(4096, 4096, policy);
+        REQUIRE(pool);
+        for (int i = 0; i < 100; i++) {
+            void *obj = hmpool_alloc(pool);
+            size_t counts[HMALLOC_MAX_NODES];
+
+            REQUIRE(obj);
+            memset(obj, 1, 4096);
+            REQUIRE(4096 == hmalloc_where(obj, 4096, counts, HMALLOC_MAX_NODES));
+            CHECK(4096 == counts[node]);
+        }
+        hmpool_destroy(pool);
+    }
+}
+
+TEST_CASE("hmarena") {
+    SECTION("alloc and reset") {
+        hmarena_t *arena = hmarena_create(nullptr, 64 * kb);
+        void *first = nullptr;
+        REQUIRE(arena);
+
+        for (int round = 0; round < 3; round++) {
+            void *ptr = hmarena_alloc(arena, 10);
+            REQUIRE(ptr);
+
+            /* the chunks are reused from the start after reset */
+            if (round == 0)
+                first = ptr;
+            CHECK(first == ptr);
+
+            for (int i = 0; i < 10000; i++) {
+                ptr = hmarena_alloc(arena, 100);
+                REQUIRE(ptr);
+                CHECK(0 == reinterpret_cast<uintptr_t>(ptr) % alignof(std::max_align_t));
+                memset(ptr, 0xff, 100);
+            }
+            hmarena_reset(arena);
+        }
+        hmarena_destroy(arena);
+    }
+
+    SECTION("larger than a chunk") {
+        hmarena_t *arena = hmarena_create(nullptr, 64 * kb);
+        REQUIRE(arena);
+
+        void *ptr = hmarena_aligned_alloc(arena, 4 * kb, 4 * mb);
+        REQUIRE(ptr);
+        CHECK(0 == reinterpret_cast<uintptr_t>(ptr) % (4 * kb));
+        memset(ptr, 0xff, 4 * mb);
+
+        CHECK(nullptr == hmarena_aligned_alloc(arena, 3, 10));
+        CHECK(EINVAL == errno);
+        CHECK(nullptr == hmarena_alloc(arena, SIZE_MAX - 10));
+        CHECK(ENOMEM == errno);
+        hmarena_destroy(arena);
+    }
+
+    SECTION("policy") {
+        struct bitmask *mask = numa_get_mems_allowed();
+        int node = ffs(*mask->maskp) - 1;
+        numa_free_nodemask(mask);
+
+        unsigned long nodemask = 1UL << node;
+        auto *policy = hmalloc_policy_create(MPOL_BIND, &nodemask, sizeof(nodemask) * 8);
+        REQUIRE(policy);
+
+        hmarena_t *arena = hmarena_create(policy, 0);
+        size_t counts[HMALLOC_MAX_NODES];
+        REQUIRE(arena);
+
+        void *ptr = hmarena_alloc(arena, 1 * mb);
+        REQUIRE(ptr);
+        memset(ptr, 1, 1 * mb);
+        CHECK(0 < hmalloc_where(ptr, 1 * mb, counts, HMALLOC_MAX_NODES));
+        CHECK(1 * mb <= counts[node]);
+        hmarena_destroy(arena);
+    }
+
+    SECTION("trim") {
+        hmarena_t *arena = hmarena_create(nullptr, 1 * mb);
+        REQUIRE(arena);
+
+        std::vector<char *> ptrs;
+        for (int i = 0; i < 8; i++) {
+            auto *ptr = static_cast<char *>(hmarena_alloc(arena, 512 * kb));
+            REQUIRE(ptr);
+            memset(ptr, 1, 512 * kb);
+            ptrs.push_back(ptr);
+        }
+        hmarena_reset(arena);
+
+        /* MADV_FREE releases the pages lazily so only the reuse is checked */
+        CHECK(0 == hmarena_trim(arena, 0));
+        for (int i = 0; i < 8; i++) {
+            auto *ptr = static_cast<char *>(hmarena_alloc(arena, 512 * kb));
+            CHECK(ptrs[i] == ptr);
+            memset(ptr, 1, 512 * kb);
+        }
+        hmarena_destroy(arena);
+    }
+
+    SECTION("null arena") {
+        hmarena_reset(nullptr);
+        CHECK(0 == hmarena_trim(nullptr, 0));
+        CHECK(nullptr == hmarena_alloc(nullptr, 10));
+        CHECK(EINVAL == errno);
+        hmarena_destroy(nullptr);
+    }
+}
+
+TEST_CASE("fallback") {
+    struct hmalloc_stats stats;
+
+    SECTION("disabled") {
+        REQUIRE(0 == hmalloc_stats(&stats));
+        CHECK(stats.pressured_nodes[0] == 0);
+        CHECK(stats.fallback_nodes[0] == 0);
+        CHECK(stats.nr_fallbacks == 0);
+    }
+
+    SECTION("pressure") {
+        /* skip this test without two nodes to fall back between */
+        struct bitmask *mask = numa_get_mems_allowed();
+        unsigned long nodemask = *mask->maskp;
+        int maxnode = numa_max_possible_node();
+        numa_bitmask_free(mask);
+        if (__builtin_popcountl(nodemask) < 2)
+            return;
+
+        int node = __builtin_ctzl(nodemask);
+        int fallback = __builtin_ctzl(nodemask & ~(1UL << node));
+        size_t size = 2 * mb;
+        char buf[32];
+
+        snprintf(buf, sizeof(buf), "%lu", 1UL << node);
+        setenv("HMALLOC_MPOL_MODE", "2", 1); /* MPOL_BIND is 2 */
+        setenv("HMALLOC_NODEMASK", buf, 1);
+        snprintf(buf, sizeof(buf), "%d", fallback);
+        setenv("HMALLOC_FALLBACK", buf, 1);
+        /* a node never has all its memory free, so it is always under pressure */
+        setenv("HMALLOC_FALLBACK_WATERMARK", "100%", 1);
+        update_env();
+        pressure_init();
+
+        REQUIRE(0 == hmalloc_stats(&stats));
+        CHECK(stats.pressured_nodes[0] & (1UL << node));
+        CHECK(stats.fallback_nodes[0] == 1UL << fallback);
+        CHECK(stats.effective_mode == MPOL_BIND);
+        CHECK(stats.effective_nodemask[0] == 1UL << fallback);
+        unsigned long nr_fallbacks = stats.nr_fallbacks;
+
+        /* new extents go to the fallback node */
+        void *addr = extent_alloc(nullptr, nullptr, size, 0, nullptr, nullptr, 0);
+        REQUIRE(addr);
+        mempolicy_test(MPOL_BIND, 1UL << fallback, maxnode, addr);
+        CHECK(0 == munmap(addr, size));
+
+        REQUIRE(0 == hmalloc_stats(&stats));
+        CHECK(stats.nr_fallbacks > nr_fallbacks);
+
+        unsetenv("HMALLOC_MPOL_MODE");
+        unsetenv("HMALLOC_NODEMASK");
+        unsetenv("HMALLOC_FALLBACK");
+        unsetenv("HMALLOC_FALLBACK_WATERMARK");
+        update_env();
+        pressure_init();
+
+        REQUIRE(0 == hmalloc_stats(&stats));
+        CHECK(stats.pressured_nodes[0] == 0);
+    }
+}